@@ -1,22 +1,76 @@
 #include <string.h>
+#include <esp_attr.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
 #include "app_lora.h"
+#include "app_radio.h"
 
-#ifdef CONFIG_SX126x
-#include "ra01s.h"
-#define DEFAULT_TCXO_VOLTAGE 3.3
-#define DEFAULT_USE_REGULATOR_LDO 1
+#if defined(CONFIG_SX126x)
+#define RADIO app_radio_sx126x
+#elif defined(CONFIG_SX127x)
+#define RADIO app_radio_sx127x
 #else
-#include "lora.h"
+#define RADIO app_radio_sim
 #endif
 
+/*
+ * The radio task is the only one that touches the modem. Everything else,
+ * configuring it, transmitting and starting or stopping reception, is a
+ * command queued to it, and its task notification is the doorbell for both
+ * new commands and the radio's RX done interrupt. Parameters are merged into
+ * the requested parameters as the command is queued, so that commands queued
+ * later build on them, and the radio task keeps what it last applied.
+ */
+
+// Frames waiting for the decode task, a full queue drops new frames
+#define RX_QUEUE_LEN 8
+#define CMD_QUEUE_LEN 4
+// Only a safety net in case an interrupt edge is missed
+#define RX_IRQ_WAIT_TICKS pdMS_TO_TICKS(1000)
+
+typedef enum {
+    RADIO_CMD_CONFIGURE,
+    RADIO_CMD_TX,
+    RADIO_CMD_STOP_TX,
+    RADIO_CMD_START_RX,
+    RADIO_CMD_STOP_RX,
+    RADIO_CMD_CAD,
+} radio_cmd_type_t;
+
+typedef struct {
+    radio_cmd_type_t type;
+    app_lora_params_t params;  // CONFIGURE and CAD
+    char msg[PAYLOAD_LEN_MAX + 1];  // TX
+    uint32_t repeat_interval_ms;    // TX, 0 to send once
+    bool *detected;                 // CAD
+    // Signaled once the command has been carried out, if not NULL
+    TaskHandle_t notify;
+    SemaphoreHandle_t done;
+    esp_err_t *result;
+} radio_cmd_t;
+
 static const char *TAG = "app_lora";
-static TaskHandle_t xRxTask = NULL;
-static TaskHandle_t xTxTask = NULL;
-static SemaphoreHandle_t xRadioSemaphore = NULL;
+static const app_radio_t *radio = &RADIO;
+static TickType_t rx_wait_ticks = 1;
+static TaskHandle_t xRadioTask = NULL;
+static TaskHandle_t xDecodeTask = NULL;
+static SemaphoreHandle_t xParamsMutex = NULL;
+static QueueHandle_t xCmdQueue = NULL;
+static QueueHandle_t xRxQueue = NULL;
+static SemaphoreHandle_t xDecodeStopped = NULL;
+static app_lora_rx_stats_t rx_stats;
+static app_lora_retune_stats_t retune_stats;
+
+// Owned by the radio task
+static app_lora_params_t applied_params;
+static bool receiving = false;
+static char repeat_msg[PAYLOAD_LEN_MAX + 1];
+static uint32_t repeat_interval_ms = 0;
+static TickType_t next_repeat = 0;
 
 static app_lora_params_t radio_params = {.tx_power = DEFAULT_TX_POWER,
                                          .frequency = DEFAULT_FREQ,
@@ -33,10 +87,12 @@ static bool range_check(int val, int min, int max) {
     return (min <= val && val <= max);
 }
 
-static int validate_params(app_lora_params_t *in_params) {
+/* Merge the valid non-zero fields of in_params into params */
+static int validate_params(app_lora_params_t *params,
+                           const app_lora_params_t *in_params) {
     if (in_params->tx_power) {
         if (range_check(in_params->tx_power, TX_POWER_MIN, TX_POWER_MAX)) {
-            radio_params.tx_power = in_params->tx_power;
+            params->tx_power = in_params->tx_power;
         } else {
             ESP_LOGE(TAG, "invalid tx power %d", in_params->tx_power);
         }
@@ -44,7 +100,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->frequency) {
         if (range_check(in_params->frequency, FREQ_MIN, FREQ_MAX)) {
-            radio_params.frequency = in_params->frequency;
+            params->frequency = in_params->frequency;
         } else {
             ESP_LOGE(TAG, "invalid frequency %d", in_params->frequency);
         }
@@ -52,7 +108,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->bandwidth) {
         if (range_check(in_params->bandwidth, BW_MIN, BW_MAX)) {
-            radio_params.bandwidth = in_params->bandwidth;
+            params->bandwidth = in_params->bandwidth;
         } else {
             ESP_LOGE(TAG, "invalid bandwidth %d", in_params->bandwidth);
         }
@@ -60,7 +116,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->spreading_factor) {
         if (range_check(in_params->spreading_factor, SF_MIN, SF_MAX)) {
-            radio_params.spreading_factor = in_params->spreading_factor;
+            params->spreading_factor = in_params->spreading_factor;
         } else {
             ESP_LOGE(TAG, "invalid spreading_factor %d",
                      in_params->spreading_factor);
@@ -69,7 +125,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->preamble_len) {
         if (range_check(in_params->preamble_len, PREAMBLE_MIN, PREAMBLE_MAX)) {
-            radio_params.preamble_len = in_params->preamble_len;
+            params->preamble_len = in_params->preamble_len;
         } else {
             ESP_LOGE(TAG, "invalid preamble length %d",
                      in_params->preamble_len);
@@ -78,7 +134,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->sync_word) {
         if (range_check(in_params->sync_word, SYNC_WORD_MIN, SYNC_WORD_MAX)) {
-            radio_params.sync_word = in_params->sync_word;
+            params->sync_word = in_params->sync_word;
         } else {
             ESP_LOGE(TAG, "invalid sync word %d", in_params->sync_word);
         }
@@ -86,7 +142,7 @@ static int validate_params(app_lora_params_t *in_params) {
 
     if (in_params->coding_rate) {
         if (range_check(in_params->coding_rate, CR_MIN, CR_MAX)) {
-            radio_params.coding_rate = in_params->coding_rate;
+            params->coding_rate = in_params->coding_rate;
         } else {
             ESP_LOGE(TAG, "invalid coding rate %d", in_params->coding_rate);
         }
@@ -95,202 +151,368 @@ static int validate_params(app_lora_params_t *in_params) {
     return ESP_OK;
 }
 
-static void tx_msg(char *msg) {
-    size_t len = strlen(msg);
-    if (xSemaphoreTake(xRadioSemaphore, portMAX_DELAY)) {
-#ifdef CONFIG_SX126x
-        if (!LoRaSend((uint8_t *)msg, len, SX126x_TXMODE_SYNC)) {
-            ESP_LOGE(TAG, "Send fail");
-        }
-#else
-        lora_send_packet((uint8_t *)msg, len);
-        if (xRxTask) {
-            lora_receive();
+/* Field by field, memcmp would also compare the padding between them */
+bool app_lora_params_equal(const app_lora_params_t *a,
+                           const app_lora_params_t *b) {
+    return a->tx_power == b->tx_power && a->frequency == b->frequency &&
+           a->bandwidth == b->bandwidth &&
+           a->spreading_factor == b->spreading_factor &&
+           a->preamble_len == b->preamble_len &&
+           a->sync_word == b->sync_word &&
+           a->implicit_hdr == b->implicit_hdr && a->msg_len == b->msg_len &&
+           a->coding_rate == b->coding_rate && a->crc_on == b->crc_on;
+}
+
+static void log_params(const app_lora_params_t *params) {
+    ESP_LOGD(TAG,
+             "New radio parameters set\n f=%d\n bw=%d\n sf=%d\n "
+             "tx_power=%d\n cr=%d\n sync=%x\n impl_hdr=%d\n crc_on=%d\n",
+             params->frequency, params->bandwidth, params->spreading_factor,
+             params->tx_power, params->coding_rate, params->sync_word,
+             params->implicit_hdr, params->crc_on);
+}
+
+static void account_retune(app_lora_timing_t *timing, uint32_t us) {
+    timing->count++;
+    timing->last_us = us;
+    timing->max_us = us > timing->max_us ? us : timing->max_us;
+    timing->total_us += us;
+}
+
+static esp_err_t apply_params(const app_lora_params_t *params) {
+    app_lora_params_t retuned = applied_params;
+    app_lora_timing_t *timing = &retune_stats.full;
+    esp_err_t err = ESP_OK;
+    int64_t start;
+    if (!app_lora_params_equal(params, &applied_params)) {
+        // The drivers take a fast path when only the frequency changes
+        retuned.frequency = params->frequency;
+        if (app_lora_params_equal(params, &retuned)) {
+            timing = &retune_stats.frequency;
         }
-#endif
-        ESP_LOGI(TAG, "%d bytes transmitted (%s)", len, msg);
-        xSemaphoreGive(xRadioSemaphore);
+        start = esp_timer_get_time();
+        err = radio->configure(params);
+        account_retune(timing, esp_timer_get_time() - start);
+        applied_params = *params;
+        log_params(params);
     }
+    return err;
+}
+
+static esp_err_t tx_msg(const char *msg) {
+    size_t len = strlen(msg);
+    esp_err_t err = radio->send((const uint8_t *)msg, len);
+    ESP_LOGI(TAG, "%d bytes transmitted (%s)", len, msg);
+    return err;
 }
 
-static void tx_task(void *pvParameter) {
-    if (pvParameter) {
-        app_lora_tx_msg_t *args = (app_lora_tx_msg_t *)pvParameter;
-        char msg[PAYLOAD_LEN_MAX];
-        strncpy(msg, args->msg, PAYLOAD_LEN_MAX);
-        xTaskNotifyGive(args->sending_task);
-        uint32_t interval = args->repeat_interval_ms;
-
-        ESP_LOGI(TAG, "Starting LoRa Tx msg='%s' interval=%dms", msg, interval);
-        while (1) {
-            tx_msg(msg);
-            vTaskDelay(pdMS_TO_TICKS(interval));
+/* Wakes the radio task when the radio signals that a packet is done */
+static void IRAM_ATTR rx_done() {
+    BaseType_t task_woken = pdFALSE;
+    if (!xRadioTask) {
+        return;
+    }
+    if (xPortInIsrContext()) {
+        vTaskNotifyGiveFromISR(xRadioTask, &task_woken);
+        if (task_woken) {
+            portYIELD_FROM_ISR();
         }
+    } else {
+        xTaskNotifyGive(xRadioTask);
+    }
+}
+
+/* Hand a frame over to the decode task without ever waiting on it */
+static void queue_frame(const app_lora_frame_t *frame) {
+    UBaseType_t queued;
+    rx_stats.received++;
+    if (xQueueSend(xRxQueue, frame, 0) != pdTRUE) {
+        rx_stats.dropped++;
+        ESP_LOGW(TAG, "Receive queue full, %d frames dropped",
+                 rx_stats.dropped);
+        return;
+    }
+    queued = uxQueueMessagesWaiting(xRxQueue);
+    if (queued > rx_stats.max_queued) {
+        rx_stats.max_queued = queued;
     }
 }
 
-static void rx_task(void *pvParameter) {
+static void read_frames() {
+    app_lora_frame_t frame;
+    app_radio_status_t status;
     int msg_len;
-    uint8_t buf[255];
-    void (*cb)(const char *, const int) = pvParameter;
-    ESP_LOGI(TAG, "Starting LoRa Rx");
-    while (1) {
-        msg_len = 0;
-        if (xSemaphoreTake(xRadioSemaphore, (TickType_t)10)) {
-#ifdef CONFIG_SX126x
-            msg_len = LoRaReceive(buf, sizeof(buf));
-            if (msg_len > 0) {
-                int8_t rssi, snr;
-                buf[msg_len] = 0;
-                GetPacketStatus(&rssi, &snr);
-                ESP_LOGI(TAG, "Packet received - Size: %d RSSI: %d, SNR: %d",
-                         msg_len, rssi, snr);
-                ESP_LOGI(TAG, "%s", buf);
+    while ((msg_len = radio->receive((uint8_t *)frame.payload,
+                                     PAYLOAD_LEN_MAX)) > 0) {
+        radio->status(&status);
+        frame.len = msg_len;
+        frame.payload[msg_len] = 0;
+        frame.rssi = status.rssi;
+        frame.snr = status.snr;
+        frame.timestamp = esp_timer_get_time();
+        queue_frame(&frame);
+    }
+}
+
+static void run_cmd(radio_cmd_t *cmd) {
+    esp_err_t err = ESP_OK;
+    switch (cmd->type) {
+        case RADIO_CMD_CONFIGURE:
+            err = apply_params(&cmd->params);
+            break;
+        case RADIO_CMD_TX:
+            err = tx_msg(cmd->msg);
+            if (cmd->repeat_interval_ms) {
+                ESP_LOGI(TAG, "Starting LoRa Tx msg='%s' interval=%dms",
+                         cmd->msg, cmd->repeat_interval_ms);
+                strcpy(repeat_msg, cmd->msg);
+                repeat_interval_ms = cmd->repeat_interval_ms;
+                next_repeat =
+                    xTaskGetTickCount() + pdMS_TO_TICKS(repeat_interval_ms);
             }
-#else
-            lora_receive();
-            while (lora_received()) {
-                msg_len = lora_receive_packet(buf, sizeof(buf));
-                int rssi = lora_packet_rssi();
-                float snr = lora_packet_snr();
-                buf[msg_len] = 0;
-                ESP_LOGI(TAG, "Packet received - Size: %d RSSI: %d, SNR: %f",
-                         msg_len, rssi, snr);
-                ESP_LOGI(TAG, "%s", buf);
-                lora_receive();
+            break;
+        case RADIO_CMD_STOP_TX:
+            if (repeat_interval_ms) {
+                ESP_LOGI(TAG, "Stopping LoRa Tx");
+                repeat_interval_ms = 0;
             }
-#endif
-            xSemaphoreGive(xRadioSemaphore);
-            if (msg_len > 0) {
-                cb((char *)buf, msg_len);
+            break;
+        case RADIO_CMD_START_RX:
+            ESP_LOGI(TAG, "Starting LoRa Rx");
+            err = radio->start_rx();
+            receiving = true;
+            break;
+        case RADIO_CMD_STOP_RX:
+            ESP_LOGI(TAG, "Stopping LoRa Rx");
+            err = radio->stop_rx();
+            receiving = false;
+            break;
+        case RADIO_CMD_CAD:
+            err = apply_params(&cmd->params);
+            if (!err) {
+                err = radio->cad(cmd->detected);
             }
-        }
-        vTaskDelay(1);
+            break;
+    }
+    if (cmd->result) {
+        *cmd->result = err;
+    }
+    if (cmd->done) {
+        xSemaphoreGive(cmd->done);
+    }
+    if (cmd->notify) {
+        xTaskNotifyGive(cmd->notify);
     }
 }
 
-int app_lora_start_tx(app_lora_tx_msg_t *args) {
-    if (args->repeat_interval_ms > 0) {
-        if (!xTxTask) {
-            xTaskCreate(&tx_task, "app_lora_tx_task", 3072, args, 5, &xTxTask);
-            return ESP_OK;
+static void radio_task(void *pvParameter) {
+    radio_cmd_t cmd;
+    TickType_t wait, now;
+    while (1) {
+        wait = receiving ? rx_wait_ticks : portMAX_DELAY;
+        if (repeat_interval_ms) {
+            now = xTaskGetTickCount();
+            TickType_t until_repeat =
+                (int32_t)(next_repeat - now) > 0 ? next_repeat - now : 0;
+            if (until_repeat < wait) {
+                wait = until_repeat;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+        while (xQueueReceive(xCmdQueue, &cmd, 0) == pdTRUE) {
+            run_cmd(&cmd);
+        }
+        if (repeat_interval_ms &&
+            (int32_t)(xTaskGetTickCount() - next_repeat) >= 0) {
+            tx_msg(repeat_msg);
+            next_repeat += pdMS_TO_TICKS(repeat_interval_ms);
+        }
+        if (receiving) {
+            read_frames();
         }
-        ESP_LOGI(TAG, "app_lora_tx_task already started");
-        return ESP_FAIL;
     }
-    // Transmit one message only, don't start new task
-    tx_msg(args->msg);
-    xTaskNotifyGive(args->sending_task);
+}
+
+static esp_err_t send_cmd(const radio_cmd_t *cmd) {
+    if (!xRadioTask) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xQueueSend(xCmdQueue, cmd, portMAX_DELAY);
+    xTaskNotifyGive(xRadioTask);
     return ESP_OK;
 }
 
-int app_lora_start_rx(void (*cb)(const char *, const int)) {
-    if (!xRxTask) {
-        xTaskCreate(&rx_task, "app_lora_rx_task", 3072, cb, 5, &xRxTask);
-        return ESP_OK;
+/* Queue a command and wait until the radio task has carried it out */
+static esp_err_t send_cmd_wait(radio_cmd_t *cmd) {
+    StaticSemaphore_t done_buf;
+    esp_err_t err = ESP_FAIL;
+    cmd->done = xSemaphoreCreateBinaryStatic(&done_buf);
+    cmd->result = &err;
+    if (send_cmd(cmd) == ESP_OK) {
+        xSemaphoreTake(cmd->done, portMAX_DELAY);
     }
-    ESP_LOGI(TAG, "app_lora_rx_task already started");
+    vSemaphoreDelete(cmd->done);
+    return err;
+}
+
+/* Merge in_params into the requested parameters and return a copy of them */
+static void update_params(const app_lora_params_t *in_params,
+                          app_lora_params_t *out_params) {
+    if (xSemaphoreTake(xParamsMutex, portMAX_DELAY)) {
+        if (in_params) {
+            validate_params(&radio_params, in_params);
+        }
+        *out_params = radio_params;
+        xSemaphoreGive(xParamsMutex);
+    }
+}
+
+/*
+ * Runs the receive callback for every frame until it takes an empty frame,
+ * which app_lora_stop_rx() queues to stop it. The task then deletes itself,
+ * so it never goes away in the middle of the callback.
+ */
+static void decode_task(void *pvParameter) {
+    app_lora_frame_t frame;
+    app_lora_rx_cb_t cb = pvParameter;
+    while (1) {
+        if (xQueueReceive(xRxQueue, &frame, portMAX_DELAY) == pdTRUE) {
+            if (!frame.len) {
+                break;
+            }
+            ESP_LOGD(TAG, "Packet received - Size: %d RSSI: %d, SNR: %.1f",
+                     frame.len, frame.rssi, frame.snr);
+            ESP_LOGD(TAG, "%s", frame.payload);
+            if (cb) {
+                cb(&frame);
+            }
+            ESP_LOGD(TAG, "Packet handled %lld us after it was received",
+                     esp_timer_get_time() - frame.timestamp);
+        }
+    }
+    xSemaphoreGive(xDecodeStopped);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Transmit args->msg, then every repeat_interval_ms if it isn't 0, replacing
+ * any message already being repeated. args->sending_task is notified once
+ * the message has been sent.
+ */
+int app_lora_start_tx(app_lora_tx_msg_t *args) {
+    radio_cmd_t cmd = {.type = RADIO_CMD_TX,
+                       .repeat_interval_ms = args->repeat_interval_ms,
+                       .notify = args->sending_task};
+    strlcpy(cmd.msg, args->msg, sizeof(cmd.msg));
+    return send_cmd(&cmd);
+}
+
+int app_lora_start_rx(app_lora_rx_cb_t cb) {
+    radio_cmd_t cmd = {.type = RADIO_CMD_START_RX};
+    if (!xDecodeTask) {
+        xTaskCreate(&decode_task, "app_lora_decode_task", 3072, cb, 5,
+                    &xDecodeTask);
+        return send_cmd(&cmd);
+    }
+    ESP_LOGI(TAG, "app_lora_decode_task already started");
     return ESP_FAIL;
 }
 
 int app_lora_stop_tx() {
-    if (xTxTask) {
-        ESP_LOGI(TAG, "Stopping LoRa Tx");
-        vTaskDelete(xTxTask);
-        xTxTask = NULL;
-    }
-    return ESP_OK;
+    radio_cmd_t cmd = {.type = RADIO_CMD_STOP_TX};
+    return send_cmd(&cmd);
 }
 
+/* Not from the receive callback, the decode task is waited on to stop */
 int app_lora_stop_rx() {
-    if (xRxTask) {
-        ESP_LOGI(TAG, "Stopping LoRa Rx");
-        vTaskDelete(xRxTask);
-        xRxTask = NULL;
+    radio_cmd_t cmd = {.type = RADIO_CMD_STOP_RX};
+    app_lora_frame_t stop = {.len = 0};
+    if (xDecodeTask) {
+        if (xTaskGetCurrentTaskHandle() == xDecodeTask) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        send_cmd_wait(&cmd);
+        // Ahead of the frames still queued, which are dropped
+        xQueueSendToFront(xRxQueue, &stop, portMAX_DELAY);
+        xSemaphoreTake(xDecodeStopped, portMAX_DELAY);
+        xDecodeTask = NULL;
+        xQueueReset(xRxQueue);
     }
     return ESP_OK;
 }
 
+/* The parameters as last requested, the radio gets them once it is free */
 int app_lora_get_params(app_lora_params_t *out_params) {
     if (out_params) {
-        memcpy(out_params, &radio_params, sizeof(app_lora_params_t));
+        update_params(NULL, out_params);
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
-int app_lora_set_params(app_lora_params_t *in_params,
-                        xTaskHandle calling_task) {
-    if (validate_params(in_params) == ESP_OK) {
-        if (xSemaphoreTake(xRadioSemaphore, portMAX_DELAY)) {
-#ifdef CONFIG_SX126x
-            LoRaConfig(radio_params.spreading_factor, radio_params.bandwidth,
-                       radio_params.coding_rate, radio_params.preamble_len, 0,
-                       radio_params.crc_on, false);
-            SetRfFrequency(radio_params.frequency);
-            SetRx(0xFFFFFF);
-#else
-            ESP_LOGD(TAG, "Setting radio parameters");
-            lora_idle();
-            ESP_LOGD(TAG, "  Frequency %d", radio_params.frequency);
-            lora_set_frequency(radio_params.frequency);
-            ESP_LOGD(TAG, "  Bandwidth %d", radio_params.bandwidth);
-            lora_set_bandwidth(radio_params.bandwidth);
-            ESP_LOGD(TAG, "  Spreading Factor %d",
-                     radio_params.spreading_factor);
-            lora_set_spreading_factor(radio_params.spreading_factor);
-            ESP_LOGD(TAG, "  Transmit Power %d", radio_params.tx_power);
-            lora_set_tx_power(radio_params.tx_power);
-            ESP_LOGD(TAG, "  Coding Rate %d", radio_params.coding_rate);
-            lora_set_coding_rate(radio_params.coding_rate);
-            ESP_LOGD(TAG, "  Sync Word %d", radio_params.sync_word);
-            lora_set_sync_word(radio_params.sync_word);
-            ESP_LOGD(TAG, "  Implicit Header %d", radio_params.implicit_hdr);
-            if (radio_params.implicit_hdr) {
-                lora_explicit_header_mode();
-            } else {
-                // lora_implicit_header_mode(radio_params.payload_len);
-            }
-            ESP_LOGD(TAG, "  CRC Enable %d", radio_params.crc_on);
-            if (radio_params.crc_on)
-                lora_enable_crc();
-            else {
-                lora_disable_crc();
-            }
-#endif
-            xSemaphoreGive(xRadioSemaphore);
-        }
+int app_lora_get_rx_stats(app_lora_rx_stats_t *out_stats) {
+    if (out_stats) {
+        memcpy(out_stats, &rx_stats, sizeof(app_lora_rx_stats_t));
+        return ESP_OK;
+    }
+    return ESP_FAIL;
+}
 
-        if (calling_task) {
-            xTaskNotifyGive(calling_task);
-            ESP_LOGD(
-                TAG,
-                "New radio parameters set\n f=%d\n bw=%d\n sf=%d\n "
-                "tx_power=%d\n cr=%d\n sync=%x\n impl_hdr=%d\n crc_on=%d\n",
-                radio_params.frequency, radio_params.bandwidth,
-                radio_params.spreading_factor, radio_params.tx_power,
-                radio_params.coding_rate, radio_params.sync_word,
-                radio_params.implicit_hdr, radio_params.crc_on);
-        }
+/* How long reconfiguring the radio took, frequency changes apart */
+int app_lora_get_retune_stats(app_lora_retune_stats_t *out_stats) {
+    if (out_stats) {
+        memcpy(out_stats, &retune_stats, sizeof(app_lora_retune_stats_t));
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
+/* calling_task, if not NULL, is notified once the radio has been configured */
+int app_lora_set_params(app_lora_params_t *in_params,
+                        xTaskHandle calling_task) {
+    radio_cmd_t cmd = {.type = RADIO_CMD_CONFIGURE, .notify = calling_task};
+    update_params(in_params, &cmd.params);
+    return send_cmd(&cmd);
+}
+
+bool app_lora_has_cad() { return radio->cad != NULL; }
+
+/* Tune to frequency and check it for a preamble */
+int app_lora_cad(uint32_t frequency, bool *detected) {
+    app_lora_params_t params = {.frequency = frequency};
+    radio_cmd_t cmd = {.type = RADIO_CMD_CAD, .detected = detected};
+    *detected = false;
+    if (!range_check(frequency, FREQ_MIN, FREQ_MAX)) {
+        ESP_LOGE(TAG, "invalid frequency %d", frequency);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!radio->cad) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    update_params(&params, &cmd.params);
+    return send_cmd_wait(&cmd);
+}
+
 int app_lora_init() {
-    int error;
-#ifdef CONFIG_SX126x
-    LoRaInit();
-    error = LoRaBegin(radio_params.frequency, DEFAULT_TX_POWER,
-                      DEFAULT_TCXO_VOLTAGE, DEFAULT_USE_REGULATOR_LDO);
-#else
-    error = lora_init() ? 0 : 1;
-#endif
-    if (!error) {
-        xRadioSemaphore = xSemaphoreCreateBinary();
-        xSemaphoreGive(xRadioSemaphore);
+    if (radio->init(&radio_params) == ESP_OK) {
+        xParamsMutex = xSemaphoreCreateMutex();
+        xCmdQueue = xQueueCreate(CMD_QUEUE_LEN, sizeof(radio_cmd_t));
+        xRxQueue = xQueueCreate(RX_QUEUE_LEN, sizeof(app_lora_frame_t));
+        xDecodeStopped = xSemaphoreCreateBinary();
+        if (!xParamsMutex || !xCmdQueue || !xRxQueue || !xDecodeStopped) {
+            ESP_LOGE(TAG, "Unable to create radio queues");
+            return ESP_FAIL;
+        }
+        if (radio->set_rx_done(rx_done) == ESP_OK) {
+            rx_wait_ticks = RX_IRQ_WAIT_TICKS;
+        } else {
+            ESP_LOGW(TAG, "No receive interrupt, polling the radio");
+        }
+        // Frames are read as soon as they arrive, ahead of decoding
+        xTaskCreate(&radio_task, "app_lora_radio_task", 3072, NULL, 6,
+                    &xRadioTask);
         app_lora_set_params(&radio_params, NULL);
-        ESP_LOGI(TAG, "LoRa module initialized");
+        ESP_LOGI(TAG, "%s LoRa module initialized", radio->name);
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Error initializing LoRa");
@@ -60,12 +60,46 @@ typedef struct {
     TaskHandle_t sending_task;
 } app_lora_tx_msg_t;
 
+typedef struct {
+    char payload[PAYLOAD_LEN_MAX + 1];  // null terminated
+    uint8_t len;
+    int16_t rssi;       // dBm
+    float snr;          // dB
+    int64_t timestamp;  // esp_timer_get_time() when received
+} app_lora_frame_t;
+
+typedef struct {
+    uint32_t received;
+    uint32_t dropped;  // Queue full, the decode task fell behind
+    uint32_t max_queued;
+} app_lora_rx_stats_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} app_lora_timing_t;
+
+typedef struct {
+    app_lora_timing_t frequency;  // Only the frequency changed
+    app_lora_timing_t full;
+} app_lora_retune_stats_t;
+
+typedef void (*app_lora_rx_cb_t)(const app_lora_frame_t* frame);
+
 int app_lora_start_tx(app_lora_tx_msg_t* task_arg);
-int app_lora_start_rx(void (*cb)(const char*, const int));
+int app_lora_start_rx(app_lora_rx_cb_t cb);
 int app_lora_stop_tx();
 int app_lora_stop_rx();
+bool app_lora_params_equal(const app_lora_params_t* a,
+                           const app_lora_params_t* b);
 int app_lora_get_params(app_lora_params_t* out_params);
+int app_lora_get_rx_stats(app_lora_rx_stats_t* out_stats);
+int app_lora_get_retune_stats(app_lora_retune_stats_t* out_stats);
 int app_lora_set_params(app_lora_params_t* in_params, xTaskHandle calling_task);
+bool app_lora_has_cad();
+int app_lora_cad(uint32_t frequency, bool* detected);
 int app_lora_init();
 
 #endif
@@ -1,16 +1,23 @@
+#include <math.h>
 #include <stdlib.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <cJSON.h>
 #include <mqtt_client.h>
 #include <nvs.h>
 #include "app_mqtt.h"
+#include "app_mqtt_backlog.h"
+#include "app_mqtt_json.h"
 #include "smoke_x.h"
 
 #define NVS_NAMESPACE "mqtt_config"
 #define MQTT_BUF_SIZE 1024
-
-#define BOOL_TO_STR(b) b ? "ON" : "OFF"
+// Initial size of a device's discovery cache, it grows as needed
+#define DISCOVERY_CACHE_SIZE 4096
 
 // Home Assistant specific things
 // https://www.home-assistant.io/docs/mqtt/discovery/
@@ -21,27 +28,126 @@
 #define HASS_DEVICE "dev"
 #define HASS_DEVICE_CLASS "dev_cla"
 #define HASS_DEVICE_NAME "name"
+#define HASS_ENTITY_CATEGORY "ent_cat"
 #define HASS_EXPIRE_AFTER "exp_aft"
 #define HASS_PAYLOAD_NOT_AVAIL "pl_not_avail"
 #define HASS_STATE_TOPIC "stat_t"
 #define HASS_UNIT_OF_MEASUREMENT "unit_of_meas"
 #define HASS_VALUE_TEMPLATE "val_tpl"
-
-static app_mqtt_params_t app_mqtt_params = {.uri = NULL,
-                                            .identity = NULL,
-                                            .username = NULL,
-                                            .password = NULL,
-                                            .ca_cert = NULL,
-                                            .enabled = false,
-                                            .ha_discovery = false,
-                                            .ha_base_topic = NULL,
-                                            .ha_status_topic = NULL,
-                                            .ha_birth_payload = NULL,
-                                            .state_topic = NULL};
+// Seconds without a state before Home Assistant shows the device unavailable
+#define EXPIRE_AFTER_MIN 120
+#define HISTORY_TOPIC "history"
+// How often the backlog is checked for states that couldn't be published
+#define BACKLOG_RETRY_MS 5000
+#define BACKLOG_PUBACK_TIMEOUT_MS 10000
+#define ACKED_MSG_IDS_LEN 8
+// Link quality changes published without waiting for the heartbeat
+#define LINK_RSSI_DEADBAND 3    // dB
+#define LINK_SNR_DEADBAND 1.0   // dB
+#define LINK_LOSS_DEADBAND 0.01  // 1 percentage point
+
+static app_mqtt_params_t app_mqtt_params = {
+    .uri = NULL,
+    .identity = NULL,
+    .username = NULL,
+    .password = NULL,
+    .ca_cert = NULL,
+    .enabled = false,
+    .ha_discovery = false,
+    .ha_base_topic = NULL,
+    .ha_status_topic = NULL,
+    .ha_birth_payload = NULL,
+    .state_topic = NULL,
+    .deadband = APP_MQTT_DEFAULT_DEADBAND,
+    .min_interval = APP_MQTT_DEFAULT_MIN_INTERVAL,
+    .max_interval = APP_MQTT_DEFAULT_MAX_INTERVAL,
+    .sensor_topics = false,
+};
 static esp_mqtt_client_handle_t client = NULL;
 static bool connected = false;
 static const char *TAG = "app_mqtt";
 static bool discovery_published;
+// The strings are loaded once, app_mqtt_set_params() replaces them after
+static bool config_loaded = false;
+// Held while the client or the parameters are used by the backlog task, or
+// while they are replaced
+static SemaphoreHandle_t xClientMutex = NULL;
+static TaskHandle_t xBacklogTask = NULL;
+// The message the backlog task waits on, and the last ones the broker
+// acknowledged, which may have been acknowledged before it started to wait
+static SemaphoreHandle_t xAckMutex = NULL;
+static int backlog_msg_id = -1;
+static int acked_msg_ids[ACKED_MSG_IDS_LEN];
+static unsigned int acked_next = 0;
+
+// Prefixes of the entities of a device. The first device keeps the ones from
+// before there could be several, so existing entities aren't orphaned.
+typedef struct {
+    char id[16];
+    char name[16];
+} entity_prefix_t;
+
+/*
+ * Everything the discovery messages of a device are rendered from. The
+ * messages are cached as topic and payload pairs of null terminated strings,
+ * so publishing them again takes no JSON work until the key changes.
+ */
+typedef struct {
+    char device_id[SMOKE_X_DEVICE_ID_LEN + 1];
+    unsigned int num_probes;
+    const char *units;
+    char base_topic[APP_MQTT_MAX_TOPIC_LEN + 1];
+    char state_topic[APP_MQTT_MAX_TOPIC_LEN + 4];
+    uint16_t max_interval;
+    bool sensor_topics;
+} discovery_key_t;
+
+typedef struct {
+    discovery_key_t key;
+    bool valid;
+    char *msgs;
+    size_t len;
+    size_t size;
+    unsigned int count;
+} discovery_cache_t;
+
+static discovery_cache_t discovery_cache[SMOKE_X_MAX_DEVICES];
+
+ESP_EVENT_DEFINE_BASE(APP_MQTT_EVENT);
+
+// The state last published for a device, changes are measured against it.
+// Only used on the default event loop, by app_mqtt_publish_state().
+typedef struct {
+    bool valid;
+    int64_t time_ms;
+    smoke_x_state_t state;
+} published_state_t;
+
+static published_state_t published[SMOKE_X_MAX_DEVICES];
+
+typedef enum {
+    PUBLISH_NONE,
+    PUBLISH_CHANGES,
+    PUBLISH_ALL,
+} publish_t;
+
+// A value last published to its own topic, keys are the serializer's
+// literals, so they are compared by address. Only used on the default event
+// loop, like published[].
+typedef struct {
+    const char *key;
+    char value[APP_MQTT_JSON_VALUE_LEN];
+} sensor_value_t;
+
+static sensor_value_t sensor_values[SMOKE_X_MAX_DEVICES]
+                                   [APP_MQTT_JSON_MAX_VALUES];
+static bool sensor_values_full = false;
+
+typedef struct {
+    sensor_value_t *values;
+    const char *state_topic;
+    bool all;
+} sensor_publish_t;
 
 #define MQTT_PUBLISH(client, topic, buf)                            \
     if (esp_mqtt_client_enqueue(client, topic, buf,                 \
@@ -68,13 +174,31 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
             esp_mqtt_client_subscribe(client, app_mqtt_params.ha_status_topic,
                                       1);
             connected = true;
+            // Handled on the event loop, in order with the state events
+            esp_event_post(APP_MQTT_EVENT, APP_MQTT_EVENT_CONNECTED, NULL, 0,
+                           1000);
+            if (xBacklogTask) {
+                xTaskNotifyGive(xBacklogTask);
+            }
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
             connected = false;
+            // No acknowledgement is coming, stop waiting for one
+            if (xBacklogTask) {
+                xTaskNotifyGive(xBacklogTask);
+            }
             break;
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            if (xAckMutex && xSemaphoreTake(xAckMutex, portMAX_DELAY)) {
+                acked_msg_ids[acked_next] = event->msg_id;
+                acked_next = (acked_next + 1) % ACKED_MSG_IDS_LEN;
+                if (event->msg_id == backlog_msg_id) {
+                    xTaskNotifyGive(xBacklogTask);
+                }
+                xSemaphoreGive(xAckMutex);
+            }
             break;
         case MQTT_EVENT_DATA:
             ESP_LOGD(TAG, "MQTT_EVENT_DATA %s:%s", event->topic, event->data);
@@ -115,6 +239,8 @@ static esp_err_t load_config_from_nvs() {
     esp_err_t err;
     nvs_handle_t h_nvs;
     size_t len = 0;
+    uint16_t deadband;
+    int8_t sensor_topics;
 
     err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h_nvs);
     if (!err) {
@@ -200,7 +326,29 @@ static esp_err_t load_config_from_nvs() {
             app_mqtt_params.state_topic = HASS_MQTT_STATE_TOPIC;
         }
 
+        // The deadband is kept in tenths of a degree
+        err = nvs_get_u16(h_nvs, APP_MQTT_DEADBAND, &deadband);
+        app_mqtt_params.deadband =
+            err ? APP_MQTT_DEFAULT_DEADBAND : deadband / 10.0;
+
+        err = nvs_get_u16(h_nvs, APP_MQTT_MIN_INTERVAL,
+                          &app_mqtt_params.min_interval);
+        if (err) {
+            app_mqtt_params.min_interval = APP_MQTT_DEFAULT_MIN_INTERVAL;
+        }
+
+        err = nvs_get_u16(h_nvs, APP_MQTT_MAX_INTERVAL,
+                          &app_mqtt_params.max_interval);
+        if (err) {
+            app_mqtt_params.max_interval = APP_MQTT_DEFAULT_MAX_INTERVAL;
+        }
+
+        err = nvs_get_i8(h_nvs, APP_MQTT_SENSOR_TOPICS, &sensor_topics);
+        app_mqtt_params.sensor_topics = !err && sensor_topics;
+
         nvs_close(h_nvs);
+        // Missing keys have their defaults, the last of them isn't an error
+        err = ESP_OK;
     }
     return err;
 }
@@ -228,6 +376,14 @@ static esp_err_t save_config_to_nvs() {
                           app_mqtt_params.ha_birth_payload);
         err = nvs_set_str(h_nvs, APP_MQTT_STATE_TOPIC,
                           app_mqtt_params.state_topic);
+        err = nvs_set_u16(h_nvs, APP_MQTT_DEADBAND,
+                          lroundf(app_mqtt_params.deadband * 10));
+        err = nvs_set_u16(h_nvs, APP_MQTT_MIN_INTERVAL,
+                          app_mqtt_params.min_interval);
+        err = nvs_set_u16(h_nvs, APP_MQTT_MAX_INTERVAL,
+                          app_mqtt_params.max_interval);
+        err = nvs_set_i8(h_nvs, APP_MQTT_SENSOR_TOPICS,
+                         (int8_t)app_mqtt_params.sensor_topics);
         nvs_close(h_nvs);
     }
     return err;
@@ -247,11 +403,9 @@ static void update_client_status() {
 }
 
 static esp_err_t init() {
-    esp_err_t err;
+    esp_err_t err = ESP_OK;
 
-    err = load_config_from_nvs();
-
-    if (!err & app_mqtt_params.enabled) {
+    if (app_mqtt_params.enabled) {
         if (strlen(app_mqtt_params.uri) < 1) {
             ESP_LOGE(TAG, "MQTT URI field is empty");
             err = 1;
@@ -276,6 +430,142 @@ static esp_err_t init() {
     return err;
 }
 
+/* The state topic, followed by /<n> for every device but the first */
+static void get_state_topic(unsigned int device, char *topic, size_t len) {
+    if (device == 0) {
+        snprintf(topic, len, "%s", app_mqtt_params.state_topic);
+    } else {
+        snprintf(topic, len, "%s/%d", app_mqtt_params.state_topic, device + 1);
+    }
+}
+
+/*
+ * Set the message the backlog task waits on, -1 for none, and tell if the
+ * broker has acknowledged it already
+ */
+static bool set_backlog_msg_id(int msg_id) {
+    bool acked = false;
+    if (xSemaphoreTake(xAckMutex, portMAX_DELAY)) {
+        backlog_msg_id = msg_id;
+        for (unsigned int i = 0; msg_id >= 0 && i < ACKED_MSG_IDS_LEN; i++) {
+            acked |= acked_msg_ids[i] == msg_id;
+        }
+        if (msg_id < 0) {
+            memset(acked_msg_ids, 0, sizeof(acked_msg_ids));
+        }
+        xSemaphoreGive(xAckMutex);
+    }
+    return acked;
+}
+
+/*
+ * Wait for the broker to acknowledge a message published with QoS 1, as
+ * long as the client stays connected
+ */
+static bool wait_for_puback(int msg_id) {
+    TickType_t timeout = pdMS_TO_TICKS(BACKLOG_PUBACK_TIMEOUT_MS);
+    TickType_t start = xTaskGetTickCount(), elapsed;
+    bool acked = set_backlog_msg_id(msg_id);
+
+    while (!acked && connected &&
+           (elapsed = xTaskGetTickCount() - start) < timeout) {
+        ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+        acked = set_backlog_msg_id(msg_id);
+    }
+    set_backlog_msg_id(-1);
+    return acked;
+}
+
+/*
+ * Publish the states kept while disconnected to the history topic, oldest
+ * first and one at a time. A state is only dropped from the backlog once the
+ * broker acknowledged it, so it may be published twice but is never lost to
+ * a disconnect, and CONFIG_MQTT_BACKLOG_DRAIN_MS passes before the next one.
+ */
+static void backlog_task(void *arg) {
+    char buf[MQTT_BUF_SIZE];
+    char topic[APP_MQTT_MAX_TOPIC_LEN + 12];
+    smoke_x_state_t state;
+    unsigned int device;
+    unsigned int count;
+    uint32_t seq;
+    int msg_id;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BACKLOG_RETRY_MS));
+        count = connected ? app_mqtt_backlog_count() : 0;
+        if (count) {
+            ESP_LOGI(TAG, "Publishing %d states kept while disconnected",
+                     count);
+        }
+        while (connected && app_mqtt_backlog_peek(&device, &state, &seq)) {
+            if (!app_mqtt_json_state(&state, buf, sizeof(buf))) {
+                app_mqtt_backlog_pop(seq);
+                continue;
+            }
+            // Queued for the client's task, the lock is never held for long
+            msg_id = -1;
+            if (xSemaphoreTake(xClientMutex, portMAX_DELAY)) {
+                get_state_topic(device, topic, sizeof(topic));
+                strlcat(topic, "/" HISTORY_TOPIC, sizeof(topic));
+                if (client && connected) {
+                    msg_id = esp_mqtt_client_enqueue(client, topic, buf, 0, 1,
+                                                     0, true);
+                }
+                xSemaphoreGive(xClientMutex);
+            }
+            if (msg_id < 0 || !wait_for_puback(msg_id)) {
+                break;
+            }
+            app_mqtt_backlog_pop(seq);
+            vTaskDelay(pdMS_TO_TICKS(CONFIG_MQTT_BACKLOG_DRAIN_MS));
+        }
+    }
+}
+
+/* Runs on the default event loop, as app_mqtt_publish_state() does */
+static void app_mqtt_event_handler(void *handler_args, esp_event_base_t base,
+                                   int32_t event_id, void *event_data) {
+    switch (event_id) {
+        case APP_MQTT_EVENT_CONNECTED:
+            // Start over from a full state on every connection
+            memset(published, 0, sizeof(published));
+            memset(sensor_values, 0, sizeof(sensor_values));
+            break;
+    }
+}
+
+static esp_err_t start_backlog() {
+    if (xBacklogTask) {
+        return ESP_OK;
+    }
+    app_mqtt_backlog_init();
+    esp_event_handler_register(APP_MQTT_EVENT, ESP_EVENT_ANY_ID,
+                               &app_mqtt_event_handler, NULL);
+    xClientMutex = xSemaphoreCreateMutex();
+    xAckMutex = xSemaphoreCreateMutex();
+    if (!xClientMutex || !xAckMutex) {
+        ESP_LOGE(TAG, "Unable to create backlog mutexes");
+        return ESP_FAIL;
+    }
+    xTaskCreate(&backlog_task, "app_mqtt_backlog_task", 4096, NULL, 4,
+                &xBacklogTask);
+    return xBacklogTask ? ESP_OK : ESP_FAIL;
+}
+
+/*
+ * Load the configuration and start keeping states for the broker, at boot
+ * and before there is a network to reach it
+ */
+esp_err_t app_mqtt_init() {
+    esp_err_t err = start_backlog();
+    if (!err && !config_loaded) {
+        err = load_config_from_nvs();
+        config_loaded = !err;
+    }
+    return err;
+}
+
 esp_err_t app_mqtt_start() {
     esp_err_t err;
 
@@ -283,6 +573,10 @@ esp_err_t app_mqtt_start() {
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
 #endif
 
+    err = app_mqtt_init();
+    if (err) {
+        return err;
+    }
     err = init();
     if (!err & app_mqtt_params.enabled) {
         ESP_LOGI(TAG, "Starting MQTT client");
@@ -299,230 +593,492 @@ bool app_mqtt_is_enabled() { return app_mqtt_params.enabled; }
 void app_mqtt_stop() {
     if (client) {
         ESP_LOGI(TAG, "Stopping MQTT client");
+        xSemaphoreTake(xClientMutex, portMAX_DELAY);
         esp_mqtt_client_disconnect(client);
         esp_mqtt_client_stop(client);
         esp_mqtt_client_destroy(client);
         connected = false;
         client = NULL;
+        xSemaphoreGive(xClientMutex);
+        xTaskNotifyGive(xBacklogTask);
     }
 }
 
-void app_mqtt_publish_discovery() {
+static void get_prefix(unsigned int device, entity_prefix_t *prefix) {
+    if (device == 0) {
+        snprintf(prefix->id, sizeof(prefix->id), "smoke-x");
+        snprintf(prefix->name, sizeof(prefix->name), "Smoke X");
+    } else {
+        snprintf(prefix->id, sizeof(prefix->id), "smoke-x_%d", device + 1);
+        snprintf(prefix->name, sizeof(prefix->name), "Smoke X %d",
+                 device + 1);
+    }
+}
+
+static void clear_cache(discovery_cache_t *cache) {
+    free(cache->msgs);
+    memset(cache, 0, sizeof(discovery_cache_t));
+}
+
+/* Append a message, on failure the cache is left for rendering again */
+static void cache_add(discovery_cache_t *cache, const char *topic,
+                      const char *payload) {
+    size_t topic_len = strlen(topic) + 1;
+    size_t payload_len = strnlen(payload, MQTT_BUF_SIZE) + 1;
+    size_t len = cache->len + topic_len + payload_len;
+    size_t size = cache->size ? cache->size : DISCOVERY_CACHE_SIZE;
+    char *msgs;
+
+    while (size < len) {
+        size *= 2;
+    }
+    if (size != cache->size) {
+        msgs = realloc(cache->msgs, size);
+        if (!msgs) {
+            ESP_LOGE(TAG, "No memory to cache discovery for %s", topic);
+            cache->valid = false;
+            return;
+        }
+        cache->msgs = msgs;
+        cache->size = size;
+    }
+    memcpy(cache->msgs + cache->len, topic, topic_len);
+    memcpy(cache->msgs + cache->len + topic_len, payload, payload_len);
+    cache->len = len;
+    cache->count++;
+}
+
+/*
+ * Point an entity at its value: a template on the state topic, or the topic
+ * the value is published to on its own
+ */
+static void set_value_source(cJSON *root, const discovery_key_t *key,
+                             const char *field) {
+    char str[APP_MQTT_MAX_TOPIC_LEN + 36];
+
+    if (key->sensor_topics) {
+        snprintf(str, sizeof(str), "%s/%s", key->state_topic, field);
+        cJSON_ReplaceItemInObject(root, HASS_STATE_TOPIC,
+                                  cJSON_CreateString(str));
+    } else {
+        snprintf(str, sizeof(str), "{{value_json.%s}}", field);
+        if (cJSON_HasObjectItem(root, HASS_VALUE_TEMPLATE)) {
+            cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
+                                      cJSON_CreateString(str));
+        } else {
+            cJSON_AddStringToObject(root, HASS_VALUE_TEMPLATE, str);
+        }
+    }
+}
+
+/*
+ * Print root to buf and cache it. A message that doesn't fit leaves the
+ * cache invalid, so the set is rendered again rather than kept without it.
+ */
+static void cache_render(discovery_cache_t *cache, const char *topic,
+                         cJSON *root, char *buf, size_t buf_len) {
+    if (!cJSON_PrintPreallocated(root, buf, buf_len, false)) {
+        ESP_LOGE(TAG, "Discovery message for %s over %d bytes", topic,
+                 buf_len);
+        cache->valid = false;
+        return;
+    }
+    cache_add(cache, topic, buf);
+}
+
+/* Render the discovery message of a link quality sensor */
+static void render_link_discovery(cJSON *root, char *buf, size_t buf_len,
+                                  discovery_cache_t *cache,
+                                  const entity_prefix_t *prefix,
+                                  const char *key, const char *name,
+                                  const char *device_class, const char *unit) {
+    char uniq_id[32];
+    char device_name[32];
+    char topic_str[100];
+
+    snprintf(uniq_id, sizeof(uniq_id), "%s_%s", prefix->id, key);
+    snprintf(device_name, sizeof(device_name), "%s %s", prefix->name, name);
+    cJSON_DeleteItemFromObject(root, HASS_DEVICE_CLASS);
+    if (device_class) {
+        cJSON_AddStringToObject(root, HASS_DEVICE_CLASS, device_class);
+    }
+    cJSON_DeleteItemFromObject(root, HASS_UNIT_OF_MEASUREMENT);
+    cJSON_AddStringToObject(root, HASS_UNIT_OF_MEASUREMENT, unit);
+    cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
+    cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
+                              cJSON_CreateString(device_name));
+    set_value_source(root, &cache->key, key);
+    snprintf(topic_str, sizeof(topic_str), "%s/sensor/%s/config",
+             cache->key.base_topic, uniq_id);
+    cache_render(cache, topic_str, root, buf, buf_len);
+}
+
+static void render_device_discovery(unsigned int n, discovery_cache_t *cache) {
+    const discovery_key_t *key = &cache->key;
     char buf[MQTT_BUF_SIZE];
     char topic_str[100];
-    smoke_x_config_t config;
-    smoke_x_get_config(&config);
+    char uniq_id[32];
+    char device_name[32];
+    char field[24];
+    entity_prefix_t prefix;
+    get_prefix(n, &prefix);
 
-    ESP_LOGI(TAG, "Sending Home Assistant MQTT Device Discovery");
+    ESP_LOGI(TAG, "Rendering Home Assistant MQTT Device Discovery for %s",
+             key->device_id);
     cJSON *root = cJSON_CreateObject();
     cJSON *device = cJSON_AddObjectToObject(root, HASS_DEVICE);
-    cJSON_AddStringToObject(device, "name", "Smoke X Receiver");
-    cJSON_AddStringToObject(device, "identifiers", smoke_x_get_device_id());
+    snprintf(device_name, sizeof(device_name), "%s Receiver", prefix.name);
+    cJSON_AddStringToObject(device, "name", device_name);
+    cJSON_AddStringToObject(device, "identifiers", key->device_id);
     cJSON_AddStringToObject(device, "sw_version", SMOKE_X_APP_VERSION);
     cJSON_AddStringToObject(device, "model",
-                            config.num_probes == 2 ? "X2" : "X4");
+                            key->num_probes == 2 ? "X2" : "X4");
     cJSON_AddStringToObject(device, "manufacturer", "ThermoWorks");
-    cJSON_AddNumberToObject(root, HASS_EXPIRE_AFTER, 120);
+    if (key->max_interval) {
+        // Unavailable once a couple of heartbeats were missed
+        cJSON_AddNumberToObject(
+            root, HASS_EXPIRE_AFTER,
+            key->max_interval > EXPIRE_AFTER_MIN / 2 ? key->max_interval * 2
+                                                     : EXPIRE_AFTER_MIN);
+    }
     cJSON_AddStringToObject(root, HASS_PAYLOAD_NOT_AVAIL, "offline");
-    cJSON_AddStringToObject(root, HASS_STATE_TOPIC,
-                            app_mqtt_params.state_topic);
+    cJSON_AddStringToObject(root, HASS_STATE_TOPIC, key->state_topic);
 
+    snprintf(uniq_id, sizeof(uniq_id), "%s_billows_target", prefix.id);
+    snprintf(device_name, sizeof(device_name), "%s Billows Target Temp",
+             prefix.name);
     cJSON_AddStringToObject(root, HASS_DEVICE_CLASS, "temperature");
-    cJSON_AddStringToObject(root, HASS_UNIT_OF_MEASUREMENT,
-                            smoke_x_get_units());
-    cJSON_AddStringToObject(root, "uniq_id", "smoke-x_billows_target");
-    cJSON_AddStringToObject(root, HASS_DEVICE_NAME,
-                            "Smoke X Billows Target Temp");
-    cJSON_AddStringToObject(root, HASS_VALUE_TEMPLATE,
-                            "{{value_json.billows_target}}");
-    cJSON_PrintPreallocated(root, buf, 512, false);
-    snprintf(topic_str, sizeof(topic_str),
-             "%s/sensor/smoke-x_billows_target/config",
-             app_mqtt_params.ha_base_topic);
-    MQTT_PUBLISH(client, topic_str, buf);
+    cJSON_AddStringToObject(root, HASS_UNIT_OF_MEASUREMENT, key->units);
+    cJSON_AddStringToObject(root, "uniq_id", uniq_id);
+    cJSON_AddStringToObject(root, HASS_DEVICE_NAME, device_name);
+    set_value_source(root, key, "billows_target");
+    snprintf(topic_str, sizeof(topic_str), "%s/sensor/%s/config",
+             key->base_topic, uniq_id);
+    cache_render(cache, topic_str, root, buf, sizeof(buf));
     cJSON_DeleteItemFromObject(root, HASS_DEVICE_CLASS);
     cJSON_DeleteItemFromObject(root, HASS_UNIT_OF_MEASUREMENT);
 
-    char uniq_id[32];
-    char device_name[32];
-    char template[64];
-    for (unsigned int i = 0; i < config.num_probes; i++) {
-        snprintf(uniq_id, sizeof(uniq_id), "smoke-x_probe_%d_temp", i + 1);
-        snprintf(device_name, sizeof(device_name), "Smoke X Probe %d Temp",
-                 i + 1);
-        snprintf(template, sizeof(template), "{{value_json.probe_%d_temp}}",
+    for (unsigned int i = 0; i < key->num_probes; i++) {
+        snprintf(uniq_id, sizeof(uniq_id), "%s_probe_%d_temp", prefix.id,
                  i + 1);
+        snprintf(device_name, sizeof(device_name), "%s Probe %d Temp",
+                 prefix.name, i + 1);
+        snprintf(field, sizeof(field), "probe_%d_temp", i + 1);
         cJSON_AddStringToObject(root, HASS_DEVICE_CLASS, "temperature");
-        cJSON_AddStringToObject(root, HASS_UNIT_OF_MEASUREMENT,
-                                smoke_x_get_units());
+        cJSON_AddStringToObject(root, HASS_UNIT_OF_MEASUREMENT, key->units);
         cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
                                   cJSON_CreateString(device_name));
-        cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
-                                  cJSON_CreateString(template));
-        cJSON_PrintPreallocated(root, buf, 512, false);
+        set_value_source(root, key, field);
         snprintf(topic_str, sizeof(topic_str), "%s/sensor/%s/config",
-                 app_mqtt_params.ha_base_topic, uniq_id);
-        MQTT_PUBLISH(client, topic_str, buf);
+                 key->base_topic, uniq_id);
+        cache_render(cache, topic_str, root, buf, sizeof(buf));
 
-        snprintf(uniq_id, sizeof(uniq_id), "smoke-x_probe_%d_max", i + 1);
-        snprintf(device_name, sizeof(device_name), "Smoke X Probe %d Max",
-                 i + 1);
-        snprintf(template, sizeof(template), "{{value_json.probe_%d_max}}",
-                 i + 1);
+        snprintf(uniq_id, sizeof(uniq_id), "%s_probe_%d_max", prefix.id, i + 1);
+        snprintf(device_name, sizeof(device_name), "%s Probe %d Max",
+                 prefix.name, i + 1);
+        snprintf(field, sizeof(field), "probe_%d_max", i + 1);
         cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
                                   cJSON_CreateString(device_name));
-        cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
-                                  cJSON_CreateString(template));
-        cJSON_PrintPreallocated(root, buf, 512, false);
+        set_value_source(root, key, field);
         snprintf(topic_str, sizeof(topic_str), "%s/sensor/%s/config",
-                 app_mqtt_params.ha_base_topic, uniq_id);
-        MQTT_PUBLISH(client, topic_str, buf);
+                 key->base_topic, uniq_id);
+        cache_render(cache, topic_str, root, buf, sizeof(buf));
 
-        snprintf(uniq_id, sizeof(uniq_id), "smoke-x_probe_%d_min", i + 1);
-        snprintf(device_name, sizeof(device_name), "Smoke X Probe %d Min",
-                 i + 1);
-        snprintf(template, sizeof(template), "{{value_json.probe_%d_min}}",
-                 i + 1);
+        snprintf(uniq_id, sizeof(uniq_id), "%s_probe_%d_min", prefix.id, i + 1);
+        snprintf(device_name, sizeof(device_name), "%s Probe %d Min",
+                 prefix.name, i + 1);
+        snprintf(field, sizeof(field), "probe_%d_min", i + 1);
         cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
                                   cJSON_CreateString(device_name));
-        cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
-                                  cJSON_CreateString(template));
-        cJSON_PrintPreallocated(root, buf, 512, false);
+        set_value_source(root, key, field);
         snprintf(topic_str, sizeof(topic_str), "%s/sensor/%s/config",
-                 app_mqtt_params.ha_base_topic, uniq_id);
-        MQTT_PUBLISH(client, topic_str, buf);
+                 key->base_topic, uniq_id);
+        cache_render(cache, topic_str, root, buf, sizeof(buf));
 
-        snprintf(uniq_id, sizeof(uniq_id), "smoke-x_probe_%d_attached", i + 1);
-        snprintf(device_name, sizeof(device_name), "Smoke X Probe %d Attached",
-                 i + 1);
-        snprintf(template, sizeof(template), "{{value_json.probe_%d_attached}}",
+        snprintf(uniq_id, sizeof(uniq_id), "%s_probe_%d_attached", prefix.id,
                  i + 1);
+        snprintf(device_name, sizeof(device_name), "%s Probe %d Attached",
+                 prefix.name, i + 1);
+        snprintf(field, sizeof(field), "probe_%d_attached", i + 1);
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_CLASS,
                                   cJSON_CreateString("plug"));
         cJSON_DeleteItemFromObject(root, HASS_UNIT_OF_MEASUREMENT);
         cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
                                   cJSON_CreateString(device_name));
-        cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
-                                  cJSON_CreateString(template));
-        cJSON_PrintPreallocated(root, buf, 512, false);
+        set_value_source(root, key, field);
         snprintf(topic_str, sizeof(topic_str), "%s/binary_sensor/%s/config",
-                 app_mqtt_params.ha_base_topic, uniq_id);
-        MQTT_PUBLISH(client, topic_str, buf);
+                 key->base_topic, uniq_id);
+        cache_render(cache, topic_str, root, buf, sizeof(buf));
 
-        snprintf(uniq_id, sizeof(uniq_id), "smoke-x_probe_%d_alarm", i + 1);
-        snprintf(device_name, sizeof(device_name), "Smoke X Probe %d Alarm",
-                 i + 1);
-        snprintf(template, sizeof(template), "{{value_json.probe_%d_alarm}}",
+        snprintf(uniq_id, sizeof(uniq_id), "%s_probe_%d_alarm", prefix.id,
                  i + 1);
+        snprintf(device_name, sizeof(device_name), "%s Probe %d Alarm",
+                 prefix.name, i + 1);
+        snprintf(field, sizeof(field), "probe_%d_alarm", i + 1);
         cJSON_DeleteItemFromObject(root, HASS_DEVICE_CLASS);
         cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
         cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
                                   cJSON_CreateString(device_name));
-        cJSON_ReplaceItemInObject(root, HASS_VALUE_TEMPLATE,
-                                  cJSON_CreateString(template));
-        cJSON_PrintPreallocated(root, buf, 512, false);
+        set_value_source(root, key, field);
         snprintf(topic_str, sizeof(topic_str), "%s/binary_sensor/%s/config",
-                 app_mqtt_params.ha_base_topic, uniq_id);
-        MQTT_PUBLISH(client, topic_str, buf);
+                 key->base_topic, uniq_id);
+        cache_render(cache, topic_str, root, buf, sizeof(buf));
     }
 
-    cJSON_ReplaceItemInObject(root, "uniq_id",
-                              cJSON_CreateString("smoke-x_billows_attached"));
+    snprintf(uniq_id, sizeof(uniq_id), "%s_billows_attached", prefix.id);
+    snprintf(device_name, sizeof(device_name), "%s Billows Attached",
+             prefix.name);
+    cJSON_ReplaceItemInObject(root, "uniq_id", cJSON_CreateString(uniq_id));
     cJSON_ReplaceItemInObject(root, HASS_DEVICE_NAME,
-                              cJSON_CreateString("Smoke X Billows Attached"));
+                              cJSON_CreateString(device_name));
     cJSON_AddStringToObject(root, HASS_DEVICE_CLASS, "plug");
-    cJSON_ReplaceItemInObject(
-        root, HASS_VALUE_TEMPLATE,
-        cJSON_CreateString("{{value_json.billows_attached}}"));
-    cJSON_PrintPreallocated(root, buf, 512, false);
-    snprintf(topic_str, sizeof(topic_str),
-             "%s/binary_sensor/smoke-x_billows_attached/config",
+    set_value_source(root, key, "billows_attached");
+    snprintf(topic_str, sizeof(topic_str), "%s/binary_sensor/%s/config",
+             key->base_topic, uniq_id);
+    cache_render(cache, topic_str, root, buf, sizeof(buf));
+
+    cJSON_AddStringToObject(root, HASS_ENTITY_CATEGORY, "diagnostic");
+    render_link_discovery(root, buf, sizeof(buf), cache, &prefix, "rssi",
+                          "RSSI", "signal_strength", "dBm");
+    render_link_discovery(root, buf, sizeof(buf), cache, &prefix, "snr", "SNR",
+                          "signal_strength", "dB");
+    render_link_discovery(root, buf, sizeof(buf), cache, &prefix,
+                          "packet_interval", "Packet Interval", "duration",
+                          "s");
+    render_link_discovery(root, buf, sizeof(buf), cache, &prefix,
+                          "packet_loss", "Packet Loss", NULL, "%");
+
+    cJSON_Delete(root);
+}
+
+/* The inputs of the discovery messages of a device */
+static void get_discovery_key(unsigned int n, discovery_key_t *key) {
+    smoke_x_config_t config;
+    smoke_x_get_config(n, &config);
+    memset(key, 0, sizeof(discovery_key_t));
+    memcpy(key->device_id, config.device_id, SMOKE_X_DEVICE_ID_LEN);
+    key->num_probes = config.num_probes;
+    key->units = smoke_x_get_units(n);
+    snprintf(key->base_topic, sizeof(key->base_topic), "%s",
              app_mqtt_params.ha_base_topic);
-    MQTT_PUBLISH(client, topic_str, buf);
+    get_state_topic(n, key->state_topic, sizeof(key->state_topic));
+    key->max_interval = app_mqtt_params.max_interval;
+    key->sensor_topics = app_mqtt_params.sensor_topics;
+}
+
+/* Units are NULL until the first packet */
+static bool discovery_key_equal(const discovery_key_t *a,
+                                const discovery_key_t *b) {
+    return !strncmp(a->device_id, b->device_id, sizeof(a->device_id)) &&
+           a->num_probes == b->num_probes &&
+           (a->units == b->units ||
+            (a->units && b->units && !strcmp(a->units, b->units))) &&
+           !strcmp(a->base_topic, b->base_topic) &&
+           !strcmp(a->state_topic, b->state_topic) &&
+           a->max_interval == b->max_interval &&
+           a->sensor_topics == b->sensor_topics;
+}
+
+/* Publish the cached messages, rendering them again if an input changed */
+static void publish_device_discovery(unsigned int n) {
+    discovery_cache_t *cache = &discovery_cache[n];
+    discovery_key_t key;
+    const char *topic, *payload;
+
+    get_discovery_key(n, &key);
+    if (!cache->valid || !discovery_key_equal(&key, &cache->key)) {
+        clear_cache(cache);
+        cache->key = key;
+        cache->valid = true;
+        render_device_discovery(n, cache);
+        // Keep only what the messages need, a partial set is retried
+        if (cache->valid && cache->len < cache->size) {
+            char *msgs = realloc(cache->msgs, cache->len);
+            if (msgs) {
+                cache->msgs = msgs;
+                cache->size = cache->len;
+            }
+        }
+    }
+
+    ESP_LOGI(TAG, "Sending Home Assistant MQTT Device Discovery for %s",
+             cache->key.device_id);
+    topic = cache->msgs;
+    for (unsigned int i = 0; i < cache->count; i++) {
+        payload = topic + strlen(topic) + 1;
+        MQTT_PUBLISH(client, topic, payload);
+        topic = payload + strlen(payload) + 1;
+    }
 
 #if APP_DEBUG > 0
     ESP_LOGD(TAG, "Free Heap: %d", xPortGetFreeHeapSize());
-    ESP_LOGD(TAG, "Num Records: %d", smoke_x_get_num_records());
+    ESP_LOGD(TAG, "Num Records: %d", smoke_x_get_num_records(n));
 #endif
+}
 
-    cJSON_Delete(root);
+void app_mqtt_publish_discovery() {
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        if (smoke_x_is_paired(i)) {
+            publish_device_discovery(i);
+        } else {
+            clear_cache(&discovery_cache[i]);
+        }
+    }
     discovery_published = true;
 }
 
-void app_mqtt_publish_state() {
+/* A probe temperature that moved at least deadband degrees */
+static bool beyond_deadband(double temp, double last) {
+    double diff = fabs(temp - last);
+    // Temperatures come in tenths, don't let rounding hide a change
+    return diff > 0 && diff + 0.01 >= app_mqtt_params.deadband;
+}
+
+/* RSSI, SNR or packet loss that moved enough to be worth publishing */
+static bool link_changed(const smoke_x_link_t *link,
+                         const smoke_x_link_t *last) {
+    return abs(link->rssi - last->rssi) >= LINK_RSSI_DEADBAND ||
+           fabsf(link->snr - last->snr) >= LINK_SNR_DEADBAND ||
+           fabsf(link->loss - last->loss) >= LINK_LOSS_DEADBAND;
+}
+
+/*
+ * Whether the publish policy lets the state of a device be published now.
+ * Alarm and attach changes always are, the heartbeat once max_interval has
+ * passed, and other changes once min_interval has: a probe temperature
+ * beyond the deadband, or the link quality beyond its own. The first state
+ * and the heartbeat are published in full.
+ */
+static publish_t should_publish(unsigned int device,
+                                const smoke_x_state_t *state, int64_t now_ms) {
+    const published_state_t *last = &published[device];
+    const smoke_x_state_t *prev = &last->state;
+    int64_t elapsed_ms = now_ms - last->time_ms;
+    bool changed = false;
+
+    if (!last->valid) {
+        return PUBLISH_ALL;
+    }
+    if (state->num_probes != prev->num_probes ||
+        state->billows_attached != prev->billows_attached) {
+        return PUBLISH_CHANGES;
+    }
+    for (unsigned int i = 0; i < state->num_probes; i++) {
+        if (state->probes[i].attached != prev->probes[i].attached ||
+            state->probes[i].alarm != prev->probes[i].alarm) {
+            return PUBLISH_CHANGES;
+        }
+    }
+    if (app_mqtt_params.max_interval &&
+        elapsed_ms >= app_mqtt_params.max_interval * 1000LL) {
+        return PUBLISH_ALL;
+    }
+    if (elapsed_ms < app_mqtt_params.min_interval * 1000LL) {
+        return PUBLISH_NONE;
+    }
+    changed = state->units != prev->units ||
+              link_changed(&state->link, &prev->link);
+    for (unsigned int i = 0; i < state->num_probes; i++) {
+        const smoke_x_probe_t *probe = &state->probes[i];
+        if (probe->attached &&
+            (beyond_deadband(probe->temp, prev->probes[i].temp) ||
+             probe->max_temp != prev->probes[i].max_temp ||
+             probe->min_temp != prev->probes[i].min_temp)) {
+            changed = true;
+        }
+    }
+    return changed ? PUBLISH_CHANGES : PUBLISH_NONE;
+}
+
+/* Publish a value to its own topic, retained, unless it is unchanged */
+static void publish_sensor_value(const char *key, const char *value,
+                                 void *ctx) {
+    const sensor_publish_t *pub = ctx;
+    sensor_value_t *last = NULL;
+    char topic[APP_MQTT_MAX_TOPIC_LEN + 24];
+
+    for (unsigned int i = 0; i < APP_MQTT_JSON_MAX_VALUES; i++) {
+        if (!pub->values[i].key || pub->values[i].key == key) {
+            last = &pub->values[i];
+            break;
+        }
+    }
+    if (!last) {
+        // Would be published with every state, never compared
+        if (!sensor_values_full) {
+            ESP_LOGE(TAG, "No room to track %s, not published", key);
+            sensor_values_full = true;
+        }
+        return;
+    }
+    if (!pub->all && last->key == key && !strcmp(last->value, value)) {
+        return;
+    }
+    snprintf(topic, sizeof(topic), "%s/%s", pub->state_topic, key);
+    if (esp_mqtt_client_enqueue(client, topic, value, strlen(value), 1, 1,
+                                0) == ESP_FAIL) {
+        ESP_LOGE(TAG, "Failed to send message to server: %s", value);
+        return;
+    }
+    last->key = key;
+    strcpy(last->value, value);
+}
+
+void app_mqtt_publish_state(unsigned int device) {
     char buf[MQTT_BUF_SIZE];
+    char state_topic[APP_MQTT_MAX_TOPIC_LEN + 4];
     smoke_x_state_t state;
-    cJSON *root;
-    char tmp_str[32];
+    int64_t now_ms;
+    publish_t publish;
 
     if (!discovery_published && app_mqtt_params.ha_discovery) {
         esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_DISCOVERY_REQUIRED, NULL, 0,
                        1000);
     }
 
-    smoke_x_get_state(&state);
-    root = cJSON_CreateObject();
-
-    for (unsigned int i = 0; i < state.num_probes; i++) {
-        snprintf(tmp_str, sizeof(tmp_str), "probe_%d_attached", i + 1);
-        cJSON_AddStringToObject(root, tmp_str,
-                                BOOL_TO_STR(state.probes[i].attached));
-        if (state.probes[i].attached) {
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_alarm", i + 1);
-            cJSON_AddStringToObject(root, tmp_str,
-                                    BOOL_TO_STR(state.probes[i].alarm));
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_temp", i + 1);
-            cJSON_AddNumberToObject(root, tmp_str, state.probes[i].temp);
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_max", i + 1);
-            cJSON_AddNumberToObject(root, tmp_str, state.probes[i].max_temp);
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_min", i + 1);
-            cJSON_AddNumberToObject(root, tmp_str, state.probes[i].min_temp);
-
-            if ((i == (state.num_probes - 1)) && state.billows_attached) {
-                cJSON_AddNumberToObject(root, "billows_target",
-                                        state.probes[i].billows_target);
-                snprintf(tmp_str, sizeof(tmp_str), "probe_%d_max", i + 1);
-                cJSON_ReplaceItemInObject(root, tmp_str,
-                                          cJSON_CreateString("offline"));
-
-                snprintf(tmp_str, sizeof(tmp_str), "probe_%d_min", i + 1);
-                cJSON_ReplaceItemInObject(root, tmp_str,
-                                          cJSON_CreateString("offline"));
-            } else {
-                cJSON_AddStringToObject(root, "billows_target", "offline");
-            }
-        } else {
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_alarm", i + 1);
-            cJSON_AddStringToObject(root, tmp_str, "offline");
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_temp", i + 1);
-            cJSON_AddStringToObject(root, tmp_str, "offline");
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_max", i + 1);
-            cJSON_AddStringToObject(root, tmp_str, "offline");
-
-            snprintf(tmp_str, sizeof(tmp_str), "probe_%d_min", i + 1);
-            cJSON_AddStringToObject(root, tmp_str, "offline");
+    if (smoke_x_get_state(device, &state) != ESP_OK) {
+        return;
+    }
+    now_ms = esp_timer_get_time() / 1000;
+    publish = should_publish(device, &state, now_ms);
+    if (publish == PUBLISH_NONE) {
+        ESP_LOGD(TAG, "State of device %d unchanged, not published", device);
+        return;
+    }
+    published[device].valid = true;
+    published[device].time_ms = now_ms;
+    published[device].state = state;
+    if (!connected) {
+        // Kept for the history topic until the broker is back
+        app_mqtt_backlog_push(device, &state);
+        return;
+    }
+    get_state_topic(device, state_topic, sizeof(state_topic));
+    if (app_mqtt_params.sensor_topics) {
+        // Each value on its own retained topic, only the ones that changed
+        sensor_publish_t pub = {
+            .values = sensor_values[device],
+            .state_topic = state_topic,
+            .all = publish == PUBLISH_ALL,
+        };
+        app_mqtt_json_values(&state, publish_sensor_value, &pub);
+    } else {
+        if (!app_mqtt_json_state(&state, buf, sizeof(buf))) {
+            ESP_LOGE(TAG, "State of device %d doesn't fit in a message",
+                     device);
+            return;
         }
+        MQTT_PUBLISH(client, state_topic, buf);
     }
-    cJSON_AddStringToObject(root, "billows_attached",
-                            BOOL_TO_STR(state.billows_attached));
-    cJSON_PrintPreallocated(root, buf, sizeof(buf), false);
-    MQTT_PUBLISH(client, app_mqtt_params.state_topic, buf);
 
 #if APP_DEBUG > 0
     ESP_LOGD(TAG, "Free Heap: %d", xPortGetFreeHeapSize());
-    ESP_LOGD(TAG, "Num Records: %d", smoke_x_get_num_records());
+    ESP_LOGD(TAG, "Num Records: %d", smoke_x_get_num_records(device));
 #endif
-
-    cJSON_Delete(root);
 }
 
 void app_mqtt_get_params(app_mqtt_params_t *params) {
@@ -532,9 +1088,22 @@ void app_mqtt_get_params(app_mqtt_params_t *params) {
 esp_err_t app_mqtt_set_params(app_mqtt_params_t *params) {
     esp_err_t err;
 
+    if (params->deadband < 0 || params->deadband > APP_MQTT_MAX_DEADBAND ||
+        params->min_interval > APP_MQTT_MAX_PUBLISH_INTERVAL ||
+        params->max_interval > APP_MQTT_MAX_PUBLISH_INTERVAL) {
+        ESP_LOGE(TAG, "Invalid publish policy");
+        return ESP_ERR_INVALID_ARG;
+    }
     if (params->uri && params->username && params->password &&
         params->identity && params->ca_cert) {
+        // No backlog task reads them before there is a lock
+        bool locked =
+            xClientMutex && xSemaphoreTake(xClientMutex, portMAX_DELAY);
         memcpy(&app_mqtt_params, params, sizeof(app_mqtt_params_t));
+        config_loaded = true;
+        if (locked) {
+            xSemaphoreGive(xClientMutex);
+        }
         err = save_config_to_nvs();
         update_client_status();
         return err;
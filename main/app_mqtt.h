@@ -1,6 +1,10 @@
 #ifndef APP_MQTT_H
 #define APP_MQTT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_event.h>
+
 #define APP_MQTT_URI "uri"
 #define APP_MQTT_USERNAME "username"
 #define APP_MQTT_PASSWORD "password"
@@ -12,6 +16,10 @@
 #define APP_MQTT_HA_STATUS_TOPIC "ha_status_topic"
 #define APP_MQTT_HA_BIRTH_PAYLOAD "ha_birth_payload"
 #define APP_MQTT_STATE_TOPIC "state_topic"
+#define APP_MQTT_DEADBAND "deadband"
+#define APP_MQTT_MIN_INTERVAL "min_interval"
+#define APP_MQTT_MAX_INTERVAL "max_interval"
+#define APP_MQTT_SENSOR_TOPICS "sensor_topics"
 
 #define APP_MQTT_MAX_URI_LEN 128
 #define APP_MQTT_MAX_USERNAME_LEN 128
@@ -19,6 +27,20 @@
 #define APP_MQTT_MAX_IDENTITY_LEN 128
 #define APP_MQTT_MAX_CERT_LEN 2048
 #define APP_MQTT_MAX_TOPIC_LEN 48
+#define APP_MQTT_MAX_DEADBAND 50
+#define APP_MQTT_MAX_PUBLISH_INTERVAL 3600
+
+// Every change is published, as before there was a policy
+#define APP_MQTT_DEFAULT_DEADBAND 0
+#define APP_MQTT_DEFAULT_MIN_INTERVAL 0
+#define APP_MQTT_DEFAULT_MAX_INTERVAL 60
+
+ESP_EVENT_DECLARE_BASE(APP_MQTT_EVENT);
+
+// Posted to the default event loop, where states are published
+typedef enum {
+    APP_MQTT_EVENT_CONNECTED = 0,
+} app_mqtt_event_t;
 
 typedef struct {
     char* uri;
@@ -32,14 +54,25 @@ typedef struct {
     char* ha_status_topic;
     char* ha_birth_payload;
     char* state_topic;
+    // State publish policy, a probe temperature has to move by deadband
+    // degrees to be published, no sooner than min_interval seconds after the
+    // last publish. Alarm and attach changes go out right away, and the state
+    // every max_interval seconds even if nothing changed (0 to never).
+    float deadband;
+    uint16_t min_interval;
+    uint16_t max_interval;
+    // Publish each value retained to <state_topic>/<key> when it changes,
+    // instead of the whole state as JSON to the state topic
+    bool sensor_topics;
 } app_mqtt_params_t;
 
+esp_err_t app_mqtt_init();
 esp_err_t app_mqtt_start();
 void app_mqtt_stop();
 bool app_mqtt_is_connected();
 bool app_mqtt_is_enabled();
 void app_mqtt_publish_discovery();
-void app_mqtt_publish_state();
+void app_mqtt_publish_state(unsigned int device);
 void app_mqtt_get_params(app_mqtt_params_t*);
 esp_err_t app_mqtt_set_params(app_mqtt_params_t*);
 
@@ -0,0 +1,443 @@
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "app_mqtt_backlog.h"
+#include "smoke_x_history.h"
+
+/*
+ * Store-and-forward backlog of the states received while the MQTT broker
+ * can't be reached, to be published to the history topic once it can.
+ *
+ * States are kept as compact records in a ring in RAM. With an mqttlog
+ * partition, the oldest records are moved to flash in batches once the ring
+ * is full, and the rest of them on a software restart; without one, the
+ * oldest record is dropped. The partition is a ring of sectors like the cook
+ * log, holding records numbered in the order they were received, each
+ * protected by a CRC. A published record is marked by clearing its sent
+ * byte, which flash allows without an erase, so where publishing left off is
+ * found again after a restart. Once every sector is used, the sector holding
+ * the oldest records is erased to make room.
+ *
+ * A state received before the wall clock was set is kept with the seconds
+ * of uptime it was received at instead, and given its time since the epoch
+ * when it is published, if the clock has been set by then. States from
+ * before a restart that never had the wall clock go without a time.
+ */
+
+#define BACKLOG_SECTOR_SIZE SPI_FLASH_SEC_SIZE
+#define BACKLOG_RECORDS_PER_SECTOR \
+    (BACKLOG_SECTOR_SIZE / sizeof(backlog_record_t))
+#define BACKLOG_SPILL_LEN 10
+#define BACKLOG_MAGIC 0x4251
+#define BACKLOG_ERASED 0xFFFF
+#define BACKLOG_UNSENT 0xFF
+#define BACKLOG_SENT 0x00
+
+#define BACKLOG_EPOCH 0x01
+#define BACKLOG_BILLOWS 0x02
+#define BACKLOG_ATTACHED(i) (0x01 << (i))
+#define BACKLOG_ALARM(i) (0x10 << (i))
+
+_Static_assert(SMOKE_X_MAX_PROBES <= 4, "Probe flags are kept in a byte");
+
+typedef struct {
+    uint16_t magic;
+    uint8_t device;
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t time;  // seconds of uptime, unless BACKLOG_EPOCH
+    uint32_t interval;
+    int16_t rssi;
+    int16_t snr;    // tenths of a dB
+    uint16_t loss;  // tenths of a percent
+    uint8_t num_probes;
+    uint8_t probe_flags;
+    int16_t temps[SMOKE_X_MAX_PROBES];  // tenths of a degree
+    int16_t max_temps[SMOKE_X_MAX_PROBES];
+    int16_t min_temps[SMOKE_X_MAX_PROBES];
+    uint32_t crc;
+    uint8_t sent;  // cleared once published, not covered by the CRC
+    uint8_t reserved[3];
+} backlog_record_t;
+
+static const char *TAG = "app_mqtt_backlog";
+static SemaphoreHandle_t xBacklogMutex = NULL;
+static backlog_record_t ring[CONFIG_MQTT_BACKLOG_LEN];
+static unsigned int ring_head = 0;
+static unsigned int ring_len = 0;
+static uint32_t next_seq = 0;
+// Records numbered from here on were pushed since the restart
+static uint32_t boot_seq = 0;
+// Positions in the partition count records across all of its sectors
+static const esp_partition_t *partition = NULL;
+static unsigned int num_sectors = 0;
+static unsigned int num_records = 0;
+static unsigned int read_pos = 0;
+static unsigned int write_pos = 0;
+// Records from read_pos to write_pos, which can't tell full from empty
+static unsigned int flash_len = 0;
+
+static uint32_t record_crc(const backlog_record_t *record) {
+    return esp_rom_crc32_le(0, (const uint8_t *)record,
+                            offsetof(backlog_record_t, crc));
+}
+
+static bool record_valid(const backlog_record_t *record) {
+    return record->magic == BACKLOG_MAGIC &&
+           record->device < SMOKE_X_MAX_DEVICES &&
+           record->crc == record_crc(record);
+}
+
+static size_t record_offset(unsigned int pos) {
+    return pos / BACKLOG_RECORDS_PER_SECTOR * BACKLOG_SECTOR_SIZE +
+           pos % BACKLOG_RECORDS_PER_SECTOR * sizeof(backlog_record_t);
+}
+
+static esp_err_t read_record(unsigned int pos, backlog_record_t *record) {
+    return esp_partition_read(partition, record_offset(pos), record,
+                              sizeof(backlog_record_t));
+}
+
+/* A record that is still to be published */
+static bool record_pending(unsigned int pos, backlog_record_t *record) {
+    return read_record(pos, record) == ESP_OK && record_valid(record) &&
+           record->sent != BACKLOG_SENT;
+}
+
+static uint32_t uptime_seconds() {
+    return (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+static void fill_record(backlog_record_t *record, unsigned int device,
+                        const smoke_x_state_t *state) {
+    unsigned int num_probes = state->num_probes < SMOKE_X_MAX_PROBES
+                                  ? state->num_probes
+                                  : SMOKE_X_MAX_PROBES;
+
+    memset(record, 0, sizeof(backlog_record_t));
+    record->magic = BACKLOG_MAGIC;
+    record->device = device;
+    record->flags = (state->time_is_epoch ? BACKLOG_EPOCH : 0) |
+                    (state->billows_attached ? BACKLOG_BILLOWS : 0);
+    record->time = state->time_is_epoch ? state->time : uptime_seconds();
+    record->interval = state->link.interval;
+    record->rssi = state->link.rssi;
+    record->snr = lround(state->link.snr * 10.0);
+    record->loss = lround(state->link.loss * 1000.0);
+    record->num_probes = num_probes;
+    for (unsigned int i = 0; i < num_probes; i++) {
+        const smoke_x_probe_t *probe = &state->probes[i];
+        if (probe->attached) {
+            record->probe_flags |= BACKLOG_ATTACHED(i);
+        }
+        if (probe->alarm) {
+            record->probe_flags |= BACKLOG_ALARM(i);
+        }
+        record->temps[i] = lround(probe->temp * 10);
+        record->max_temps[i] = probe->max_temp;
+        record->min_temps[i] = probe->min_temp;
+    }
+    record->sent = BACKLOG_UNSENT;
+}
+
+static void get_state(const backlog_record_t *record,
+                      smoke_x_state_t *state) {
+    memset(state, 0, sizeof(smoke_x_state_t));
+    state->num_probes = record->num_probes;
+    state->billows_attached = record->flags & BACKLOG_BILLOWS;
+    state->time = record->time;
+    state->time_is_epoch = record->flags & BACKLOG_EPOCH;
+    state->link.rssi = record->rssi;
+    state->link.snr = record->snr / 10.0f;
+    state->link.interval = record->interval;
+    state->link.loss = record->loss / 1000.0f;
+    for (unsigned int i = 0; i < record->num_probes; i++) {
+        smoke_x_probe_t *probe = &state->probes[i];
+        probe->attached = record->probe_flags & BACKLOG_ATTACHED(i);
+        probe->alarm = record->probe_flags & BACKLOG_ALARM(i);
+        probe->temp = record->temps[i] / 10.0;
+        probe->max_temp = record->max_temps[i];
+        probe->min_temp = record->min_temps[i];
+    }
+}
+
+/* Append a record to the partition, erasing each sector as it is reached */
+static esp_err_t write_record(const backlog_record_t *record) {
+    unsigned int sector = write_pos / BACKLOG_RECORDS_PER_SECTOR;
+    unsigned int next, dropped;
+    esp_err_t err = ESP_OK;
+
+    if (write_pos % BACKLOG_RECORDS_PER_SECTOR == 0) {
+        if (flash_len && read_pos / BACKLOG_RECORDS_PER_SECTOR == sector) {
+            next = (sector + 1) % num_sectors * BACKLOG_RECORDS_PER_SECTOR;
+            dropped = (next + num_records - read_pos) % num_records;
+            ESP_LOGW(TAG, "Backlog partition full, dropped %d states",
+                     dropped);
+            read_pos = next;
+            flash_len -= dropped;
+        }
+        err = esp_partition_erase_range(
+            partition, sector * BACKLOG_SECTOR_SIZE, BACKLOG_SECTOR_SIZE);
+    }
+    if (!err) {
+        err = esp_partition_write(partition, record_offset(write_pos), record,
+                                  sizeof(backlog_record_t));
+    }
+    if (!err) {
+        write_pos = (write_pos + 1) % num_records;
+        flash_len++;
+    }
+    return err;
+}
+
+/* Move up to len of the oldest records in RAM to the partition */
+static void spill(unsigned int len) {
+    esp_err_t err;
+    while (len-- && ring_len) {
+        err = write_record(&ring[ring_head]);
+        if (err) {
+            ESP_LOGE(TAG, "Failed to write backlog (%s)", esp_err_to_name(err));
+            return;
+        }
+        ring_head = (ring_head + 1) % CONFIG_MQTT_BACKLOG_LEN;
+        ring_len--;
+    }
+}
+
+/* Keep what is in RAM across a software restart */
+static void shutdown_handler() {
+    if (xSemaphoreTake(xBacklogMutex, pdMS_TO_TICKS(100))) {
+        spill(ring_len);
+        xSemaphoreGive(xBacklogMutex);
+    }
+}
+
+/*
+ * Find where publishing left off in the partition. Calling it again starts
+ * over from the partition, as a restart would.
+ */
+esp_err_t app_mqtt_backlog_init() {
+    backlog_record_t record;
+    uint32_t newest_seq = 0, oldest_seq;
+    unsigned int newest = 0, oldest;
+    bool found = false;
+
+    if (!xBacklogMutex) {
+        xBacklogMutex = xSemaphoreCreateMutex();
+    }
+    if (!xBacklogMutex) {
+        ESP_LOGE(TAG, "Unable to create backlog mutex");
+        return ESP_FAIL;
+    }
+    ring_head = 0;
+    ring_len = 0;
+    next_seq = 0;
+    boot_seq = 0;
+    flash_len = 0;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                         ESP_PARTITION_SUBTYPE_ANY,
+                                         APP_MQTT_BACKLOG_PARTITION);
+    if (!partition || partition->size < 2 * BACKLOG_SECTOR_SIZE) {
+        ESP_LOGW(TAG, "No %s partition, backlog will be kept in RAM only",
+                 APP_MQTT_BACKLOG_PARTITION);
+        partition = NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
+    num_sectors = partition->size / BACKLOG_SECTOR_SIZE;
+    num_records = num_sectors * BACKLOG_RECORDS_PER_SECTOR;
+
+    // The newest record is in the sector whose first record is newest
+    for (unsigned int i = 0; i < num_sectors; i++) {
+        if (read_record(i * BACKLOG_RECORDS_PER_SECTOR, &record) == ESP_OK &&
+            record_valid(&record) &&
+            (!found || (int32_t)(record.seq - newest_seq) > 0)) {
+            newest_seq = record.seq;
+            newest = i;
+            found = true;
+        }
+    }
+
+    if (found) {
+        // Slots are filled in order, find the first one that is still erased
+        unsigned int lo = 1, hi = BACKLOG_RECORDS_PER_SECTOR;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            if (read_record(newest * BACKLOG_RECORDS_PER_SECTOR + mid,
+                            &record) == ESP_OK &&
+                record.magic == BACKLOG_ERASED) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        write_pos = (newest * BACKLOG_RECORDS_PER_SECTOR + lo) % num_records;
+
+        /*
+         * Records popped from RAM took numbers that never reached flash, so
+         * numbering goes on from the last one written. A torn write is
+         * skipped, still counting its slot.
+         */
+        next_seq = newest_seq + lo;
+        for (unsigned int i = lo - 1; i > 0; i--) {
+            if (read_record(newest * BACKLOG_RECORDS_PER_SECTOR + i,
+                            &record) == ESP_OK &&
+                record_valid(&record)) {
+                next_seq = record.seq + lo - i;
+                break;
+            }
+        }
+
+        // Walk back over the sectors written before it
+        oldest = newest;
+        oldest_seq = newest_seq;
+        for (unsigned int i = 1; i < num_sectors; i++) {
+            unsigned int prev = (oldest + num_sectors - 1) % num_sectors;
+            if (read_record(prev * BACKLOG_RECORDS_PER_SECTOR, &record) !=
+                    ESP_OK ||
+                !record_valid(&record) ||
+                (int32_t)(record.seq - oldest_seq) >= 0) {
+                break;
+            }
+            oldest = prev;
+            oldest_seq = record.seq;
+        }
+
+        // Only a full partition has the oldest record where the next goes
+        read_pos = oldest * BACKLOG_RECORDS_PER_SECTOR;
+        flash_len = (write_pos + num_records - read_pos) % num_records;
+        flash_len = flash_len ? flash_len : num_records;
+
+        // Records are published in order, skip the sectors that all were
+        while (read_pos / BACKLOG_RECORDS_PER_SECTOR != newest) {
+            if (read_record(read_pos + BACKLOG_RECORDS_PER_SECTOR - 1,
+                            &record) != ESP_OK ||
+                !record_valid(&record) || record.sent != BACKLOG_SENT) {
+                break;
+            }
+            read_pos = (read_pos + BACKLOG_RECORDS_PER_SECTOR) % num_records;
+            flash_len -= BACKLOG_RECORDS_PER_SECTOR;
+        }
+        while (flash_len && !record_pending(read_pos, &record)) {
+            read_pos = (read_pos + 1) % num_records;
+            flash_len--;
+        }
+    } else {
+        // Empty partition, the first write erases and starts at sector 0
+        write_pos = 0;
+        read_pos = 0;
+    }
+    boot_seq = next_seq;
+    esp_register_shutdown_handler(shutdown_handler);
+    ESP_LOGI(TAG, "Backlog has %d sectors, %d states left to publish",
+             num_sectors, flash_len);
+    return ESP_OK;
+}
+
+/* Keep a state received while the broker can't be reached */
+void app_mqtt_backlog_push(unsigned int device, const smoke_x_state_t *state) {
+    backlog_record_t record;
+
+    if (!xBacklogMutex || device >= SMOKE_X_MAX_DEVICES) {
+        return;
+    }
+    fill_record(&record, device, state);
+    if (xSemaphoreTake(xBacklogMutex, portMAX_DELAY)) {
+        record.seq = next_seq++;
+        record.crc = record_crc(&record);
+        if (ring_len == CONFIG_MQTT_BACKLOG_LEN && partition) {
+            spill(BACKLOG_SPILL_LEN);
+        }
+        if (ring_len == CONFIG_MQTT_BACKLOG_LEN) {
+            ESP_LOGW(TAG, "Backlog full, dropped the oldest state");
+            ring_head = (ring_head + 1) % CONFIG_MQTT_BACKLOG_LEN;
+            ring_len--;
+        }
+        ring[(ring_head + ring_len) % CONFIG_MQTT_BACKLOG_LEN] = record;
+        ring_len++;
+        xSemaphoreGive(xBacklogMutex);
+    }
+}
+
+/*
+ * Get the oldest state left to publish, and the sequence number to pop it
+ * with once it was. Returns false if there is none.
+ */
+bool app_mqtt_backlog_peek(unsigned int *device, smoke_x_state_t *state,
+                           uint32_t *seq) {
+    backlog_record_t record;
+    bool found = false;
+
+    if (!xBacklogMutex) {
+        return false;
+    }
+    if (xSemaphoreTake(xBacklogMutex, portMAX_DELAY)) {
+        // What is in flash is older than what is in RAM
+        while (!found && flash_len) {
+            found = record_pending(read_pos, &record);
+            if (!found) {
+                read_pos = (read_pos + 1) % num_records;
+                flash_len--;
+            }
+        }
+        if (!found && ring_len) {
+            record = ring[ring_head];
+            found = true;
+        }
+        xSemaphoreGive(xBacklogMutex);
+    }
+    if (found) {
+        *device = record.device;
+        *seq = record.seq;
+        get_state(&record, state);
+        // Received since the restart, before the wall clock was set
+        if (!state->time_is_epoch && (int32_t)(record.seq - boot_seq) >= 0 &&
+            smoke_x_history_clock_synced()) {
+            state->time =
+                smoke_x_history_now() - (uptime_seconds() - record.time);
+            state->time_is_epoch = true;
+        }
+    }
+    return found;
+}
+
+/* Forget a state that was published, unless it was dropped since */
+void app_mqtt_backlog_pop(uint32_t seq) {
+    backlog_record_t record;
+    uint8_t sent = BACKLOG_SENT;
+
+    if (!xBacklogMutex) {
+        return;
+    }
+    if (xSemaphoreTake(xBacklogMutex, portMAX_DELAY)) {
+        if (flash_len && read_record(read_pos, &record) == ESP_OK &&
+            record.seq == seq) {
+            esp_partition_write(
+                partition,
+                record_offset(read_pos) + offsetof(backlog_record_t, sent),
+                &sent, sizeof(sent));
+            read_pos = (read_pos + 1) % num_records;
+            flash_len--;
+        } else if (ring_len && ring[ring_head].seq == seq) {
+            ring_head = (ring_head + 1) % CONFIG_MQTT_BACKLOG_LEN;
+            ring_len--;
+        }
+        xSemaphoreGive(xBacklogMutex);
+    }
+}
+
+unsigned int app_mqtt_backlog_count() {
+    unsigned int count = 0;
+    if (xBacklogMutex && xSemaphoreTake(xBacklogMutex, portMAX_DELAY)) {
+        count = ring_len + flash_len;
+        xSemaphoreGive(xBacklogMutex);
+    }
+    return count;
+}
@@ -0,0 +1,17 @@
+#ifndef APP_MQTT_BACKLOG_H
+#define APP_MQTT_BACKLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "smoke_x.h"
+
+#define APP_MQTT_BACKLOG_PARTITION "mqttlog"
+
+esp_err_t app_mqtt_backlog_init();
+void app_mqtt_backlog_push(unsigned int device, const smoke_x_state_t *state);
+bool app_mqtt_backlog_peek(unsigned int *device, smoke_x_state_t *state,
+                           uint32_t *seq);
+void app_mqtt_backlog_pop(uint32_t seq);
+unsigned int app_mqtt_backlog_count();
+
+#endif
@@ -0,0 +1,276 @@
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "app_mqtt_json.h"
+
+/*
+ * Serializer for the state payload. It writes what cJSON printed for the
+ * object app_mqtt used to build, straight into the caller's buffer: the keys
+ * of every probe are string literals with their lengths known at compile
+ * time, and numbers are formatted by hand. Temperatures, SNR and packet loss
+ * are whole tenths, which print without any floating point formatting, so
+ * nothing is allocated. Only billows_target differs, it is written once
+ * after the probes where the cJSON object repeated it after each of them.
+ *
+ * The same writer can instead hand every value over on its own, unquoted,
+ * for publishing each one to its own topic.
+ */
+
+typedef struct {
+    const char *str;
+    size_t len;
+} json_key_t;
+
+typedef struct {
+    json_key_t attached;
+    json_key_t alarm;
+    json_key_t temp;
+    json_key_t max;
+    json_key_t min;
+} probe_keys_t;
+
+typedef struct {
+    char *p;
+    char *end;
+    bool need_sep;
+    bool overflow;
+    // Set to write values one by one rather than a JSON object
+    app_mqtt_json_value_fn_t value_fn;
+    void *ctx;
+    const char *key;
+    char value[APP_MQTT_JSON_VALUE_LEN];
+} json_writer_t;
+
+#define KEY(name) \
+    { name, sizeof(name) - 1 }
+#define PROBE_KEYS(n)                                              \
+    {                                                              \
+        KEY("probe_" #n "_attached"), KEY("probe_" #n "_alarm"),   \
+            KEY("probe_" #n "_temp"), KEY("probe_" #n "_max"),     \
+            KEY("probe_" #n "_min")                                \
+    }
+
+_Static_assert(SMOKE_X_MAX_PROBES == 4, "Keys are listed for 4 probes");
+static const probe_keys_t probe_keys[SMOKE_X_MAX_PROBES] = {
+    PROBE_KEYS(1), PROBE_KEYS(2), PROBE_KEYS(3), PROBE_KEYS(4)};
+static const json_key_t billows_target_key = KEY("billows_target");
+static const json_key_t billows_attached_key = KEY("billows_attached");
+static const json_key_t time_key = KEY("time");
+static const json_key_t rssi_key = KEY("rssi");
+static const json_key_t snr_key = KEY("snr");
+static const json_key_t packet_interval_key = KEY("packet_interval");
+static const json_key_t packet_loss_key = KEY("packet_loss");
+
+static void put(json_writer_t *w, const char *str, size_t len) {
+    if (w->overflow || (size_t)(w->end - w->p) < len) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->p, str, len);
+    w->p += len;
+}
+
+/* Hand over the value written since the last key, if writing values */
+static void end_value(json_writer_t *w) {
+    if (w->value_fn && w->key) {
+        if (!w->overflow) {
+            *w->p = '\0';
+            w->value_fn(w->key, w->value, w->ctx);
+        }
+        w->key = NULL;
+    }
+}
+
+static void put_key(json_writer_t *w, const json_key_t *key) {
+    if (w->value_fn) {
+        end_value(w);
+        w->key = key->str;
+        w->p = w->value;
+        w->end = w->value + sizeof(w->value) - 1;
+        w->overflow = false;
+        return;
+    }
+    if (w->need_sep) {
+        put(w, ",", 1);
+    }
+    put(w, "\"", 1);
+    put(w, key->str, key->len);
+    put(w, "\":", 2);
+    w->need_sep = true;
+}
+
+static void put_str(json_writer_t *w, const char *str, size_t len) {
+    if (w->value_fn) {
+        put(w, str, len);
+    } else {
+        put(w, "\"", 1);
+        put(w, str, len);
+        put(w, "\"", 1);
+    }
+}
+
+static void put_on_off(json_writer_t *w, bool on) {
+    if (on) {
+        put_str(w, "ON", 2);
+    } else {
+        put_str(w, "OFF", 3);
+    }
+}
+
+static void put_offline(json_writer_t *w) { put_str(w, "offline", 7); }
+
+static void put_uint(json_writer_t *w, uint32_t val) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    put(w, digits + sizeof(digits) - n, n);
+}
+
+static void put_int(json_writer_t *w, int32_t val) {
+    if (val < 0) {
+        put(w, "-", 1);
+        put_uint(w, -(uint32_t)val);
+    } else {
+        put_uint(w, val);
+    }
+}
+
+// Writes a number of tenths the way cJSON prints the equivalent double
+static void put_deci(json_writer_t *w, int32_t tenths) {
+    uint32_t abs_tenths = tenths < 0 ? -(uint32_t)tenths : (uint32_t)tenths;
+    char frac[2] = {'.', '0' + abs_tenths % 10};
+    if (tenths < 0) {
+        put(w, "-", 1);
+    }
+    put_uint(w, abs_tenths / 10);
+    if (abs_tenths % 10) {
+        put(w, frac, sizeof(frac));
+    }
+}
+
+/* Writes a double the way cJSON prints it */
+static void put_double(json_writer_t *w, double val) {
+    char num[26];
+    double test = 0;
+    long tenths;
+    int len;
+
+    if (isnan(val) || isinf(val)) {
+        put(w, "null", 4);
+        return;
+    }
+    if (fabs(val) < INT32_MAX / 10) {
+        tenths = lround(val * 10);
+        if (tenths / 10.0 == val) {
+            put_deci(w, tenths);
+            return;
+        }
+    }
+    // Not a whole number of tenths, this is what cJSON does for any number
+    len = snprintf(num, sizeof(num), "%1.15g", val);
+    if (sscanf(num, "%lg", &test) != 1 ||
+        fabs(test - val) > fmax(fabs(test), fabs(val)) * DBL_EPSILON) {
+        len = snprintf(num, sizeof(num), "%1.17g", val);
+    }
+    put(w, num, len);
+}
+
+static void write_state(json_writer_t *w, const smoke_x_state_t *state) {
+    unsigned int num_probes = state->num_probes < SMOKE_X_MAX_PROBES
+                                  ? state->num_probes
+                                  : SMOKE_X_MAX_PROBES;
+    const smoke_x_probe_t *billows_probe = NULL;
+
+    for (unsigned int i = 0; i < num_probes; i++) {
+        const smoke_x_probe_t *probe = &state->probes[i];
+        const probe_keys_t *keys = &probe_keys[i];
+        // The last probe reports the billows target instead of its alarms
+        bool billows = i == num_probes - 1 && state->billows_attached;
+
+        put_key(w, &keys->attached);
+        put_on_off(w, probe->attached);
+        put_key(w, &keys->alarm);
+        if (probe->attached) {
+            put_on_off(w, probe->alarm);
+            put_key(w, &keys->temp);
+            put_double(w, probe->temp);
+            if (billows) {
+                put_key(w, &keys->max);
+                put_offline(w);
+                put_key(w, &keys->min);
+                put_offline(w);
+                billows_probe = probe;
+            } else {
+                put_key(w, &keys->max);
+                put_int(w, probe->max_temp);
+                put_key(w, &keys->min);
+                put_int(w, probe->min_temp);
+            }
+        } else {
+            put_offline(w);
+            put_key(w, &keys->temp);
+            put_offline(w);
+            put_key(w, &keys->max);
+            put_offline(w);
+            put_key(w, &keys->min);
+            put_offline(w);
+        }
+    }
+    // Always there and only once, right after the probes
+    put_key(w, &billows_target_key);
+    if (billows_probe) {
+        put_int(w, billows_probe->billows_target);
+    } else {
+        put_offline(w);
+    }
+    put_key(w, &billows_attached_key);
+    put_on_off(w, state->billows_attached);
+    if (state->time_is_epoch) {
+        put_key(w, &time_key);
+        put_uint(w, state->time);
+    }
+    put_key(w, &rssi_key);
+    put_int(w, state->link.rssi);
+    put_key(w, &snr_key);
+    put_double(w, round(state->link.snr * 10) / 10);
+    if (state->link.interval) {
+        put_key(w, &packet_interval_key);
+        put_uint(w, state->link.interval);
+    }
+    put_key(w, &packet_loss_key);
+    put_double(w, round(state->link.loss * 1000) / 10);
+}
+
+/*
+ * Write the state payload into buf, null terminated. Returns its length, or
+ * 0 if it doesn't fit in len bytes.
+ */
+size_t app_mqtt_json_state(const smoke_x_state_t *state, char *buf,
+                           size_t len) {
+    json_writer_t w = {.p = buf, .end = buf + len, .overflow = !len};
+
+    put(&w, "{", 1);
+    write_state(&w, state);
+    put(&w, "}", 1);
+    put(&w, "", 1);
+
+    return w.overflow ? 0 : w.p - buf - 1;
+}
+
+/*
+ * Call value_fn with every value of the state, named by its key in the
+ * payload. Strings are not quoted, a value too long to format is skipped.
+ */
+void app_mqtt_json_values(const smoke_x_state_t *state,
+                          app_mqtt_json_value_fn_t value_fn, void *ctx) {
+    json_writer_t w = {.value_fn = value_fn, .ctx = ctx};
+
+    write_state(&w, state);
+    end_value(&w);
+}
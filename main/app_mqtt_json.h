@@ -0,0 +1,20 @@
+#ifndef APP_MQTT_JSON_H
+#define APP_MQTT_JSON_H
+
+#include <stddef.h>
+#include "smoke_x.h"
+
+// Room for any value on its own, null terminated
+#define APP_MQTT_JSON_VALUE_LEN 26
+// Values of a state with the most probes
+#define APP_MQTT_JSON_MAX_VALUES (SMOKE_X_MAX_PROBES * 5 + 7)
+
+typedef void (*app_mqtt_json_value_fn_t)(const char *key, const char *value,
+                                         void *ctx);
+
+size_t app_mqtt_json_state(const smoke_x_state_t *state, char *buf,
+                           size_t len);
+void app_mqtt_json_values(const smoke_x_state_t *state,
+                          app_mqtt_json_value_fn_t value_fn, void *ctx);
+
+#endif
@@ -0,0 +1,62 @@
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "app_radio.h"
+
+static const char *TAG = "app_radio";
+static bool dio_wired = false;
+
+static void IRAM_ATTR gpio_isr(void *arg) { ((app_radio_rx_done_t)arg)(); }
+
+/* Call rx_done on the rising edge of a modem DIO line, for the drivers */
+esp_err_t app_radio_gpio_rx_done(int gpio, app_radio_rx_done_t rx_done) {
+    gpio_config_t io_conf = {.pin_bit_mask = 1ULL << gpio,
+                             .mode = GPIO_MODE_INPUT,
+                             .intr_type = GPIO_INTR_POSEDGE};
+    esp_err_t err;
+
+    if (gpio < 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    err = gpio_config(&io_conf);
+    if (!err) {
+        err = gpio_install_isr_service(0);
+        // Already installed by another driver is fine
+        if (err == ESP_ERR_INVALID_STATE) err = ESP_OK;
+    }
+    if (!err) {
+        err = gpio_isr_handler_add(gpio, gpio_isr, rx_done);
+    }
+    if (err) {
+        ESP_LOGE(TAG, "Unable to set up receive interrupt on GPIO %d (%s)",
+                 gpio, esp_err_to_name(err));
+    }
+    dio_wired = !err;
+    return err;
+}
+
+/*
+ * Wait until done() returns true or ticks run out, for the drivers to wait
+ * on a modem operation from the radio task. The DIO line wakes it up when
+ * it is wired, otherwise done() is polled every tick. A notification taken
+ * here for a new command is not lost, the radio task goes through its
+ * command queue after every command.
+ */
+bool app_radio_wait_dio(bool (*done)(), TickType_t ticks) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t waited;
+    while (!done()) {
+        waited = xTaskGetTickCount() - start;
+        if (waited >= ticks) {
+            return false;
+        }
+        if (dio_wired) {
+            ulTaskNotifyTake(pdTRUE, ticks - waited);
+        } else {
+            vTaskDelay(1);
+        }
+    }
+    return true;
+}
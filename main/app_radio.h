@@ -0,0 +1,51 @@
+#ifndef APP_RADIO_H
+#define APP_RADIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include "app_lora.h"
+
+/* Signals that a packet is ready, may be called from an ISR */
+typedef void (*app_radio_rx_done_t)();
+
+typedef struct {
+    int16_t rssi;  // dBm
+    float snr;     // dB
+} app_radio_status_t;
+
+/*
+ * Operations of a radio driver. app_lora serializes every call, so drivers
+ * only need locking for state they share with other tasks or ISRs.
+ */
+typedef struct {
+    const char *name;
+    esp_err_t (*init)(const app_lora_params_t *params);
+    // Apply params, staying in receive mode if it was started. Drivers keep
+    // what they applied and only write the fields that changed.
+    esp_err_t (*configure)(const app_lora_params_t *params);
+    esp_err_t (*send)(const uint8_t *buf, size_t len);
+    // Receive continuously until the next send or configure
+    esp_err_t (*start_rx)();
+    esp_err_t (*stop_rx)();
+    // Read the next received packet, returns its length or 0 if there is none
+    int (*receive)(uint8_t *buf, size_t max_len);
+    // Signal quality of the packet last read by receive
+    void (*status)(app_radio_status_t *status);
+    // ESP_ERR_NOT_SUPPORTED if there is no interrupt and receive must be polled
+    esp_err_t (*set_rx_done)(app_radio_rx_done_t rx_done);
+    // Channel activity detection: look for a preamble on the current
+    // frequency, then go back to receiving if receive was started. Optional.
+    esp_err_t (*cad)(bool *detected);
+} app_radio_t;
+
+esp_err_t app_radio_gpio_rx_done(int gpio, app_radio_rx_done_t rx_done);
+bool app_radio_wait_dio(bool (*done)(), TickType_t ticks);
+
+extern const app_radio_t app_radio_sx126x;
+extern const app_radio_t app_radio_sx127x;
+extern const app_radio_t app_radio_sim;
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdbool.h>
+#include <string.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "app_radio.h"
+#include "app_radio_sim.h"
+
+/*
+ * Radio without any hardware behind it. Packets injected by the web UI, a
+ * test or a benchmark go through a simulated channel that loses, duplicates
+ * and varies the RSSI of packets, then wait to be read like the modem's
+ * FIFO. It only needs FreeRTOS, so the whole receive path can also run on a
+ * Linux host.
+ *
+ * A transmitter can be put on the air at a frequency, then only a radio
+ * tuned to it receives the injected packets or detects channel activity.
+ */
+
+#define SIM_QUEUE_LEN 16
+
+typedef struct {
+    uint8_t payload[PAYLOAD_LEN_MAX];
+    uint8_t len;
+    app_radio_status_t status;
+} sim_packet_t;
+
+static const char *TAG = "app_radio_sim";
+static SemaphoreHandle_t xSimMutex = NULL;
+static sim_packet_t queue[SIM_QUEUE_LEN];
+static unsigned int head = 0;
+static unsigned int count = 0;
+static app_radio_status_t last_status;
+static app_radio_sim_channel_t channel;
+static uint32_t rng_state = 1;
+static bool receiving = false;
+static app_radio_rx_done_t rx_done_cb = NULL;
+static bool rx_done_wired = true;
+static app_radio_sim_stats_t stats;
+static uint32_t frequency = 0;
+static uint32_t active_frequency = 0;
+
+/* xorshift32, unlike rand() the sequence only depends on the seed */
+static uint32_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static bool chance(uint8_t pct) { return next_random() % 100 < pct; }
+
+static void push_packet(const uint8_t *buf, size_t len,
+                        const app_radio_status_t *status) {
+    sim_packet_t *pkt;
+    if (count == SIM_QUEUE_LEN) {
+        stats.overflowed++;
+        return;
+    }
+    pkt = &queue[(head + count++) % SIM_QUEUE_LEN];
+    memcpy(pkt->payload, buf, len);
+    pkt->len = len;
+    pkt->status = *status;
+}
+
+static esp_err_t sim_init(const app_lora_params_t *params) {
+    if (!xSimMutex) {
+        xSimMutex = xSemaphoreCreateMutex();
+    }
+    if (!xSimMutex) {
+        ESP_LOGE(TAG, "Unable to create simulated radio mutex");
+        return ESP_FAIL;
+    }
+    ESP_LOGW(TAG, "Using a simulated radio, nothing will be received "
+                  "unless it is injected");
+    return ESP_OK;
+}
+
+static esp_err_t sim_configure(const app_lora_params_t *params) {
+    ESP_LOGD(TAG, "Configured f=%d bw=%d sf=%d", params->frequency,
+             params->bandwidth, params->spreading_factor);
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        frequency = params->frequency;
+        xSemaphoreGive(xSimMutex);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sim_send(const uint8_t *buf, size_t len) {
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        stats.sent++;
+        xSemaphoreGive(xSimMutex);
+    }
+    ESP_LOGI(TAG, "Sent %d bytes: %.*s", len, (int)len, buf);
+    return ESP_OK;
+}
+
+static esp_err_t sim_start_rx() {
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        receiving = true;
+        xSemaphoreGive(xSimMutex);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sim_stop_rx() {
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        receiving = false;
+        count = 0;
+        xSemaphoreGive(xSimMutex);
+    }
+    return ESP_OK;
+}
+
+static int sim_receive(uint8_t *buf, size_t max_len) {
+    int len = 0;
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        stats.reads++;
+        if (count) {
+            sim_packet_t *pkt = &queue[head];
+            len = pkt->len < max_len ? pkt->len : max_len;
+            memcpy(buf, pkt->payload, len);
+            last_status = pkt->status;
+            head = (head + 1) % SIM_QUEUE_LEN;
+            count--;
+        }
+        xSemaphoreGive(xSimMutex);
+    }
+    return len;
+}
+
+static void sim_status(app_radio_status_t *status) { *status = last_status; }
+
+static esp_err_t sim_set_rx_done(app_radio_rx_done_t rx_done) {
+    if (!rx_done_wired) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    rx_done_cb = rx_done;
+    return ESP_OK;
+}
+
+/* Instant, the scan's hop dwell paces the checks as it does on a modem */
+static esp_err_t sim_cad(bool *detected) {
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        stats.cad_checks++;
+        *detected = active_frequency && active_frequency == frequency;
+        xSemaphoreGive(xSimMutex);
+    }
+    return ESP_OK;
+}
+
+const app_radio_t app_radio_sim = {
+    .name = "simulated",
+    .init = sim_init,
+    .configure = sim_configure,
+    .send = sim_send,
+    .start_rx = sim_start_rx,
+    .stop_rx = sim_stop_rx,
+    .receive = sim_receive,
+    .status = sim_status,
+    .set_rx_done = sim_set_rx_done,
+    .cad = sim_cad,
+};
+
+/* Transmit a packet to the receiver through the simulated channel */
+esp_err_t app_radio_sim_inject(const uint8_t *buf, size_t len, int16_t rssi,
+                               float snr) {
+    app_radio_status_t status = {.rssi = rssi, .snr = snr};
+    unsigned int copies = 0;
+
+    if (len == 0 || len > PAYLOAD_LEN_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!xSimMutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        stats.injected++;
+        if (!receiving || chance(channel.loss_pct) ||
+            (active_frequency && active_frequency != frequency)) {
+            stats.lost++;
+        } else if (chance(channel.duplicate_pct)) {
+            stats.duplicated++;
+            copies = 2;
+        } else {
+            copies = 1;
+        }
+        for (unsigned int i = 0; i < copies; i++) {
+            if (channel.rssi_jitter) {
+                status.rssi = rssi - channel.rssi_jitter +
+                              next_random() % (2 * channel.rssi_jitter + 1);
+            }
+            push_packet(buf, len, &status);
+        }
+        xSemaphoreGive(xSimMutex);
+    }
+    if (copies && rx_done_cb) {
+        rx_done_cb();
+    }
+    return ESP_OK;
+}
+
+void app_radio_sim_set_channel(const app_radio_sim_channel_t *in_channel) {
+    if (xSimMutex && xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        channel = *in_channel;
+        // A zero state would make xorshift return zero forever
+        rng_state = channel.seed ? channel.seed : 1;
+        xSemaphoreGive(xSimMutex);
+    }
+}
+
+/* Put a transmitter on the air at frequency, or take it off with 0 */
+void app_radio_sim_set_activity(uint32_t in_frequency) {
+    if (xSimMutex && xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        active_frequency = in_frequency;
+        xSemaphoreGive(xSimMutex);
+    }
+}
+
+/*
+ * Whether the receive done line is wired, as with DIO1_GPIO or DIO0_GPIO
+ * set to -1 when it isn't. Takes effect on the next app_lora_init().
+ */
+void app_radio_sim_set_rx_done_wired(bool wired) { rx_done_wired = wired; }
+
+void app_radio_sim_get_stats(app_radio_sim_stats_t *out_stats) {
+    if (xSimMutex && xSemaphoreTake(xSimMutex, portMAX_DELAY)) {
+        *out_stats = stats;
+        xSemaphoreGive(xSimMutex);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef APP_RADIO_SIM_H
+#define APP_RADIO_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+typedef struct {
+    uint8_t loss_pct;       // Injected packets that never arrive
+    uint8_t duplicate_pct;  // Packets that arrive twice
+    uint8_t rssi_jitter;    // RSSI varies by up to +/- this many dB
+    uint32_t seed;          // Same seed, same losses and duplicates
+} app_radio_sim_channel_t;
+
+typedef struct {
+    uint32_t injected;
+    uint32_t lost;  // By the channel, or while not receiving or tuned to it
+    uint32_t duplicated;
+    uint32_t overflowed;  // Pending packets not read in time
+    uint32_t sent;
+    uint32_t cad_checks;
+    uint32_t reads;  // Of the receive buffer, with a packet in it or not
+} app_radio_sim_stats_t;
+
+esp_err_t app_radio_sim_inject(const uint8_t *buf, size_t len, int16_t rssi,
+                               float snr);
+void app_radio_sim_set_channel(const app_radio_sim_channel_t *channel);
+void app_radio_sim_set_activity(uint32_t frequency);
+void app_radio_sim_set_rx_done_wired(bool wired);
+void app_radio_sim_get_stats(app_radio_sim_stats_t *out_stats);
+
+#endif
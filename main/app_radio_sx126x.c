@@ -0,0 +1,137 @@
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "app_radio.h"
+#include "ra01s.h"
+
+#define DEFAULT_TCXO_VOLTAGE 3.3
+#define DEFAULT_USE_REGULATOR_LDO 1
+// A 2 symbol CAD takes under 10 ms up to SF9
+#define CAD_TIMEOUT_TICKS (pdMS_TO_TICKS(100) + 1)
+#define CAD_DET_MIN 10
+
+static const char *TAG = "app_radio_sx126x";
+static uint8_t spreading_factor;
+static uint16_t cad_irq;
+// What the modem was last configured with, valid once configured
+static app_lora_params_t applied;
+static bool configured = false;
+
+static esp_err_t sx126x_init(const app_lora_params_t *params) {
+    LoRaInit();
+    if (LoRaBegin(params->frequency, params->tx_power, DEFAULT_TCXO_VOLTAGE,
+                  DEFAULT_USE_REGULATOR_LDO)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* Fields LoRaConfig writes, tx_power is only set by LoRaBegin */
+static bool modulation_changed(const app_lora_params_t *params) {
+    return params->spreading_factor != applied.spreading_factor ||
+           params->bandwidth != applied.bandwidth ||
+           params->coding_rate != applied.coding_rate ||
+           params->preamble_len != applied.preamble_len ||
+           params->crc_on != applied.crc_on;
+}
+
+/*
+ * A frequency change alone only takes the modem through standby, so retuning
+ * while scanning or hopping between transmitters skips the modulation and
+ * packet setup.
+ */
+static esp_err_t sx126x_configure(const app_lora_params_t *params) {
+    if (!configured || modulation_changed(params)) {
+        spreading_factor = params->spreading_factor;
+        LoRaConfig(params->spreading_factor, params->bandwidth,
+                   params->coding_rate, params->preamble_len, 0,
+                   params->crc_on, false);
+        SetRfFrequency(params->frequency);
+        SetDioIrqParams(SX126X_IRQ_ALL, SX126X_IRQ_RX_DONE, SX126X_IRQ_NONE,
+                        SX126X_IRQ_NONE);
+        SetRx(0xFFFFFF);
+    } else if (params->frequency != applied.frequency) {
+        SetStandby(SX126X_STANDBY_RC);
+        SetRfFrequency(params->frequency);
+        SetRx(0xFFFFFF);
+    }
+    applied = *params;
+    configured = true;
+    return ESP_OK;
+}
+
+static esp_err_t sx126x_send(const uint8_t *buf, size_t len) {
+    if (!LoRaSend((uint8_t *)buf, len, SX126x_TXMODE_SYNC)) {
+        ESP_LOGE(TAG, "Send fail");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* configure already left the modem in continuous receive */
+static esp_err_t sx126x_start_rx() { return ESP_OK; }
+
+/* The modem keeps receiving, packets are just no longer read */
+static esp_err_t sx126x_stop_rx() { return ESP_OK; }
+
+static int sx126x_receive(uint8_t *buf, size_t max_len) {
+    return LoRaReceive(buf, max_len);
+}
+
+static void sx126x_status(app_radio_status_t *status) {
+    int8_t rssi, snr;
+    GetPacketStatus(&rssi, &snr);
+    status->rssi = rssi;
+    status->snr = snr;
+}
+
+/* configure routes RX_DONE to DIO1 */
+static esp_err_t sx126x_set_rx_done(app_radio_rx_done_t rx_done) {
+    return app_radio_gpio_rx_done(CONFIG_DIO1_GPIO, rx_done);
+}
+
+static bool cad_done() {
+    cad_irq = GetIrqStatus();
+    return cad_irq & SX126X_IRQ_CAD_DONE;
+}
+
+static esp_err_t sx126x_cad(bool *detected) {
+    // Detection peak threshold grows with the spreading factor
+    uint8_t cad_params[] = {SX126X_CAD_ON_2_SYMB, spreading_factor + 13,
+                            CAD_DET_MIN, SX126X_CAD_GOTO_STDBY, 0, 0, 0};
+    bool done;
+
+    SetStandby(SX126X_STANDBY_RC);
+    // CAD done on DIO1 wakes the radio task up as RX done does
+    SetDioIrqParams(SX126X_IRQ_ALL, SX126X_IRQ_CAD_DONE, SX126X_IRQ_NONE,
+                    SX126X_IRQ_NONE);
+    ClearIrqStatus(SX126X_IRQ_ALL);
+    WriteCommand(SX126X_CMD_SET_CAD_PARAMS, cad_params, sizeof(cad_params));
+    WriteCommand(SX126X_CMD_SET_CAD, NULL, 0);
+    done = app_radio_wait_dio(cad_done, CAD_TIMEOUT_TICKS);
+    ClearIrqStatus(SX126X_IRQ_ALL);
+    *detected = cad_irq & SX126X_IRQ_CAD_DETECTED;
+
+    // Back to continuous receive, as configure leaves the modem
+    SetDioIrqParams(SX126X_IRQ_ALL, SX126X_IRQ_RX_DONE, SX126X_IRQ_NONE,
+                    SX126X_IRQ_NONE);
+    SetRx(0xFFFFFF);
+    if (!done) {
+        ESP_LOGW(TAG, "Channel activity detection timed out");
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+const app_radio_t app_radio_sx126x = {
+    .name = "SX126x",
+    .init = sx126x_init,
+    .configure = sx126x_configure,
+    .send = sx126x_send,
+    .start_rx = sx126x_start_rx,
+    .stop_rx = sx126x_stop_rx,
+    .receive = sx126x_receive,
+    .status = sx126x_status,
+    .set_rx_done = sx126x_set_rx_done,
+    .cad = sx126x_cad,
+};
@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "app_radio.h"
+#include "lora.h"
+
+// Registers and flags not exported by the driver
+#define REG_OP_MODE 0x01
+#define REG_IRQ_FLAGS 0x12
+#define REG_DIO_MAPPING_1 0x40
+#define MODE_LONG_RANGE_MODE 0x80
+#define MODE_CAD 0x07
+#define IRQ_CAD_DETECTED 0x01
+#define IRQ_CAD_DONE 0x04
+// DIO0 signals RxDone in receive mode, CadDone in CAD mode
+#define DIO0_RX_DONE 0x00
+#define DIO0_CAD_DONE 0x80
+// A CAD takes about 2 symbols, under 10 ms up to SF9
+#define CAD_TIMEOUT_TICKS (pdMS_TO_TICKS(100) + 1)
+
+static const char *TAG = "app_radio_sx127x";
+static bool receiving = false;
+// What the modem registers hold, valid once configured
+static app_lora_params_t applied;
+static bool configured = false;
+static int cad_flags;
+
+static esp_err_t sx127x_init(const app_lora_params_t *params) {
+    return lora_init() ? ESP_OK : ESP_FAIL;
+}
+
+/* Only the registers of fields that changed since the last call are written */
+static esp_err_t sx127x_configure(const app_lora_params_t *params) {
+    bool all = !configured;
+
+    if (configured && app_lora_params_equal(params, &applied)) {
+        return ESP_OK;
+    }
+    ESP_LOGD(TAG, "Setting radio parameters");
+    lora_idle();
+    if (all || params->frequency != applied.frequency) {
+        ESP_LOGD(TAG, "  Frequency %d", params->frequency);
+        lora_set_frequency(params->frequency);
+    }
+    if (all || params->bandwidth != applied.bandwidth) {
+        ESP_LOGD(TAG, "  Bandwidth %d", params->bandwidth);
+        lora_set_bandwidth(params->bandwidth);
+    }
+    if (all || params->spreading_factor != applied.spreading_factor) {
+        ESP_LOGD(TAG, "  Spreading Factor %d", params->spreading_factor);
+        lora_set_spreading_factor(params->spreading_factor);
+    }
+    if (all || params->tx_power != applied.tx_power) {
+        ESP_LOGD(TAG, "  Transmit Power %d", params->tx_power);
+        lora_set_tx_power(params->tx_power);
+    }
+    if (all || params->coding_rate != applied.coding_rate) {
+        ESP_LOGD(TAG, "  Coding Rate %d", params->coding_rate);
+        lora_set_coding_rate(params->coding_rate);
+    }
+    if (all || params->sync_word != applied.sync_word) {
+        ESP_LOGD(TAG, "  Sync Word %d", params->sync_word);
+        lora_set_sync_word(params->sync_word);
+    }
+    if (all || params->implicit_hdr != applied.implicit_hdr) {
+        ESP_LOGD(TAG, "  Implicit Header %d", params->implicit_hdr);
+        if (params->implicit_hdr) {
+            lora_explicit_header_mode();
+        } else {
+            // lora_implicit_header_mode(params->payload_len);
+        }
+    }
+    if (all || params->crc_on != applied.crc_on) {
+        ESP_LOGD(TAG, "  CRC Enable %d", params->crc_on);
+        if (params->crc_on)
+            lora_enable_crc();
+        else {
+            lora_disable_crc();
+        }
+    }
+    applied = *params;
+    configured = true;
+    // lora_idle() stopped the receiver
+    if (receiving) {
+        lora_receive();
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sx127x_send(const uint8_t *buf, size_t len) {
+    lora_send_packet((uint8_t *)buf, len);
+    if (receiving) {
+        lora_receive();
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sx127x_start_rx() {
+    receiving = true;
+    lora_receive();
+    return ESP_OK;
+}
+
+static esp_err_t sx127x_stop_rx() {
+    receiving = false;
+    lora_idle();
+    return ESP_OK;
+}
+
+static int sx127x_receive(uint8_t *buf, size_t max_len) {
+    int len = 0;
+    // Empty packets (failed CRC) are skipped rather than ending the reads
+    while (!len && lora_received()) {
+        len = lora_receive_packet(buf, max_len);
+        lora_receive();
+    }
+    return len;
+}
+
+static void sx127x_status(app_radio_status_t *status) {
+    status->rssi = lora_packet_rssi();
+    status->snr = lora_packet_snr();
+}
+
+/* The modem raises DIO0 on RxDone in receive mode */
+static esp_err_t sx127x_set_rx_done(app_radio_rx_done_t rx_done) {
+    return app_radio_gpio_rx_done(CONFIG_DIO0_GPIO, rx_done);
+}
+
+static bool cad_done() {
+    cad_flags = lora_read_reg(REG_IRQ_FLAGS);
+    return cad_flags & IRQ_CAD_DONE;
+}
+
+static esp_err_t sx127x_cad(bool *detected) {
+    bool done;
+
+    lora_idle();
+    lora_write_reg(REG_IRQ_FLAGS, IRQ_CAD_DONE | IRQ_CAD_DETECTED);
+    lora_write_reg(REG_DIO_MAPPING_1, DIO0_CAD_DONE);
+    lora_write_reg(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_CAD);
+    done = app_radio_wait_dio(cad_done, CAD_TIMEOUT_TICKS);
+    lora_write_reg(REG_IRQ_FLAGS, IRQ_CAD_DONE | IRQ_CAD_DETECTED);
+    lora_write_reg(REG_DIO_MAPPING_1, DIO0_RX_DONE);
+    *detected = cad_flags & IRQ_CAD_DETECTED;
+
+    if (receiving) {
+        lora_receive();
+    } else {
+        lora_idle();
+    }
+    if (!done) {
+        ESP_LOGW(TAG, "Channel activity detection timed out");
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+const app_radio_t app_radio_sx127x = {
+    .name = "SX127x",
+    .init = sx127x_init,
+    .configure = sx127x_configure,
+    .send = sx127x_send,
+    .start_rx = sx127x_start_rx,
+    .stop_rx = sx127x_stop_rx,
+    .receive = sx127x_receive,
+    .status = sx127x_status,
+    .set_rx_done = sx127x_set_rx_done,
+    .cad = sx127x_cad,
+};
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -10,6 +11,9 @@
 #include "cJSON.h"
 #include "app_lora.h"
 #include "app_mqtt.h"
+#ifdef CONFIG_RADIO_SIM
+#include "app_radio_sim.h"
+#endif
 #include "app_wifi.h"
 #include "app_web_ui.h"
 #include "smoke_x.h"
@@ -25,6 +29,9 @@ static const char *TAG = "app_web_ui";
     } while (0)
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
+#define QUERY_STR_MAX 64
+#define QUERY_VALUE_MAX 16
+#define ACCEPT_HDR_MAX 128
 #define SCRATCH_BUFSIZE (10240)
 
 typedef struct rest_server_context {
@@ -251,7 +258,10 @@ static esp_err_t rf_params_get_handler(httpd_req_t *req) {
 /* Handler for getting pairing status */
 static esp_err_t pairing_status_get_handler(httpd_req_t *req) {
     smoke_x_config_t smoke_x_config;
-    smoke_x_get_config(&smoke_x_config);
+    smoke_x_catch_stats_t catch_stats;
+    app_lora_retune_stats_t retune;
+    smoke_x_get_config(0, &smoke_x_config);
+    app_lora_get_retune_stats(&retune);
 
     httpd_resp_set_type(req, "application/json");
     cJSON *root = cJSON_CreateObject();
@@ -260,6 +270,39 @@ static esp_err_t pairing_status_get_handler(httpd_req_t *req) {
     cJSON_AddStringToObject(root, "deviceId", smoke_x_config.device_id);
     cJSON_AddStringToObject(root, "deviceModel",
                             smoke_x_config.num_probes == 2 ? "X2" : "X4");
+    cJSON_AddNumberToObject(root, "syncTime", smoke_x_get_sync_time());
+    if (retune.frequency.count) {
+        // Average microseconds to move the radio to another frequency
+        cJSON_AddNumberToObject(
+            root, "retuneTime",
+            retune.frequency.total_us / retune.frequency.count);
+    }
+    cJSON_AddBoolToObject(root, "isPairing", smoke_x_is_pairing());
+    cJSON_AddNumberToObject(root, "maxDevices", SMOKE_X_MAX_DEVICES);
+    cJSON *devices = cJSON_AddArrayToObject(root, "devices");
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        if (!smoke_x_is_paired(i)) {
+            continue;
+        }
+        smoke_x_get_config(i, &smoke_x_config);
+        smoke_x_get_catch_stats(i, &catch_stats);
+        cJSON *device = cJSON_CreateObject();
+        cJSON_AddNumberToObject(device, "device", i);
+        cJSON_AddStringToObject(device, "deviceId", smoke_x_config.device_id);
+        cJSON_AddStringToObject(device, "deviceModel",
+                                smoke_x_config.num_probes == 2 ? "X2" : "X4");
+        cJSON_AddNumberToObject(device, "frequency", smoke_x_config.frequency);
+        cJSON_AddNumberToObject(device, "interval", catch_stats.interval_ms);
+        cJSON_AddNumberToObject(device, "expected", catch_stats.expected);
+        cJSON_AddNumberToObject(device, "caught", catch_stats.caught);
+        if (catch_stats.expected) {
+            // Percent, to a tenth
+            cJSON_AddNumberToObject(
+                device, "catchRate",
+                catch_stats.caught * 1000 / catch_stats.expected / 10.0);
+        }
+        cJSON_AddItemToArray(devices, device);
+    }
     char *json_str = cJSON_Print(root);
     cJSON_Delete(root);
     if (json_str) {
@@ -270,17 +313,77 @@ static esp_err_t pairing_status_get_handler(httpd_req_t *req) {
     return ESP_FAIL;
 }
 
+/* Send a piece of the data/history document as an HTTP response chunk */
+static esp_err_t data_chunk_writer(void *ctx, const char *buf, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, buf, len);
+}
+
+/* Get an unsigned integer parameter from the request's query string */
+static bool query_get_uint(httpd_req_t *req, const char *key,
+                           unsigned long *out) {
+    char query[QUERY_STR_MAX];
+    char value[QUERY_VALUE_MAX];
+    char *end;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, key, value, sizeof(value)) == ESP_OK) {
+        *out = strtoul(value, &end, 10);
+        return end != value && *end == '\0';
+    }
+    return false;
+}
+
+/* Check whether the client listed a media type in its Accept header */
+static bool accepts_type(httpd_req_t *req, const char *type) {
+    char accept[ACCEPT_HDR_MAX];
+    return httpd_req_get_hdr_value_str(req, "Accept", accept,
+                                       sizeof(accept)) == ESP_OK &&
+           strstr(accept, type) != NULL;
+}
+
 /* Handler for getting data/history status */
 static esp_err_t data_get_handler(httpd_req_t *req) {
-    char *json_str = smoke_x_get_data_json();
-    if (json_str) {
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_sendstr(req, json_str);
-        return ESP_OK;
+    unsigned long value;
+    smoke_x_data_query_t query = {0};
+
+    // JSON unless the client asks for the more compact CBOR encoding
+    if (accepts_type(req, "application/cbor")) {
+        query.format = SMOKE_X_DATA_CBOR;
     }
-    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
-                        "Unable to generate history");
-    return ESP_FAIL;
+    // With ?since=<seq> only samples from that sequence number onward are sent
+    if (query_get_uint(req, "since", &value)) {
+        query.since = value;
+    }
+    // ?device=<n> selects one of the paired devices, the first by default
+    if (query_get_uint(req, "device", &value)) {
+        query.device = value;
+    }
+    // ?resolution=<seconds> and ?max_points=<n> select a downsampled series
+    if (query_get_uint(req, "resolution", &value)) {
+        query.resolution = value;
+    }
+    if (query_get_uint(req, "max_points", &value)) {
+        query.max_points = value;
+    }
+    if (query.device >= SMOKE_X_MAX_DEVICES) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No such device");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, query.format == SMOKE_X_DATA_CBOR
+                                 ? "application/cbor"
+                                 : "application/json");
+    if (smoke_x_write_data(&query, data_chunk_writer, req) != ESP_OK) {
+        ESP_LOGE(TAG, "History sending failed!");
+        /* Abort sending history */
+        httpd_resp_sendstr_chunk(req, NULL);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                            "Unable to generate history");
+        return ESP_FAIL;
+    }
+    /* Respond with an empty chunk to signal HTTP response completion */
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
 }
 
 /* Handler for getting wifi config */
@@ -393,6 +496,13 @@ static esp_err_t mqtt_config_get_handler(httpd_req_t *req) {
     cJSON_AddStringToObject(
         root, APP_MQTT_STATE_TOPIC,
         app_mqtt_params.state_topic ? app_mqtt_params.state_topic : "");
+    cJSON_AddNumberToObject(root, APP_MQTT_DEADBAND, app_mqtt_params.deadband);
+    cJSON_AddNumberToObject(root, APP_MQTT_MIN_INTERVAL,
+                            app_mqtt_params.min_interval);
+    cJSON_AddNumberToObject(root, APP_MQTT_MAX_INTERVAL,
+                            app_mqtt_params.max_interval);
+    cJSON_AddBoolToObject(root, APP_MQTT_SENSOR_TOPICS,
+                          app_mqtt_params.sensor_topics);
     char *json_str = cJSON_Print(root);
     cJSON_Delete(root);
     if (json_str) {
@@ -433,6 +543,7 @@ static esp_err_t mqtt_config_set_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Setting mqtt params: \n%s", param_str);
 
     app_mqtt_params_t app_mqtt_params = {0};
+    app_mqtt_params_t current_params;
 
     json_check_strncpy(root, &app_mqtt_params.uri, APP_MQTT_URI,
                        APP_MQTT_MAX_URI_LEN);
@@ -456,6 +567,28 @@ static esp_err_t mqtt_config_set_handler(httpd_req_t *req) {
                        APP_MQTT_HA_BIRTH_PAYLOAD, APP_MQTT_MAX_TOPIC_LEN);
     json_check_strncpy(root, &app_mqtt_params.state_topic, APP_MQTT_STATE_TOPIC,
                        APP_MQTT_MAX_TOPIC_LEN);
+    // The publish policy and mode are left as they were if not posted
+    app_mqtt_get_params(&current_params);
+    app_mqtt_params.deadband = current_params.deadband;
+    app_mqtt_params.min_interval = current_params.min_interval;
+    app_mqtt_params.max_interval = current_params.max_interval;
+    app_mqtt_params.sensor_topics = current_params.sensor_topics;
+    if (cJSON_HasObjectItem(root, APP_MQTT_DEADBAND)) {
+        app_mqtt_params.deadband =
+            cJSON_GetObjectItem(root, APP_MQTT_DEADBAND)->valuedouble;
+    }
+    if (cJSON_HasObjectItem(root, APP_MQTT_MIN_INTERVAL)) {
+        app_mqtt_params.min_interval =
+            cJSON_GetObjectItem(root, APP_MQTT_MIN_INTERVAL)->valueint;
+    }
+    if (cJSON_HasObjectItem(root, APP_MQTT_MAX_INTERVAL)) {
+        app_mqtt_params.max_interval =
+            cJSON_GetObjectItem(root, APP_MQTT_MAX_INTERVAL)->valueint;
+    }
+    if (cJSON_HasObjectItem(root, APP_MQTT_SENSOR_TOPICS)) {
+        app_mqtt_params.sensor_topics =
+            cJSON_GetObjectItem(root, APP_MQTT_SENSOR_TOPICS)->valueint;
+    }
 
     cJSON_Delete(root);
     free(param_str);
@@ -517,8 +650,61 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
             app_lora_start_rx(NULL);
         } else if (strcmp(cmd, "stopRx") == 0) {
             app_lora_stop_rx(NULL);
+        } else if (strcmp(cmd, "pair") == 0) {
+            smoke_x_pair();
         } else if (strcmp(cmd, "unpair") == 0) {
-            smoke_x_sync();
+            // Without a device, start over with a single one
+            if (cJSON_HasObjectItem(root, "device")) {
+                smoke_x_unpair(cJSON_GetObjectItem(root, "device")->valueint);
+            } else {
+                smoke_x_sync();
+            }
+        } else if (strcmp(cmd, "newCook") == 0) {
+            if (cJSON_HasObjectItem(root, "device")) {
+                smoke_x_new_cook(cJSON_GetObjectItem(root, "device")->valueint);
+            } else {
+                for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+                    smoke_x_new_cook(i);
+                }
+            }
+#ifdef CONFIG_RADIO_SIM
+        } else if (strcmp(cmd, "simulate") == 0) {
+            app_radio_sim_channel_t channel = {0};
+            int16_t rssi = -80;
+            float snr = 8;
+            cJSON *item;
+            if (cJSON_HasObjectItem(root, "loss")) {
+                channel.loss_pct = cJSON_GetObjectItem(root, "loss")->valueint;
+            }
+            if (cJSON_HasObjectItem(root, "duplicates")) {
+                channel.duplicate_pct =
+                    cJSON_GetObjectItem(root, "duplicates")->valueint;
+            }
+            if (cJSON_HasObjectItem(root, "rssiJitter")) {
+                channel.rssi_jitter =
+                    cJSON_GetObjectItem(root, "rssiJitter")->valueint;
+            }
+            if (cJSON_HasObjectItem(root, "seed")) {
+                channel.seed = cJSON_GetObjectItem(root, "seed")->valueint;
+            }
+            if (cJSON_HasObjectItem(root, "rssi")) {
+                rssi = cJSON_GetObjectItem(root, "rssi")->valueint;
+            }
+            if (cJSON_HasObjectItem(root, "snr")) {
+                snr = cJSON_GetObjectItem(root, "snr")->valuedouble;
+            }
+            app_radio_sim_set_channel(&channel);
+            if (cJSON_HasObjectItem(root, "frequency")) {
+                app_radio_sim_set_activity(
+                    cJSON_GetObjectItem(root, "frequency")->valuedouble);
+            }
+            cJSON_ArrayForEach(item, cJSON_GetObjectItem(root, "messages")) {
+                if (cJSON_IsString(item)) {
+                    app_radio_sim_inject((uint8_t *)item->valuestring,
+                                         strlen(item->valuestring), rssi, snr);
+                }
+            }
+#endif
         } else {
             httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
                                 "Unknown command received");
@@ -2,6 +2,7 @@
 #include <freertos/task.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_sntp.h>
 #include <nvs_flash.h>
 #include "app_mqtt.h"
 #include "app_web_ui.h"
@@ -32,8 +33,9 @@ void smoke_x_event_handler(void* handler_arg, esp_event_base_t base,
             // Do something with the web UI?
             break;
         case SMOKE_X_EVENT_STATE_MSG_RECEIVED:
-            if (app_mqtt_is_connected()) {
-                app_mqtt_publish_state();
+            // Published, or kept until the broker can be reached
+            if (app_mqtt_is_enabled()) {
+                app_mqtt_publish_state(*(int*)event_data);
             }
             break;
         case SMOKE_X_EVENT_DISCOVERY_REQUIRED:
@@ -54,9 +56,19 @@ void run_when_disconnected(void* handler_arg, esp_event_base_t base, int32_t id,
     }
 }
 
+void start_sntp() {
+    if (!sntp_enabled()) {
+        ESP_LOGI(TAG, "Starting SNTP with %s", CONFIG_SNTP_SERVER);
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, CONFIG_SNTP_SERVER);
+        sntp_init();
+    }
+}
+
 void run_when_ip_addr_obtained(void* handler_arg, esp_event_base_t base,
                                int32_t id, void* event_data) {
     ESP_LOGI(TAG, "IP address obtained");
+    start_sntp();
     app_mqtt_start();
     esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED,
                                &run_when_disconnected, NULL);
@@ -79,6 +91,8 @@ void app_main() {
     esp_event_handler_register(SMOKE_X_EVENT, ESP_EVENT_ANY_ID,
                                &smoke_x_event_handler, NULL);
 
+    // States are kept for the broker from the first one received
+    app_mqtt_init();
     smoke_x_init();
     smoke_x_start();
     app_wifi_init();
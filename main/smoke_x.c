@@ -1,13 +1,24 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <nvs.h>
-#include "cJSON.h"
 #include "app_lora.h"
 #include "smoke_x.h"
+#include "smoke_x_history.h"
+#include "smoke_x_link.h"
+#include "smoke_x_log.h"
+#include "smoke_x_msg.h"
+#include "smoke_x_scan.h"
+#include "smoke_x_sched.h"
 
 #define SMOKE_X2_SYNC_FREQ 920000000
 #define SMOKE_X4_SYNC_FREQ 915000000
@@ -15,151 +26,170 @@
 #define SMOKE_X_RF_MAX 928000000
 #define SMOKE_X_NVS_NAMESPACE "smoke_x"
 #define SMOKE_X_NVS_CONFIG "config"
-#define NUM_COMMAS_SYNC_MSG 6
-#define NUM_COMMAS_SUCCESS_MSG 2
-#define NUM_COMMAS_X2_STATE_MSG 16
-#define NUM_COMMAS_X4_STATE_MSG 26
-#define MIN_FREE_HEAP_SIZE 32768
-#define MAX_RECORDS 1200
-#define JSON_STR_LEN 16000
+#define DATA_CHUNK_LEN 256
+#define HISTORY_READ_LEN 32
+#define LINK_READ_LEN 8
+// Any earlier wall clock time means SNTP hasn't set the clock yet
+#define MIN_VALID_EPOCH 1672531200
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_SIMPLE 7
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+// Starts an indefinite length item, or with CBOR_SIMPLE ends one
+#define CBOR_INDEFINITE 31
 
 static const char *TAG = "smoke_x";
-static TaskHandle_t xSyncTask = NULL;
-static smoke_x_config_t config;
-static smoke_x_state_t state;
-static bool configured = false;
+static TaskHandle_t xTuneTask = NULL;
+static SemaphoreHandle_t xSchedMutex = NULL;
+static smoke_x_config_t configs[SMOKE_X_MAX_DEVICES];
+static smoke_x_state_t states[SMOKE_X_MAX_DEVICES];
+// Shared by the decode, tune and web server tasks, under xSchedMutex
+static bool configured[SMOKE_X_MAX_DEVICES];
+static int pair_slot = -1;  // device being paired, -1 when not pairing
 static bool sync_received = false;
-static cJSON *root;
-static cJSON *probes[4];
-static cJSON *probes_history[4];
-static char json_str[JSON_STR_LEN];
-static char *probe_names[4] = {SMOKE_X_PROBE_1, SMOKE_X_PROBE_2,
-                               SMOKE_X_PROBE_3, SMOKE_X_PROBE_4};
+static smoke_x_scan_t scan;
+static smoke_x_sched_t sched;
+static int64_t scan_start = 0;
+static uint32_t sync_time_ms = 0;
+static char *probe_names[SMOKE_X_MAX_PROBES] = {
+    SMOKE_X_PROBE_1, SMOKE_X_PROBE_2, SMOKE_X_PROBE_3, SMOKE_X_PROBE_4};
 
 ESP_EVENT_DEFINE_BASE(SMOKE_X_EVENT);
 
-static void init_history_json() {
-    root = cJSON_CreateObject();
-    for (unsigned int i = 0; i < config.num_probes; i++) {
-        probes[i] = cJSON_AddObjectToObject(root, probe_names[i]);
-        cJSON_AddNumberToObject(probes[i], SMOKE_X_CURRENT_TEMP, 0);
-        cJSON_AddNumberToObject(probes[i], SMOKE_X_ALARM_MAX, 0);
-        cJSON_AddNumberToObject(probes[i], SMOKE_X_ALARM_MIN, 0);
-        probes_history[i] = cJSON_CreateArray();
-        cJSON_AddItemToObject(probes[i], SMOKE_X_HISTORY, probes_history[i]);
-    }
-    cJSON_AddBoolToObject(root, SMOKE_X_BILLOWS, state.billows_attached);
+static bool valid_frequency(uint32_t freq) {
+    return freq >= SMOKE_X_RF_MIN && freq <= SMOKE_X_RF_MAX;
 }
 
-static esp_err_t set_frequency(unsigned int freq) {
+/* Move the radio to freq, unless it is already there */
+static void tune(uint32_t freq) {
     app_lora_params_t rf_params;
     app_lora_get_params(&rf_params);
-
-    if (freq >= SMOKE_X_RF_MIN && freq <= SMOKE_X_RF_MAX) {
-        config.frequency = freq;
-        ESP_LOGI(TAG, "Frequency set to: %d MHz", config.frequency);
-
-        rf_params.frequency = config.frequency;
-        app_lora_set_params(&rf_params, xTaskGetCurrentTaskHandle());
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Frequency out of range (%d-%d): %d MHz", SMOKE_X_RF_MIN,
-                 SMOKE_X_RF_MAX, freq);
-        return ESP_FAIL;
+    if (rf_params.frequency != freq) {
+        ESP_LOGD(TAG, "Tuning to %d Hz", freq);
+        rf_params.frequency = freq;
+        app_lora_set_params(&rf_params, NULL);
     }
 }
 
-static unsigned int count_commas(const char *msg, const int len) {
-    unsigned int result = 0;
-    for (int i = 0; i < len; i++) {
-        if (msg[i] == ',') result++;
-    }
-    return result;
-}
-
-static void handle_sync_msg(const char *msg, const int len) {
-    unsigned char freq_array[4];
-    // Example sync message "020001,|dhHWl,160,32,69,54,"
-    sync_received = true;
-    ESP_LOGI(TAG, "Received sync message: %s", msg);
-    char *tmp = strdup(msg);
-    strtok(tmp, ",");
-    strncpy(config.device_id, strtok(NULL, ","), SMOKE_X_DEVICE_ID_LEN);
-    ESP_LOGI(TAG, "DeviceID set to: %s", config.device_id);
-    for (int i = 0; i < 4; i++) {
-        freq_array[i] = (char)atoi(strtok(NULL, ","));
-    }
-    free(tmp);
-
-    config.frequency = *(unsigned int *)freq_array;
-    if (config.frequency >= SMOKE_X_RF_MIN &&
-        config.frequency <= SMOKE_X_RF_MAX) {
-        char response[32];
-        snprintf(response, sizeof(response), "%s,SUCCESS,", config.device_id);
-        app_lora_tx_msg_t tx_msg = {
-            .msg = response,
-            .repeat_interval_ms = 0,
-            .sending_task = xTaskGetCurrentTaskHandle(),
-        };
-        set_frequency(config.frequency);
-        ESP_LOGI(TAG, "Sending sync acknowledgement to transmitter: %s",
-                 tx_msg.msg);
-        app_lora_start_tx(&tx_msg);
-    } else {
-        ESP_LOGE(TAG, "Frequency out of range %d", config.frequency);
-        config.frequency = 0;
-        sync_received = false;
+static void notify_tune_task() {
+    if (xTuneTask) {
+        xTaskNotifyGive(xTuneTask);
     }
 }
 
-static void update_history() {
-    if (!root) {
-        init_history_json();
+/* Pair device to the sender of msg, once sync_received has been set */
+static void handle_sync_msg(unsigned int device, const smoke_x_msg_t *msg) {
+    smoke_x_config_t *config = &configs[device];
+    app_lora_retune_stats_t retune;
+    sync_time_ms = (esp_timer_get_time() - scan_start) / 1000;
+    ESP_LOGI(TAG, "Sync received %u ms after scanning started (%u checks)",
+             sync_time_ms, scan.checks);
+    app_lora_get_retune_stats(&retune);
+    if (retune.frequency.count) {
+        ESP_LOGI(TAG, "Retuning took %u us on average, %u us at most",
+                 (uint32_t)(retune.frequency.total_us / retune.frequency.count),
+                 retune.frequency.max_us);
+    }
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        strncpy(config->device_id, msg->device_id, SMOKE_X_DEVICE_ID_LEN);
+        config->frequency = msg->frequency;
+        smoke_x_sched_set_device(&sched, device, config->frequency);
+        xSemaphoreGive(xSchedMutex);
     }
+    ESP_LOGI(TAG, "Device %d is %s at %d Hz", device + 1, msg->device_id,
+             msg->frequency);
+
+    char response[32];
+    snprintf(response, sizeof(response), "%s,SUCCESS,", msg->device_id);
+    app_lora_tx_msg_t tx_msg = {
+        .msg = response,
+        .repeat_interval_ms = 0,
+        .sending_task = xTaskGetCurrentTaskHandle(),
+    };
+    tune(msg->frequency);
+    ESP_LOGI(TAG, "Sending sync acknowledgement to transmitter: %s",
+             tx_msg.msg);
+    app_lora_start_tx(&tx_msg);
+}
 
-    for (unsigned int i = 0; i < config.num_probes; i++) {
-        if ((cJSON_GetArraySize(probes_history[0]) >= MAX_RECORDS) ||
-            (xPortGetFreeHeapSize() < MIN_FREE_HEAP_SIZE)) {
-            cJSON_DeleteItemFromArray(probes_history[i], 0);
+/*
+ * Moves the history over to the wall clock once SNTP has set it. This runs on
+ * the receive task right before a sample is appended, so no sample can be
+ * logged between the history being rebased and the rebase being logged.
+ */
+static void sync_history_clock() {
+    time_t now = time(NULL);
+    int32_t shift;
+    uint32_t oldest, next_seq;
+    unsigned int rebased;
+    if (now >= MIN_VALID_EPOCH &&
+        (rebased = smoke_x_history_sync_clock((uint32_t)now, &shift))) {
+        for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+            if (rebased & 1 << i) {
+                smoke_x_history_tier_range(i, 0, &oldest, &next_seq);
+                smoke_x_log_clock(i, next_seq, shift);
+            }
         }
-        cJSON_AddItemToArray(probes_history[i],
-                             cJSON_CreateNumber(state.probes[i].temp));
+        smoke_x_link_rebase(shift);
+        ESP_LOGI(TAG, "History moved to wall clock (%+d s)", (int)shift);
     }
 }
 
-static void parse_state_msg(const char *msg, smoke_x_state_t *state) {
+static void parse_state_msg(unsigned int device, const smoke_x_msg_t *msg,
+                            smoke_x_state_t *state) {
     char *last_units = state->units;
-    char *tmp = strdup(msg);
-    state->num_probes = config.num_probes;
-    strtok(tmp, ",");   // Not using device ID
-    strtok(NULL, ",");  // Not using unknown field
-    state->units = atoi(strtok(NULL, ",")) == 1 ? "°F" : "°C";
-    state->new_alarm = atoi(strtok(NULL, ","));
-    for (unsigned int i = 0; i < config.num_probes; i++) {
-        state->probes[i].attached = atoi(strtok(NULL, ",")) == 3 ? false : true;
-        state->probes[i].temp = atof(strtok(NULL, ",")) / 10.0;
-        state->probes[i].alarm = atoi(strtok(NULL, ","));
-        state->probes[i].max_temp = atoi(strtok(NULL, ","));
-        state->probes[i].min_temp = atoi(strtok(NULL, ","));
-    }
-    state->billows_attached = atoi(strtok(NULL, ","));
-    strtok(NULL, ",");  // Not using unknown field
-    free(tmp);
-    update_history();
+    smoke_x_sample_t sample;
+    state->num_probes = msg->num_probes;
+    state->units = msg->fahrenheit ? "°F" : "°C";
+    state->new_alarm = msg->new_alarm;
+    for (unsigned int i = 0; i < msg->num_probes; i++) {
+        state->probes[i].attached = msg->probes[i].attached;
+        state->probes[i].temp = msg->probes[i].temp / 10.0;
+        state->probes[i].alarm = msg->probes[i].alarm;
+        state->probes[i].max_temp = msg->probes[i].max_temp;
+        state->probes[i].min_temp = msg->probes[i].min_temp;
+    }
+    state->billows_attached = msg->billows_attached;
+    if (!smoke_x_history_clock_synced()) {
+        sync_history_clock();
+    }
+    smoke_x_history_append(device, state, &sample);
+    smoke_x_log_append(device, &sample);
+    state->time = sample.time;
+    state->time_is_epoch = smoke_x_history_clock_synced();
     if (last_units != state->units) {
         esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_DISCOVERY_REQUIRED, NULL, 0,
                        1000);
     }
 }
 
-static esp_err_t save_config_to_nvram() {
+/* The first device keeps the key it had before there could be several */
+static void config_key(unsigned int device, char *key, size_t len) {
+    if (device == 0) {
+        snprintf(key, len, "%s", SMOKE_X_NVS_CONFIG);
+    } else {
+        snprintf(key, len, "%s%d", SMOKE_X_NVS_CONFIG, device + 1);
+    }
+}
+
+static esp_err_t save_config_to_nvram(unsigned int device) {
     esp_err_t err;
     nvs_handle_t h_nvs;
+    smoke_x_config_t config;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        memcpy(&config, &configs[device], sizeof(smoke_x_config_t));
+        xSemaphoreGive(xSchedMutex);
+    }
+    config_key(device, key, sizeof(key));
     err = nvs_open(SMOKE_X_NVS_NAMESPACE, NVS_READWRITE, &h_nvs);
     if (!err) {
-        err = nvs_set_blob(h_nvs, SMOKE_X_NVS_CONFIG, &config,
-                           sizeof(smoke_x_config_t));
+        err = nvs_set_blob(h_nvs, key, &config, sizeof(smoke_x_config_t));
         nvs_close(h_nvs);
     }
     return err;
@@ -168,190 +198,781 @@ static esp_err_t save_config_to_nvram() {
 static esp_err_t read_config_from_nvram() {
     esp_err_t err;
     nvs_handle_t h_nvs;
-    size_t len = 0;
+    size_t len;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    bool any = false;
 
     err = nvs_open(SMOKE_X_NVS_NAMESPACE, NVS_READWRITE, &h_nvs);
-    if (!err) {
-        err = nvs_get_blob(h_nvs, SMOKE_X_NVS_CONFIG, NULL, &len);
-        err = nvs_get_blob(h_nvs, SMOKE_X_NVS_CONFIG, &config, &len);
-        ESP_LOGD(TAG, "nvs_get_blob err: %d", err);
-        nvs_close(h_nvs);
-        if (ESP_OK == err) {
-            if ((config.frequency >= SMOKE_X_RF_MIN &&
-                 config.frequency <= SMOKE_X_RF_MAX) &&
-                strlen(config.device_id) > 0) {
-                ESP_LOGI(TAG, "Device is paired to %s at %d MHz",
-                         config.device_id, config.frequency);
-                configured = true;
-                sync_received = true;
-                return ESP_OK;
-            }
+    if (err) {
+        return ESP_FAIL;
+    }
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        smoke_x_config_t *config = &configs[i];
+        config_key(i, key, sizeof(key));
+        len = sizeof(smoke_x_config_t);
+        err = nvs_get_blob(h_nvs, key, config, &len);
+        ESP_LOGD(TAG, "nvs_get_blob %s err: %d", key, err);
+        if (ESP_OK == err && valid_frequency(config->frequency) &&
+            strlen(config->device_id) > 0) {
+            ESP_LOGI(TAG, "Device %d is paired to %s at %d MHz", i + 1,
+                     config->device_id, config->frequency);
+            configured[i] = true;
+            smoke_x_sched_set_device(&sched, i, config->frequency);
+            any = true;
+        } else {
+            memset(config, 0, sizeof(smoke_x_config_t));
+            configured[i] = false;
         }
+    }
+    nvs_close(h_nvs);
+    if (!any) {
+        ESP_LOGI(TAG, "Device is not paired, waiting for sync");
+        pair_slot = 0;
+    }
+    return ESP_OK;
+}
 
-        ESP_LOGI(TAG, "Device is not paired, waiting for sync on %d",
-                 config.frequency);
-        configured = false;
-        sync_received = false;
-        return ESP_OK;
+/*
+ * Paired device, or the one being paired, with the given ID. Call it with
+ * xSchedMutex held.
+ */
+static int find_device(const char *device_id) {
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        if ((configured[i] || (int)i == pair_slot) && configs[i].device_id[0] &&
+            !strncmp(configs[i].device_id, device_id, SMOKE_X_DEVICE_ID_LEN)) {
+            return i;
+        }
     }
-    return ESP_FAIL;
+    return -1;
 }
 
-static void handle_rx(const char *msg, const int len) {
-    switch (count_commas(msg, len)) {
-        case NUM_COMMAS_SYNC_MSG:
-            if (!configured && !sync_received) {
-                handle_sync_msg(msg, len);
-                esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_SYNC, NULL, 0,
-                               1000);
+static void handle_rx(const app_lora_frame_t *frame) {
+    const char *buf = frame->payload;
+    const int len = frame->len;
+    uint32_t tx_interval_ms = 0;
+    smoke_x_msg_t msg;
+    int device = -1, slot = -1;
+    bool paired = false, mismatch = false;
+    if (smoke_x_msg_parse(buf, len, &msg) != ESP_OK) {
+        ESP_LOGE(TAG, "Received unrecognized message: %.*s", len, buf);
+        return;
+    }
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        device = find_device(msg.device_id);
+        if (msg.type == SMOKE_X_MSG_SYNC && pair_slot >= 0 &&
+            !sync_received && device < 0 && valid_frequency(msg.frequency)) {
+            // Claimed here, so a second sync can't pair the slot again
+            slot = pair_slot;
+            sync_received = true;
+        } else if (msg.type == SMOKE_X_MSG_STATE && device >= 0) {
+            if (!configured[device]) {
+                configs[device].num_probes = msg.num_probes;
+                configured[device] = true;
+                pair_slot = -1;
+                sync_received = false;
+                paired = true;
+            } else if (msg.num_probes != configs[device].num_probes) {
+                mismatch = true;
+            }
+            if (!mismatch) {
+                // As learned up to the packet before this one
+                tx_interval_ms = sched.devices[device].interval;
+                smoke_x_sched_received(&sched, device,
+                                       frame->timestamp / 1000);
+            }
+        }
+        xSemaphoreGive(xSchedMutex);
+    }
+    switch (msg.type) {
+        case SMOKE_X_MSG_SYNC:
+            if (slot >= 0) {
+                ESP_LOGI(TAG, "Received sync message: %.*s", len, buf);
+                handle_sync_msg(slot, &msg);
+                esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_SYNC, &slot,
+                               sizeof(slot), 1000);
+                notify_tune_task();
+            } else if (!valid_frequency(msg.frequency)) {
+                ESP_LOGE(TAG, "Frequency out of range %d", msg.frequency);
             } else {
                 ESP_LOGI(
                     TAG,
-                    "Received unexpected sync message that will be ignored: %s",
-                    msg);
+                    "Received unexpected sync message that will be ignored: "
+                    "%.*s",
+                    len, buf);
             }
             break;
-        case NUM_COMMAS_X2_STATE_MSG:
-            if (sync_received) {
-                if (!configured) {
-                    config.num_probes = 2;
-                    configured = true;
-                    save_config_to_nvram();
-                    esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_SYNC_SUCCESS,
-                                   NULL, 0, 1000);
-                    ESP_LOGI(
-                        TAG,
-                        "Received data transmission from %s, saving config",
-                        config.device_id);
-                }
-                parse_state_msg(msg, &state);
-                ESP_LOGI(TAG, "X2 DATA: %s", msg);
-                esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_STATE_MSG_RECEIVED,
-                               NULL, 0, 1000);
+        case SMOKE_X_MSG_STATE:
+            if (device < 0) {
+                ESP_LOGD(TAG, "Ignoring data from unpaired %s", msg.device_id);
+                break;
             }
-            break;
-        case NUM_COMMAS_X4_STATE_MSG:
-            if (sync_received) {
-                if (!configured) {
-                    config.num_probes = 4;
-                    configured = true;
-                    save_config_to_nvram();
-                    esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_SYNC_SUCCESS,
-                                   NULL, 0, 1000);
-                    ESP_LOGI(
-                        TAG,
-                        "Received data transmission from %s, saving config",
-                        config.device_id);
-                }
-                parse_state_msg(msg, &state);
-                ESP_LOGI(TAG, "X4 DATA: %s", msg);
-                esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_STATE_MSG_RECEIVED,
-                               NULL, 0, 1000);
+            if (paired) {
+                save_config_to_nvram(device);
+                esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_SYNC_SUCCESS,
+                               &device, sizeof(device), 1000);
+                ESP_LOGI(TAG,
+                         "Received data transmission from %s, saving config",
+                         msg.device_id);
+            } else if (mismatch) {
+                ESP_LOGW(TAG, "Ignoring X%d data, paired to an X%d: %.*s",
+                         msg.num_probes, configs[device].num_probes, len, buf);
+                break;
             }
+            parse_state_msg(device, &msg, &states[device]);
+            smoke_x_link_update(device, frame->rssi, frame->snr,
+                                frame->timestamp, states[device].time,
+                                tx_interval_ms, &states[device].link);
+            // The window is over, the radio may be needed elsewhere
+            notify_tune_task();
+            ESP_LOGI(TAG, "X%d DATA: %.*s", msg.num_probes, len, buf);
+            esp_event_post(SMOKE_X_EVENT, SMOKE_X_EVENT_STATE_MSG_RECEIVED,
+                           &device, sizeof(device), 1000);
             break;
-        default:
-            ESP_LOGE(TAG, "Received unrecognized message type: %s", msg);
+        case SMOKE_X_MSG_SUCCESS:
+            ESP_LOGD(TAG, "Ignoring sync acknowledgement: %.*s", len, buf);
             break;
     }
 }
 
-static void sync_task(void *pvParameter) {
-    ESP_LOGI(TAG, "Starting Smoke X Sync");
-    int target_freq = SMOKE_X2_SYNC_FREQ;
+/* One step of the pairing scan, returns the ms to dwell on *freq */
+static uint32_t scan_step(uint32_t *freq) {
+    bool detected = false;
+    *freq = smoke_x_scan_frequency(&scan);
+    if (!scan.cad) {
+        tune(*freq);
+    } else if (app_lora_cad(*freq, &detected) != ESP_OK) {
+        ESP_LOGW(TAG, "Channel activity detection failed, scanning "
+                      "without it");
+        scan.cad = false;
+        tune(*freq);
+    }
+    return smoke_x_scan_update(&scan, detected);
+}
+
+/*
+ * Decides where the radio listens: on the frequency of a paired device while
+ * one of its packets is due, and otherwise scanning for the sync message of
+ * the device being paired, or hunting for a device that isn't on schedule.
+ * Received packets wake it up early, since they close their window.
+ */
+static void tune_task(void *pvParameter) {
+    static const uint32_t sync_freqs[] = {SMOKE_X2_SYNC_FREQ,
+                                          SMOKE_X4_SYNC_FREQ};
+    bool scanning = false;
+    bool hunting = false;
+    bool pairing = false, synced = false;
+    int device = -1;
+    uint32_t freq = 0, wait_ms = 0;
+    uint32_t dwell_freq = 0;
+    int64_t dwell_until = 0;
+    int64_t now;
+    TickType_t ticks;
+    ESP_LOGI(TAG, "Starting Smoke X tuning");
     while (1) {
-        if (!configured && !sync_received) {
-            target_freq = SMOKE_X2_SYNC_FREQ == target_freq
-                              ? SMOKE_X4_SYNC_FREQ
-                              : SMOKE_X2_SYNC_FREQ;
-            set_frequency(target_freq);
+        now = esp_timer_get_time() / 1000;
+        if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+            device = smoke_x_sched_next(&sched, now, &wait_ms);
+            if (device >= 0) {
+                freq = sched.devices[device].frequency;
+                hunting = !sched.devices[device].next_expected;
+            }
+            pairing = pair_slot >= 0;
+            synced = sync_received;
+            xSemaphoreGive(xSchedMutex);
+        }
+        if (pairing && !synced && (device < 0 || hunting)) {
+            // Pairing goes before devices that aren't on schedule
+            if (!scanning) {
+                smoke_x_scan_init(&scan, sync_freqs,
+                                  sizeof(sync_freqs) / sizeof(sync_freqs[0]),
+                                  app_lora_has_cad());
+                scan_start = esp_timer_get_time();
+                scanning = true;
+                dwell_until = 0;
+            }
+            if (now >= dwell_until) {
+                dwell_until = now + scan_step(&dwell_freq);
+            } else {
+                tune(dwell_freq);
+            }
+            if (dwell_until - now < wait_ms) {
+                wait_ms = dwell_until - now;
+            }
+        } else {
+            if (!pairing) {
+                scanning = false;
+            }
+            if (device >= 0) {
+                tune(freq);
+            }
         }
-        vTaskDelay(pdMS_TO_TICKS(3300));
+        // A scan hop is shorter than a tick at 100 Hz, sleep until the next
+        ticks = pdMS_TO_TICKS(wait_ms);
+        ulTaskNotifyTake(pdTRUE, wait_ms && !ticks ? 1 : ticks);
     }
 }
 
-esp_err_t start_sync() {
-    if (!xSyncTask) {
-        xTaskCreate(&sync_task, "smoke_x_sync_task", 3072, NULL, 5, &xSyncTask);
+static esp_err_t start_tune_task() {
+    if (!xTuneTask) {
+        xTaskCreate(&tune_task, "smoke_x_tune_task", 3072, NULL, 5,
+                    &xTuneTask);
         return ESP_OK;
     }
-    ESP_LOGI(TAG, "smoke_x_sync_task already started");
+    ESP_LOGI(TAG, "smoke_x_tune_task already started");
     return ESP_FAIL;
 }
 
-esp_err_t stop_sync() {
-    if (xSyncTask) {
-        ESP_LOGI(TAG, "Stopping smoke_x_sync_task");
-        vTaskDelete(xSyncTask);
-        xSyncTask = NULL;
-    }
-    return ESP_OK;
-}
-
 esp_err_t smoke_x_init() {
 #if APP_DEBUG > 0
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
 #endif
 
-    esp_err_t err = read_config_from_nvram();
+    smoke_x_sched_init(&sched);
+    xSchedMutex = xSemaphoreCreateMutex();
+    if (!xSchedMutex) {
+        ESP_LOGE(TAG, "Unable to create schedule mutex");
+        return ESP_FAIL;
+    }
+    esp_err_t err = smoke_x_history_init();
+    if (!err) {
+        err = smoke_x_link_init();
+    }
+    if (!err && smoke_x_log_init() == ESP_OK) {
+        smoke_x_log_restore_history();
+    }
+    if (!err) {
+        err = read_config_from_nvram();
+    }
     if (!err) {
         err = app_lora_init();
-        if (!err && configured) {
-            err = set_frequency(config.frequency);
-        } else if (!err) {
-            start_sync();
+    }
+    if (!err) {
+        for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+            if (configured[i]) {
+                tune(configs[i].frequency);
+                break;
+            }
         }
+        err = start_tune_task();
     }
     return err;
 }
 
-bool smoke_x_is_configured() { return configured; }
+/* Whether any device is paired */
+bool smoke_x_is_configured() {
+    bool any = false;
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+            any = any || configured[i];
+        }
+        xSemaphoreGive(xSchedMutex);
+    }
+    return any;
+}
+
+bool smoke_x_is_paired(unsigned int device) {
+    bool paired = false;
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        paired = configured[device];
+        xSemaphoreGive(xSchedMutex);
+    }
+    return paired;
+}
+
+bool smoke_x_is_pairing() {
+    bool pairing = false;
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        pairing = pair_slot >= 0;
+        xSemaphoreGive(xSchedMutex);
+    }
+    return pairing;
+}
+
+static void clear_device(unsigned int device) {
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        configured[device] = false;
+        memset(&configs[device], 0, sizeof(smoke_x_config_t));
+        smoke_x_sched_set_device(&sched, device, 0);
+        xSemaphoreGive(xSchedMutex);
+    }
+    save_config_to_nvram(device);
+}
 
+/* Unpair every device and wait for the sync of a single one */
 esp_err_t smoke_x_sync() {
-    strncpy(config.device_id, "", SMOKE_X_DEVICE_ID_LEN);
-    config.frequency = 0;
-    save_config_to_nvram();
-    configured = false;
-    sync_received = false;
-    esp_err_t err = start_sync();
-    return err;
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        clear_device(i);
+    }
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        sync_received = false;
+        pair_slot = 0;
+        xSemaphoreGive(xSchedMutex);
+    }
+    notify_tune_task();
+    return ESP_OK;
 }
 
-esp_err_t smoke_x_get_config(smoke_x_config_t *p_config) {
-    memcpy(p_config, &config, sizeof(smoke_x_config_t));
+/* Wait for the sync of another device, keeping the ones already paired */
+esp_err_t smoke_x_pair() {
+    int slot = -1;
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES && slot < 0; i++) {
+            if (!configured[i]) {
+                memset(&configs[i], 0, sizeof(smoke_x_config_t));
+                sync_received = false;
+                pair_slot = slot = i;
+            }
+        }
+        xSemaphoreGive(xSchedMutex);
+    }
+    if (slot < 0) {
+        ESP_LOGW(TAG, "Already paired to %d devices", SMOKE_X_MAX_DEVICES);
+        return ESP_ERR_NO_MEM;
+    }
+    notify_tune_task();
     return ESP_OK;
 }
 
-esp_err_t smoke_x_get_state(smoke_x_state_t *p_state) {
-    memcpy(p_state, &state, sizeof(smoke_x_state_t));
+esp_err_t smoke_x_unpair(unsigned int device) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGI(TAG, "Unpairing device %d (%s)", device + 1,
+             configs[device].device_id);
+    clear_device(device);
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        if ((int)device == pair_slot) {
+            sync_received = false;
+        }
+        xSemaphoreGive(xSchedMutex);
+    }
     return ESP_OK;
 }
 
-char *smoke_x_get_data_json() {
-    cJSON_ReplaceItemInObject(root, SMOKE_X_BILLOWS,
-                              cJSON_CreateBool(state.billows_attached));
-    for (unsigned int i = 0; i < config.num_probes; i++) {
-        cJSON_ReplaceItemInObject(probes[i], SMOKE_X_CURRENT_TEMP,
-                                  cJSON_CreateNumber(state.probes[i].temp));
-        cJSON_ReplaceItemInObject(probes[i], SMOKE_X_ALARM_MAX,
-                                  cJSON_CreateNumber(state.probes[i].max_temp));
-        cJSON_ReplaceItemInObject(probes[i], SMOKE_X_ALARM_MIN,
-                                  cJSON_CreateNumber(state.probes[i].min_temp));
+/* Start a new cook on a device, discarding the history kept so far */
+esp_err_t smoke_x_new_cook(unsigned int device) {
+    uint32_t oldest, next_seq;
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
     }
-    bool success =
-        cJSON_PrintPreallocated(root, json_str, sizeof(json_str), false);
-    if (success) {
-        return json_str;
+    smoke_x_history_clear(device);
+    smoke_x_link_clear(device);
+    smoke_x_history_tier_range(device, 0, &oldest, &next_seq);
+    esp_err_t err = smoke_x_log_new_cook(device, next_seq);
+    // History is still usable without the log
+    return err == ESP_ERR_INVALID_STATE ? ESP_OK : err;
+}
+
+esp_err_t smoke_x_get_config(unsigned int device, smoke_x_config_t *p_config) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        memcpy(p_config, &configs[device], sizeof(smoke_x_config_t));
+        xSemaphoreGive(xSchedMutex);
     }
-    return NULL;
+    return ESP_OK;
 }
 
-unsigned int smoke_x_get_num_records() {
-    return cJSON_GetArraySize(probes_history[0]);
+esp_err_t smoke_x_get_state(unsigned int device, smoke_x_state_t *p_state) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(p_state, &states[device], sizeof(smoke_x_state_t));
+    return ESP_OK;
 }
 
-char *smoke_x_get_device_id() { return config.device_id; }
+esp_err_t smoke_x_get_catch_stats(unsigned int device,
+                                  smoke_x_catch_stats_t *p_stats) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xSemaphoreTake(xSchedMutex, portMAX_DELAY)) {
+        const smoke_x_sched_device_t *dev = &sched.devices[device];
+        p_stats->interval_ms = dev->next_expected ? dev->interval : 0;
+        p_stats->expected = dev->expected;
+        p_stats->caught = dev->caught;
+        xSemaphoreGive(xSchedMutex);
+    }
+    return ESP_OK;
+}
+
+typedef struct {
+    smoke_x_write_fn_t write_fn;
+    void *ctx;
+    smoke_x_data_format_t format;
+    bool need_sep;
+    esp_err_t err;
+    size_t len;
+    char buf[DATA_CHUNK_LEN];
+} data_writer_t;
+
+static void writer_flush(data_writer_t *w) {
+    if (!w->err && w->len > 0) {
+        w->err = w->write_fn(w->ctx, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void writer_printf(data_writer_t *w, const char *fmt, ...) {
+    va_list args;
+    for (int attempt = 0; attempt < 2 && !w->err; attempt++) {
+        size_t avail = sizeof(w->buf) - w->len;
+        va_start(args, fmt);
+        int n = vsnprintf(w->buf + w->len, avail, fmt, args);
+        va_end(args);
+        if (n >= 0 && (size_t)n < avail) {
+            w->len += n;
+            return;
+        }
+        // Didn't fit, send what we have and try again with an empty buffer
+        writer_flush(w);
+    }
+    if (!w->err) {
+        w->err = ESP_ERR_INVALID_SIZE;
+    }
+}
+
+static void writer_bytes(data_writer_t *w, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0 && !w->err) {
+        if (w->len == sizeof(w->buf)) {
+            writer_flush(w);
+        }
+        size_t n = sizeof(w->buf) - w->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+// Writes a CBOR initial byte that carries no argument
+static void cbor_byte(data_writer_t *w, uint8_t major, uint8_t info) {
+    uint8_t byte = major << 5 | info;
+    writer_bytes(w, &byte, 1);
+}
+
+// Writes a CBOR initial byte and argument in its shortest form
+static void cbor_head(data_writer_t *w, uint8_t major, uint32_t val) {
+    uint8_t head[5];
+    size_t len = 1;
+    if (val < 24) {
+        head[0] = major << 5 | val;
+    } else if (val <= UINT8_MAX) {
+        head[0] = major << 5 | 24;
+        head[len++] = val;
+    } else if (val <= UINT16_MAX) {
+        head[0] = major << 5 | 25;
+        head[len++] = val >> 8;
+        head[len++] = val;
+    } else {
+        head[0] = major << 5 | 26;
+        head[len++] = val >> 24;
+        head[len++] = val >> 16;
+        head[len++] = val >> 8;
+        head[len++] = val;
+    }
+    writer_bytes(w, head, len);
+}
+
+/*
+ * Structure helpers shared by both output formats. Maps and arrays are
+ * written as CBOR indefinite length items, so like JSON nothing needs to be
+ * counted up front.
+ */
+static void write_sep(data_writer_t *w) {
+    if (w->format == SMOKE_X_DATA_JSON && w->need_sep) {
+        writer_printf(w, ",");
+    }
+    w->need_sep = true;
+}
+
+static void write_open(data_writer_t *w, bool map) {
+    write_sep(w);
+    if (w->format == SMOKE_X_DATA_CBOR) {
+        cbor_byte(w, map ? CBOR_MAP : CBOR_ARRAY, CBOR_INDEFINITE);
+    } else {
+        writer_printf(w, map ? "{" : "[");
+    }
+    w->need_sep = false;
+}
 
-char *smoke_x_get_units() { return state.units; }
+static void write_close(data_writer_t *w, bool map) {
+    if (w->format == SMOKE_X_DATA_CBOR) {
+        cbor_byte(w, CBOR_SIMPLE, CBOR_INDEFINITE);
+    } else {
+        writer_printf(w, map ? "}" : "]");
+    }
+    w->need_sep = true;
+}
+
+static void write_key(data_writer_t *w, const char *key) {
+    write_sep(w);
+    if (w->format == SMOKE_X_DATA_CBOR) {
+        cbor_head(w, CBOR_TEXT, strlen(key));
+        writer_bytes(w, key, strlen(key));
+    } else {
+        writer_printf(w, "\"%s\":", key);
+    }
+    w->need_sep = false;
+}
+
+static void write_int(data_writer_t *w, long val) {
+    write_sep(w);
+    if (w->format == SMOKE_X_DATA_CBOR) {
+        cbor_head(w, val < 0 ? CBOR_NEGATIVE : CBOR_UNSIGNED,
+                  val < 0 ? -1 - val : val);
+    } else {
+        writer_printf(w, "%ld", val);
+    }
+}
+
+static void write_bool(data_writer_t *w, bool val) {
+    write_sep(w);
+    if (w->format == SMOKE_X_DATA_CBOR) {
+        cbor_byte(w, CBOR_SIMPLE, val ? CBOR_TRUE : CBOR_FALSE);
+    } else {
+        writer_printf(w, val ? "true" : "false");
+    }
+}
+
+// Writes a deci-degree value, as an integer number of tenths for CBOR and
+// otherwise the same way cJSON prints the equivalent double
+static void write_deci(data_writer_t *w, long val) {
+    if (w->format == SMOKE_X_DATA_CBOR || val % 10 == 0) {
+        write_int(w, w->format == SMOKE_X_DATA_CBOR ? val : val / 10);
+    } else {
+        write_sep(w);
+        writer_printf(w, "%s%ld.%ld", val < 0 ? "-" : "", labs(val) / 10,
+                      labs(val) % 10);
+    }
+}
+
+// Writes one probe's history, merging group buckets into each min/max pair
+static void write_history(data_writer_t *w, unsigned int device,
+                          unsigned int probe, unsigned int tier,
+                          uint32_t start, uint32_t end, unsigned int group) {
+    smoke_x_bucket_t buckets[HISTORY_READ_LEN];
+    size_t len;
+    uint32_t index = start;
+    int16_t last_avg = 0;
+    bool first = true;
+
+    while ((len = smoke_x_history_read_buckets(device, tier, probe, &index,
+                                               end, group, buckets, NULL,
+                                               HISTORY_READ_LEN)) > 0) {
+        for (size_t j = 0; j < len; j++) {
+            if (group == 1) {
+                write_deci(w, buckets[j].avg);
+            } else if (first || buckets[j].avg >= last_avg) {
+                // Keep the extremes in the order a rising series hits them
+                write_deci(w, buckets[j].min);
+                write_deci(w, buckets[j].max);
+            } else {
+                write_deci(w, buckets[j].max);
+                write_deci(w, buckets[j].min);
+            }
+            last_avg = buckets[j].avg;
+            first = false;
+        }
+    }
+}
+
+// Writes the time of the first history point followed by the offset of each
+// point from it, so that they line up with the probes' history arrays
+static void write_times(data_writer_t *w, unsigned int device,
+                        unsigned int tier, uint32_t start, uint32_t end,
+                        unsigned int group, unsigned int interval) {
+    smoke_x_bucket_t buckets[HISTORY_READ_LEN];
+    uint32_t times[HISTORY_READ_LEN];
+    size_t len;
+    uint32_t index = start;
+    uint32_t start_time = smoke_x_history_now();
+
+    if (smoke_x_history_read_buckets(device, tier, 0, &index, end, group,
+                                     buckets, times, 1) > 0) {
+        start_time = times[0];
+    }
+    write_key(w, SMOKE_X_START_TIME);
+    write_int(w, start_time);
+    write_key(w, SMOKE_X_TIME_OFFSETS);
+    write_open(w, false);
+    index = start;
+    while ((len = smoke_x_history_read_buckets(device, tier, 0, &index, end,
+                                               group, buckets, times,
+                                               HISTORY_READ_LEN)) > 0) {
+        for (size_t j = 0; j < len; j++) {
+            long offset = (int32_t)(times[j] - start_time);
+            write_int(w, offset);
+            if (group > 1) {
+                // The second point of a min/max pair
+                write_int(w, offset + interval);
+            }
+        }
+    }
+    write_close(w, false);
+}
+
+// Writes the link quality of the last packet, then a row per period of
+// [time, rssi_min, rssi, rssi_max, snr, received, missed]
+static void write_link(data_writer_t *w, unsigned int device,
+                       const smoke_x_link_t *link) {
+    smoke_x_link_bucket_t buckets[LINK_READ_LEN];
+    size_t len;
+    uint32_t index, end;
+
+    write_key(w, SMOKE_X_LINK);
+    write_open(w, true);
+    write_key(w, SMOKE_X_RSSI);
+    write_int(w, link->rssi);
+    write_key(w, SMOKE_X_SNR);
+    write_int(w, lroundf(link->snr));
+    write_key(w, SMOKE_X_PACKET_INTERVAL);
+    write_int(w, link->interval);
+    write_key(w, SMOKE_X_PACKET_LOSS);
+    write_int(w, lroundf(link->loss * 100));
+    write_key(w, SMOKE_X_PERIOD);
+    write_int(w, smoke_x_link_period());
+    write_key(w, SMOKE_X_HISTORY);
+    write_open(w, false);
+    smoke_x_link_range(device, &index, &end);
+    while ((len = smoke_x_link_read_buckets(device, &index, end, buckets,
+                                            LINK_READ_LEN)) > 0) {
+        for (size_t j = 0; j < len; j++) {
+            write_open(w, false);
+            write_int(w, buckets[j].time);
+            write_int(w, buckets[j].rssi_min);
+            write_int(w, buckets[j].rssi_avg);
+            write_int(w, buckets[j].rssi_max);
+            write_int(w, buckets[j].snr_avg);
+            write_int(w, buckets[j].received);
+            write_int(w, buckets[j].missed);
+            write_close(w, false);
+        }
+    }
+    write_close(w, false);
+    write_close(w, true);
+}
+
+// Picks the finest tier that satisfies the requested resolution, or that
+// still covers the whole cook when only the number of points is limited
+static unsigned int select_tier(const smoke_x_data_query_t *query) {
+    uint32_t oldest, end;
+    unsigned int tier = 0;
+    if (query->resolution) {
+        for (unsigned int i = 1; i < SMOKE_X_HISTORY_NUM_TIERS; i++) {
+            if (smoke_x_history_tier_period(i) <= query->resolution) {
+                tier = i;
+            }
+        }
+    } else {
+        while (tier < SMOKE_X_HISTORY_NUM_TIERS - 1 &&
+               !smoke_x_history_tier_range(query->device, tier, &oldest,
+                                           &end)) {
+            tier++;
+        }
+    }
+    return tier;
+}
+
+esp_err_t smoke_x_write_data(const smoke_x_data_query_t *query,
+                             smoke_x_write_fn_t write_fn, void *ctx) {
+    uint32_t oldest_seq, start_seq, next_seq, start, end;
+    unsigned int tier = 0;
+    unsigned int group = 1;
+    unsigned int interval = SMOKE_X_TX_INTERVAL;
+    bool decimated = query->resolution || query->max_points;
+    unsigned int device = query->device;
+    smoke_x_state_t snapshot;
+    data_writer_t w = {.write_fn = write_fn,
+                       .ctx = ctx,
+                       .format = query->format,
+                       .err = ESP_OK};
+
+    if (smoke_x_get_state(device, &snapshot) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    smoke_x_history_tier_range(device, 0, &oldest_seq, &next_seq);
+    // Anything outside of the retained window (e.g. a sequence number from
+    // before a reboot) gets the full history
+    start_seq = !decimated && (int32_t)(query->since - oldest_seq) >= 0 &&
+                        (int32_t)(next_seq - query->since) >= 0
+                    ? query->since
+                    : oldest_seq;
+    start = start_seq;
+    end = next_seq;
+    if (decimated) {
+        tier = select_tier(query);
+        smoke_x_history_tier_range(device, tier, &start, &end);
+        unsigned int pairs = query->max_points > 1 ? query->max_points / 2 : 1;
+        if (query->max_points && end - start > query->max_points) {
+            group = (end - start + pairs - 1) / pairs;
+        }
+        if (tier) {
+            interval = smoke_x_history_tier_period(tier);
+        }
+        if (group > 1) {
+            interval = interval * group / 2;
+        }
+    }
+
+    write_open(&w, true);
+    for (unsigned int i = 0; i < configs[device].num_probes; i++) {
+        write_key(&w, probe_names[i]);
+        write_open(&w, true);
+        write_key(&w, SMOKE_X_CURRENT_TEMP);
+        write_deci(&w, lround(snapshot.probes[i].temp * 10.0));
+        write_key(&w, SMOKE_X_ALARM_MAX);
+        write_int(&w, snapshot.probes[i].max_temp);
+        write_key(&w, SMOKE_X_ALARM_MIN);
+        write_int(&w, snapshot.probes[i].min_temp);
+        write_key(&w, SMOKE_X_HISTORY);
+        write_open(&w, false);
+        write_history(&w, device, i, tier, start, end, group);
+        write_close(&w, false);
+        write_close(&w, true);
+    }
+    write_key(&w, SMOKE_X_BILLOWS);
+    write_bool(&w, snapshot.billows_attached);
+    write_key(&w, SMOKE_X_OLDEST_SEQ);
+    write_int(&w, oldest_seq);
+    write_key(&w, SMOKE_X_START_SEQ);
+    write_int(&w, start_seq);
+    write_key(&w, SMOKE_X_NEXT_SEQ);
+    write_int(&w, next_seq);
+    if (decimated) {
+        write_key(&w, SMOKE_X_INTERVAL);
+        write_int(&w, interval);
+    }
+    write_key(&w, SMOKE_X_TIME);
+    write_int(&w, smoke_x_history_now());
+    write_key(&w, SMOKE_X_CLOCK_SYNCED);
+    write_bool(&w, smoke_x_history_clock_synced());
+    write_times(&w, device, tier, start, end, group, interval);
+    write_link(&w, device, &snapshot.link);
+    write_close(&w, true);
+    writer_flush(&w);
+    return w.err;
+}
+
+unsigned int smoke_x_get_num_records(unsigned int device) {
+    return smoke_x_history_count(device);
+}
+
+char *smoke_x_get_device_id(unsigned int device) {
+    return device < SMOKE_X_MAX_DEVICES ? configs[device].device_id : "";
+}
+
+uint32_t smoke_x_get_sync_time() { return sync_time_ms; }
+
+char *smoke_x_get_units(unsigned int device) {
+    return device < SMOKE_X_MAX_DEVICES ? states[device].units : NULL;
+}
 
 esp_err_t smoke_x_start() {
     app_lora_start_rx(handle_rx);
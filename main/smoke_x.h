@@ -2,10 +2,15 @@
 #define SMOKE_X_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <esp_event.h>
 
 #define SMOKE_X_APP_VERSION "0.1.0"
 #define SMOKE_X_DEVICE_ID_LEN 8
+#define SMOKE_X_TX_INTERVAL 30
+#define SMOKE_X_MAX_PROBES 4
+#define SMOKE_X_MAX_DEVICES CONFIG_SMOKE_X_MAX_DEVICES
 #define SMOKE_X_PROBE_1 "probe_1"
 #define SMOKE_X_PROBE_2 "probe_2"
 #define SMOKE_X_PROBE_3 "probe_3"
@@ -15,8 +20,23 @@
 #define SMOKE_X_ALARM_MIN "alarm_min"
 #define SMOKE_X_CURRENT_TEMP "current_temp"
 #define SMOKE_X_HISTORY "history"
+#define SMOKE_X_OLDEST_SEQ "oldest_seq"
+#define SMOKE_X_START_SEQ "start_seq"
+#define SMOKE_X_NEXT_SEQ "next_seq"
+#define SMOKE_X_INTERVAL "interval"
+#define SMOKE_X_TIME "time"
+#define SMOKE_X_CLOCK_SYNCED "clock_synced"
+#define SMOKE_X_START_TIME "start_time"
+#define SMOKE_X_TIME_OFFSETS "time_offsets"
+#define SMOKE_X_LINK "link"
+#define SMOKE_X_RSSI "rssi"
+#define SMOKE_X_SNR "snr"
+#define SMOKE_X_PACKET_INTERVAL "packet_interval"
+#define SMOKE_X_PACKET_LOSS "packet_loss"
+#define SMOKE_X_PERIOD "period"
 
 ESP_EVENT_DECLARE_BASE(SMOKE_X_EVENT);
+// Events other than DISCOVERY_REQUIRED carry the device index as an int
 typedef enum {
     SMOKE_X_EVENT_SYNC = 0,
     SMOKE_X_EVENT_SYNC_SUCCESS,
@@ -41,24 +61,66 @@ typedef struct {
     int min_temp;
 } smoke_x_probe_t;
 
+typedef struct {
+    int16_t rssi;       // dBm of the last packet
+    float snr;          // dB of the last packet
+    uint32_t interval;  // seconds since the packet before, 0 if unknown
+    float loss;         // smoothed fraction of packets missed
+} smoke_x_link_t;
+
 typedef struct {
     unsigned int num_probes;
     char *units;
     bool new_alarm;
     bool billows_attached;
-    smoke_x_probe_t probes[4];
+    smoke_x_probe_t probes[SMOKE_X_MAX_PROBES];
+    uint32_t time;       // when the state was received
+    bool time_is_epoch;  // whether time is in seconds since the epoch
+    smoke_x_link_t link;
 } smoke_x_state_t;
 
+typedef struct {
+    uint32_t interval_ms;  // learned transmit interval, 0 while not known
+    uint32_t expected;     // packets due since the interval was learned
+    uint32_t caught;       // of which were received
+} smoke_x_catch_stats_t;
+
+typedef enum {
+    SMOKE_X_DATA_JSON,
+    SMOKE_X_DATA_CBOR,  // temperatures as integer tenths of a degree
+} smoke_x_data_format_t;
+
+typedef struct {
+    unsigned int device;
+    smoke_x_data_format_t format;
+    uint32_t since;           // first sequence number to include
+    unsigned int resolution;  // seconds per point, 0 for every sample
+    unsigned int max_points;  // limit on points per probe, 0 for no limit
+} smoke_x_data_query_t;
+
+// Receives successive pieces of a serialized document
+typedef esp_err_t (*smoke_x_write_fn_t)(void *ctx, const char *buf,
+                                        size_t len);
+
 esp_err_t smoke_x_init();
 bool smoke_x_is_configured();
+bool smoke_x_is_paired(unsigned int device);
+bool smoke_x_is_pairing();
 esp_err_t smoke_x_sync();
+esp_err_t smoke_x_pair();
+esp_err_t smoke_x_unpair(unsigned int device);
+esp_err_t smoke_x_new_cook(unsigned int device);
 esp_err_t smoke_x_start();
 esp_err_t smoke_x_stop();
-esp_err_t smoke_x_get_config(smoke_x_config_t *p_config);
-esp_err_t smoke_x_get_state(smoke_x_state_t *p_state);
-unsigned int smoke_x_get_num_records();
-char *smoke_x_get_data_json();
-char *smoke_x_get_units();
-char *smoke_x_get_device_id();
+esp_err_t smoke_x_get_config(unsigned int device, smoke_x_config_t *p_config);
+esp_err_t smoke_x_get_state(unsigned int device, smoke_x_state_t *p_state);
+esp_err_t smoke_x_get_catch_stats(unsigned int device,
+                                  smoke_x_catch_stats_t *p_stats);
+unsigned int smoke_x_get_num_records(unsigned int device);
+esp_err_t smoke_x_write_data(const smoke_x_data_query_t *query,
+                             smoke_x_write_fn_t write_fn, void *ctx);
+char *smoke_x_get_units(unsigned int device);
+char *smoke_x_get_device_id(unsigned int device);
+uint32_t smoke_x_get_sync_time();
 
 #endif
@@ -0,0 +1,587 @@
+#include <math.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "smoke_x_history.h"
+
+/*
+ * Probe temperatures are stored as deci-degrees (the resolution transmitted
+ * by the Smoke X) in a ring of fixed size compressed blocks, so appending or
+ * evicting a sample never touches the heap. The first sample of a block is
+ * stored in the block header and every following sample is encoded relative
+ * to the previous one: a flags byte telling which probe temperatures changed
+ * and whether the interval changed, followed by zig-zag varints of the
+ * interval's change (delta-of-delta) and of each changed temperature. A
+ * typical sample takes 2-4 bytes instead of 8 for the raw temperatures alone.
+ * When the newest block is full a new one is started, evicting the oldest
+ * block once all of them are in use.
+ *
+ * Every sample is numbered by a monotonically increasing sequence number,
+ * which lets readers resume where they left off. The newest sample has
+ * sequence number next_seq - 1 and the oldest retained one next_seq - count.
+ *
+ * Older samples are also summarized into progressively coarser tiers of
+ * min/max/avg buckets so that a whole cook can be charted after the raw
+ * samples have been evicted. Buckets are numbered the same way as samples,
+ * and the bucket that is still being filled has number next_index.
+ *
+ * Time is kept in seconds of uptime, shifted by clock_offset so that it keeps
+ * increasing when the history is restored from a previous boot. Once the
+ * wall clock has been set (see smoke_x_history_sync_clock) the history clock
+ * is moved to seconds since the epoch, and the samples recorded since the
+ * restart are moved along with it. The first of those always starts a new
+ * block, so only whole blocks need to be rebased.
+ *
+ * Each paired device has a history of its own, all sharing the one clock.
+ */
+
+#define NUM_BLOCKS 64
+#define BLOCK_DATA_LEN 236
+// Flags byte, time delta-of-delta and one temperature delta per probe
+#define MAX_SAMPLE_LEN (1 + 5 + 3 * SMOKE_X_MAX_PROBES)
+#define FLAG_TIME (1 << SMOKE_X_MAX_PROBES)
+#define TIER_1_PERIOD 120
+#define TIER_1_CAPACITY 360
+#define TIER_2_PERIOD 600
+#define TIER_2_CAPACITY 216
+
+typedef struct {
+    int16_t min[SMOKE_X_MAX_PROBES];
+    int16_t max[SMOKE_X_MAX_PROBES];
+    int32_t sum[SMOKE_X_MAX_PROBES];
+    uint32_t start;
+    uint16_t n;
+} accumulator_t;
+
+typedef struct {
+    uint32_t first_seq;
+    uint32_t first_time;
+    int16_t first_temps[SMOKE_X_MAX_PROBES];
+    uint16_t n;
+    uint16_t len;
+    uint8_t data[BLOCK_DATA_LEN];
+} block_t;
+
+// Position of a sample within the blocks, along with its decoded values
+typedef struct {
+    unsigned int block;
+    uint16_t pos;
+    uint16_t i;
+    uint32_t time;
+    int32_t interval;
+    int16_t temps[SMOKE_X_MAX_PROBES];
+} cursor_t;
+
+typedef struct {
+    unsigned int period;
+    unsigned int capacity;
+    smoke_x_bucket_t (*buckets)[SMOKE_X_MAX_PROBES];
+    uint32_t *times;
+    unsigned int head;
+    unsigned int count;
+    uint32_t first_index;
+    uint32_t next_index;
+    accumulator_t acc;
+} tier_t;
+
+// Everything recorded from one transmitter
+typedef struct {
+    block_t blocks[NUM_BLOCKS];
+    unsigned int first_block;
+    unsigned int num_blocks;
+    cursor_t tail;
+    unsigned int count;
+    uint32_t first_seq;
+    uint32_t next_seq;
+    bool recording;
+    uint32_t boot_seq;
+    smoke_x_bucket_t tier_1_buckets[TIER_1_CAPACITY][SMOKE_X_MAX_PROBES];
+    smoke_x_bucket_t tier_2_buckets[TIER_2_CAPACITY][SMOKE_X_MAX_PROBES];
+    uint32_t tier_1_times[TIER_1_CAPACITY];
+    uint32_t tier_2_times[TIER_2_CAPACITY];
+    tier_t tiers[SMOKE_X_HISTORY_NUM_TIERS - 1];
+} history_t;
+
+static const char *TAG = "smoke_x_history";
+static SemaphoreHandle_t xHistoryMutex = NULL;
+static history_t histories[SMOKE_X_MAX_DEVICES];
+_Static_assert(sizeof(histories) <= CONFIG_SMOKE_X_HISTORY_RAM_KB * 1024,
+               "Temperature history over CONFIG_SMOKE_X_HISTORY_RAM_KB");
+static uint32_t clock_offset = 0;
+static bool clock_synced = false;
+
+static int16_t to_deci_degrees(double temp) {
+    long val = lround(temp * 10.0);
+    if (val > INT16_MAX) return INT16_MAX;
+    if (val < INT16_MIN) return INT16_MIN;
+    return (int16_t)val;
+}
+
+static uint32_t now_seconds() {
+    return (uint32_t)(esp_timer_get_time() / 1000000) + clock_offset;
+}
+
+static uint32_t zigzag(int32_t val) {
+    return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static int32_t unzigzag(uint32_t val) {
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
+}
+
+static void put_varint(block_t *block, uint32_t val) {
+    while (val >= 0x80) {
+        block->data[block->len++] = (uint8_t)val | 0x80;
+        val >>= 7;
+    }
+    block->data[block->len++] = (uint8_t)val;
+}
+
+static uint32_t get_varint(const block_t *block, uint16_t *pos) {
+    uint32_t val = 0;
+    unsigned int shift = 0;
+    uint8_t byte;
+    do {
+        byte = block->data[(*pos)++];
+        val |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return val;
+}
+
+static block_t *get_block(history_t *h, unsigned int i) {
+    return &h->blocks[(h->first_block + i) % NUM_BLOCKS];
+}
+
+static void cursor_start(history_t *h, cursor_t *c, unsigned int i) {
+    const block_t *block = get_block(h, i);
+    c->block = i;
+    c->pos = 0;
+    c->i = 0;
+    c->time = block->first_time;
+    c->interval = 0;
+    memcpy(c->temps, block->first_temps, sizeof(c->temps));
+}
+
+/* Decode the sample following the cursor, moving on to the next block */
+static void cursor_next(history_t *h, cursor_t *c) {
+    const block_t *block = get_block(h, c->block);
+    if (c->i + 1 >= block->n) {
+        if (c->block + 1 < h->num_blocks) {
+            cursor_start(h, c, c->block + 1);
+        }
+        return;
+    }
+    uint8_t flags = block->data[c->pos++];
+    if (flags & FLAG_TIME) {
+        c->interval += unzigzag(get_varint(block, &c->pos));
+    }
+    c->time += c->interval;
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        if (flags & (1 << i)) {
+            c->temps[i] += unzigzag(get_varint(block, &c->pos));
+        }
+    }
+    c->i++;
+}
+
+static void cursor_seek(history_t *h, cursor_t *c, uint32_t seq) {
+    unsigned int i = 0;
+    while (i + 1 < h->num_blocks &&
+           (int32_t)(seq - get_block(h, i + 1)->first_seq) >= 0) {
+        i++;
+    }
+    cursor_start(h, c, i);
+    for (uint32_t n = seq - get_block(h, i)->first_seq; n > 0; n--) {
+        cursor_next(h, c);
+    }
+}
+
+static void start_block(history_t *h, const smoke_x_sample_t *sample) {
+    if (h->num_blocks == NUM_BLOCKS) {
+        h->count -= h->blocks[h->first_block].n;
+        h->first_block = (h->first_block + 1) % NUM_BLOCKS;
+        h->num_blocks--;
+    }
+    block_t *block = get_block(h, h->num_blocks++);
+    block->first_seq = sample->seq;
+    block->first_time = sample->time;
+    memcpy(block->first_temps, sample->temps, sizeof(block->first_temps));
+    block->n = 1;
+    block->len = 0;
+    cursor_start(h, &h->tail, h->num_blocks - 1);
+}
+
+static void encode_sample(history_t *h, const smoke_x_sample_t *sample) {
+    block_t *block = get_block(h, h->num_blocks - 1);
+    cursor_t *tail = &h->tail;
+    int32_t interval = (int32_t)(sample->time - tail->time);
+    uint8_t flags = interval != tail->interval ? FLAG_TIME : 0;
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        if (sample->temps[i] != tail->temps[i]) {
+            flags |= 1 << i;
+        }
+    }
+    block->data[block->len++] = flags;
+    if (flags & FLAG_TIME) {
+        put_varint(block, zigzag(interval - tail->interval));
+    }
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        if (flags & (1 << i)) {
+            put_varint(block, zigzag(sample->temps[i] - tail->temps[i]));
+        }
+    }
+    block->n++;
+    tail->pos = block->len;
+    tail->i++;
+    tail->time = sample->time;
+    tail->interval = interval;
+    memcpy(tail->temps, sample->temps, sizeof(tail->temps));
+}
+
+static void close_bucket(tier_t *tier) {
+    smoke_x_bucket_t *bucket = tier->buckets[tier->head];
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        bucket[i].min = tier->acc.min[i];
+        bucket[i].max = tier->acc.max[i];
+        bucket[i].avg = tier->acc.sum[i] / tier->acc.n;
+    }
+    tier->times[tier->head] = tier->acc.start;
+    tier->head = (tier->head + 1) % tier->capacity;
+    if (tier->count < tier->capacity) {
+        tier->count++;
+    }
+    tier->next_index++;
+    tier->acc.n = 0;
+}
+
+static void accumulate(tier_t *tier, const int16_t *sample, uint32_t now) {
+    uint32_t start = now - now % tier->period;
+    if (tier->acc.n > 0 && tier->acc.start != start) {
+        close_bucket(tier);
+    }
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        if (tier->acc.n == 0) {
+            tier->acc.min[i] = sample[i];
+            tier->acc.max[i] = sample[i];
+            tier->acc.sum[i] = 0;
+        } else if (sample[i] < tier->acc.min[i]) {
+            tier->acc.min[i] = sample[i];
+        } else if (sample[i] > tier->acc.max[i]) {
+            tier->acc.max[i] = sample[i];
+        }
+        tier->acc.sum[i] += sample[i];
+    }
+    tier->acc.start = start;
+    tier->acc.n++;
+}
+
+static smoke_x_bucket_t tier_bucket(tier_t *tier, unsigned int probe,
+                                    uint32_t index, uint32_t *time) {
+    if (index == tier->next_index) {
+        smoke_x_bucket_t open = {.min = tier->acc.min[probe],
+                                 .max = tier->acc.max[probe],
+                                 .avg = tier->acc.sum[probe] / tier->acc.n};
+        *time = tier->acc.start;
+        return open;
+    }
+    uint32_t age = tier->next_index - index;
+    unsigned int slot = (tier->head + tier->capacity - age) % tier->capacity;
+    *time = tier->times[slot];
+    return tier->buckets[slot][probe];
+}
+
+/*
+ * Move the samples from from_seq onward, and the buckets they went into, by
+ * shift seconds. from_seq has to be the first sample of a block.
+ */
+static void rebase(history_t *h, uint32_t from_seq, int32_t shift) {
+    unsigned int first = 0;
+    while (first < h->num_blocks &&
+           (int32_t)(get_block(h, first)->first_seq - from_seq) < 0) {
+        first++;
+    }
+    if (first == h->num_blocks) {
+        return;
+    }
+    uint32_t from_time = get_block(h, first)->first_time;
+    for (unsigned int i = first; i < h->num_blocks; i++) {
+        get_block(h, i)->first_time += shift;
+    }
+    h->tail.time += shift;
+    for (unsigned int i = 0; i < SMOKE_X_HISTORY_NUM_TIERS - 1; i++) {
+        tier_t *tier = &h->tiers[i];
+        // Any bucket still open at from_time holds some of the samples
+        for (unsigned int j = 0; j < tier->count; j++) {
+            unsigned int slot =
+                (tier->head + tier->capacity - 1 - j) % tier->capacity;
+            if ((int32_t)(tier->times[slot] + tier->period - from_time) <= 0) {
+                break;
+            }
+            tier->times[slot] += shift;
+        }
+        // Realign the open bucket so that later samples still go into it
+        if (tier->acc.n > 0 &&
+            (int32_t)(tier->acc.start + tier->period - from_time) > 0) {
+            tier->acc.start += shift;
+            tier->acc.start -= tier->acc.start % tier->period;
+        }
+    }
+}
+
+static void get_range(history_t *h, unsigned int tier, uint32_t *oldest,
+                      uint32_t *end) {
+    if (tier == 0) {
+        *oldest = h->next_seq - h->count;
+        *end = h->next_seq;
+    } else {
+        tier_t *t = &h->tiers[tier - 1];
+        *oldest = t->next_index - t->count;
+        *end = t->next_index + (t->acc.n > 0 ? 1 : 0);
+    }
+}
+
+esp_err_t smoke_x_history_init() {
+    if (!xHistoryMutex) {
+        xHistoryMutex = xSemaphoreCreateMutex();
+    }
+    if (!xHistoryMutex) {
+        ESP_LOGE(TAG, "Unable to create history mutex");
+        return ESP_FAIL;
+    }
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        history_t *h = &histories[i];
+        h->tiers[0].period = TIER_1_PERIOD;
+        h->tiers[0].capacity = TIER_1_CAPACITY;
+        h->tiers[0].buckets = h->tier_1_buckets;
+        h->tiers[0].times = h->tier_1_times;
+        h->tiers[1].period = TIER_2_PERIOD;
+        h->tiers[1].capacity = TIER_2_CAPACITY;
+        h->tiers[1].buckets = h->tier_2_buckets;
+        h->tiers[1].times = h->tier_2_times;
+        smoke_x_history_clear(i);
+    }
+    return ESP_OK;
+}
+
+void smoke_x_history_clear(unsigned int device) {
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        // Sequence numbers keep counting so that clients notice the reset
+        h->first_block = 0;
+        h->num_blocks = 0;
+        h->count = 0;
+        h->first_seq = h->next_seq;
+        for (unsigned int i = 0; i < SMOKE_X_HISTORY_NUM_TIERS - 1; i++) {
+            h->tiers[i].head = 0;
+            h->tiers[i].count = 0;
+            h->tiers[i].first_index = h->tiers[i].next_index;
+            h->tiers[i].acc.n = 0;
+        }
+        xSemaphoreGive(xHistoryMutex);
+    }
+}
+
+static void append_sample(history_t *h, const smoke_x_sample_t *sample) {
+    const block_t *last =
+        h->num_blocks ? get_block(h, h->num_blocks - 1) : NULL;
+    if (!last || sample->flags & SMOKE_X_SAMPLE_BOOT ||
+        last->len > BLOCK_DATA_LEN - MAX_SAMPLE_LEN) {
+        start_block(h, sample);
+    } else {
+        encode_sample(h, sample);
+    }
+    h->count++;
+    for (unsigned int i = 0; i < SMOKE_X_HISTORY_NUM_TIERS - 1; i++) {
+        accumulate(&h->tiers[i], sample->temps, sample->time);
+    }
+    h->next_seq = sample->seq + 1;
+}
+
+void smoke_x_history_append(unsigned int device, const smoke_x_state_t *state,
+                            smoke_x_sample_t *p_sample) {
+    smoke_x_sample_t sample = {.time = now_seconds()};
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return;
+    }
+    for (unsigned int i = 0; i < state->num_probes; i++) {
+        sample.temps[i] = to_deci_degrees(state->probes[i].temp);
+    }
+    if (xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        sample.seq = h->next_seq;
+        if (!h->recording) {
+            h->recording = true;
+            h->boot_seq = sample.seq;
+            sample.flags = SMOKE_X_SAMPLE_BOOT;
+        }
+        append_sample(h, &sample);
+        xSemaphoreGive(xHistoryMutex);
+    }
+    if (p_sample) {
+        memcpy(p_sample, &sample, sizeof(smoke_x_sample_t));
+    }
+}
+
+/* Append a sample that was recorded earlier, keeping its number and time */
+void smoke_x_history_restore(unsigned int device,
+                             const smoke_x_sample_t *sample) {
+    uint32_t now = now_seconds();
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        if (h->count > 0 && sample->seq != h->next_seq) {
+            // Samples in a block are consecutive, start over after a gap
+            h->first_block = 0;
+            h->num_blocks = 0;
+            h->count = 0;
+        }
+        if (h->count == 0) {
+            h->first_seq = sample->seq;
+        }
+        if ((int32_t)(sample->time - now) > 0) {
+            clock_offset += sample->time - now;
+        }
+        append_sample(h, sample);
+        xSemaphoreGive(xHistoryMutex);
+    }
+}
+
+/* Current time on the clock used to timestamp samples */
+uint32_t smoke_x_history_now() { return now_seconds(); }
+
+bool smoke_x_history_clock_synced() { return clock_synced; }
+
+/*
+ * Switch the history clock over to the wall clock once it has been set, e.g.
+ * by SNTP. Returns a bit per device whose samples recorded since the restart
+ * had to be moved, along with the shift so that the same can be done on
+ * replay.
+ */
+unsigned int smoke_x_history_sync_clock(uint32_t epoch, int32_t *shift) {
+    unsigned int rebased = 0;
+    if (xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        if (!clock_synced) {
+            *shift = (int32_t)(epoch - now_seconds());
+            for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+                if (histories[i].recording) {
+                    rebase(&histories[i], histories[i].boot_seq, *shift);
+                    rebased |= 1 << i;
+                }
+            }
+            clock_offset += *shift;
+            clock_synced = true;
+        }
+        xSemaphoreGive(xHistoryMutex);
+    }
+    return rebased;
+}
+
+/* Repeat an earlier clock sync on restored samples */
+void smoke_x_history_rebase(unsigned int device, uint32_t from_seq,
+                            int32_t shift) {
+    uint32_t now = now_seconds();
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        rebase(h, from_seq, shift);
+        if (h->num_blocks > 0 && (int32_t)(h->tail.time - now) > 0) {
+            clock_offset += h->tail.time - now;
+        }
+        xSemaphoreGive(xHistoryMutex);
+    }
+}
+
+unsigned int smoke_x_history_count(unsigned int device) {
+    return device < SMOKE_X_MAX_DEVICES ? histories[device].count : 0;
+}
+
+unsigned int smoke_x_history_tier_period(unsigned int tier) {
+    return tier > 0 && tier < SMOKE_X_HISTORY_NUM_TIERS
+               ? histories[0].tiers[tier - 1].period
+               : 0;
+}
+
+/*
+ * A tier is complete if it still holds everything since the history was
+ * cleared, i.e. it covers the whole cook.
+ */
+bool smoke_x_history_tier_range(unsigned int device, unsigned int tier,
+                                uint32_t *oldest, uint32_t *end) {
+    bool complete = false;
+    if (device < SMOKE_X_MAX_DEVICES && tier < SMOKE_X_HISTORY_NUM_TIERS &&
+        xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        get_range(h, tier, oldest, end);
+        if (tier == 0) {
+            complete = h->count == h->next_seq - h->first_seq;
+        } else {
+            tier_t *t = &h->tiers[tier - 1];
+            complete = t->count == t->next_index - t->first_index;
+        }
+        xSemaphoreGive(xHistoryMutex);
+    }
+    return complete;
+}
+
+/*
+ * Copy up to max_len buckets of one probe, each one merging group consecutive
+ * buckets (or samples for tier 0) starting at *index and stopping before end.
+ * *index is advanced past the merged buckets. If times isn't NULL it receives
+ * the time of the first bucket of each group.
+ */
+size_t smoke_x_history_read_buckets(unsigned int device, unsigned int tier,
+                                    unsigned int probe, uint32_t *index,
+                                    uint32_t end, unsigned int group,
+                                    smoke_x_bucket_t *out, uint32_t *times,
+                                    size_t max_len) {
+    size_t len = 0;
+    uint32_t oldest, newest_end;
+    cursor_t c;
+    if (device >= SMOKE_X_MAX_DEVICES || tier >= SMOKE_X_HISTORY_NUM_TIERS ||
+        probe >= SMOKE_X_MAX_PROBES || group == 0) {
+        return 0;
+    }
+    if (xSemaphoreTake(xHistoryMutex, portMAX_DELAY)) {
+        history_t *h = &histories[device];
+        get_range(h, tier, &oldest, &newest_end);
+        if ((int32_t)(*index - oldest) < 0) {
+            *index = oldest;
+        }
+        if ((int32_t)(end - newest_end) > 0) {
+            end = newest_end;
+        }
+        if (tier == 0 && (int32_t)(end - *index) > 0) {
+            cursor_seek(h, &c, *index);
+        }
+        while ((int32_t)(end - *index) > 0 && len < max_len) {
+            int32_t sum = 0;
+            unsigned int n = 0;
+            smoke_x_bucket_t merged;
+            for (; n < group && (int32_t)(end - *index) > 0; n++, (*index)++) {
+                smoke_x_bucket_t b;
+                uint32_t time;
+                if (tier == 0) {
+                    b.min = b.max = b.avg = c.temps[probe];
+                    time = c.time;
+                    cursor_next(h, &c);
+                } else {
+                    b = tier_bucket(&h->tiers[tier - 1], probe, *index, &time);
+                }
+                if (n == 0 && times) {
+                    times[len] = time;
+                }
+                if (n == 0 || b.min < merged.min) merged.min = b.min;
+                if (n == 0 || b.max > merged.max) merged.max = b.max;
+                sum += b.avg;
+            }
+            merged.avg = sum / (int32_t)n;
+            out[len++] = merged;
+        }
+        xSemaphoreGive(xHistoryMutex);
+    }
+    return len;
+}
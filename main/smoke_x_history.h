@@ -0,0 +1,47 @@
+#ifndef SMOKE_X_HISTORY_H
+#define SMOKE_X_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "smoke_x.h"
+
+#define SMOKE_X_HISTORY_NUM_TIERS 3
+
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int16_t avg;
+} smoke_x_bucket_t;
+
+// Set on the first sample recorded after a restart
+#define SMOKE_X_SAMPLE_BOOT 0x01
+
+typedef struct {
+    uint32_t seq;
+    uint32_t time;
+    int16_t temps[SMOKE_X_MAX_PROBES];
+    uint8_t flags;
+} smoke_x_sample_t;
+
+esp_err_t smoke_x_history_init();
+void smoke_x_history_clear(unsigned int device);
+void smoke_x_history_append(unsigned int device, const smoke_x_state_t *state,
+                            smoke_x_sample_t *p_sample);
+void smoke_x_history_restore(unsigned int device,
+                             const smoke_x_sample_t *sample);
+uint32_t smoke_x_history_now();
+bool smoke_x_history_clock_synced();
+unsigned int smoke_x_history_sync_clock(uint32_t epoch, int32_t *shift);
+void smoke_x_history_rebase(unsigned int device, uint32_t from_seq,
+                            int32_t shift);
+unsigned int smoke_x_history_count(unsigned int device);
+unsigned int smoke_x_history_tier_period(unsigned int tier);
+bool smoke_x_history_tier_range(unsigned int device, unsigned int tier,
+                                uint32_t *oldest, uint32_t *end);
+size_t smoke_x_history_read_buckets(unsigned int device, unsigned int tier,
+                                    unsigned int probe, uint32_t *index,
+                                    uint32_t end, unsigned int group,
+                                    smoke_x_bucket_t *out, uint32_t *times,
+                                    size_t max_len);
+
+#endif
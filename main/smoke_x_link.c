@@ -0,0 +1,214 @@
+#include <math.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include "smoke_x_link.h"
+
+/*
+ * Radio link quality of the transmissions from the Smoke X. Every received
+ * packet updates the latest RSSI, SNR and packet interval. Since the base
+ * station transmits at a fixed interval, as learned by smoke_x_sched, the
+ * gap to the previous packet also tells how many packets were missed, which
+ * feeds a smoothed loss estimate.
+ *
+ * Packets are summarized into fixed periods of RSSI min/avg/max, average SNR
+ * and received/missed counts, kept in a ring that covers about as long as the
+ * coarsest history tier, so a dropped cook can be matched against the link.
+ * Every paired transmitter has a link of its own.
+ */
+
+#define LINK_PERIOD 600
+// Indexes wrap around at 2^32, which only stays aligned on a power of two
+#define LINK_CAPACITY 256
+// A longer gap, in transmit intervals, means the transmitter was off rather
+// than out of range
+#define LINK_MAX_GAP 20
+// Weight of the newest packet in the smoothed loss estimate
+#define LINK_LOSS_WEIGHT 0.1
+
+typedef struct {
+    int32_t rssi_sum;
+    int32_t snr_sum;
+    int16_t rssi_min;
+    int16_t rssi_max;
+    uint16_t received;
+    uint16_t missed;
+    uint32_t start;
+} link_acc_t;
+
+// Link of one transmitter
+typedef struct {
+    smoke_x_link_bucket_t buckets[LINK_CAPACITY];
+    uint32_t next_index;
+    unsigned int count;
+    link_acc_t acc;
+    int64_t last_timestamp;
+    float loss;
+} link_state_t;
+
+_Static_assert((LINK_CAPACITY & (LINK_CAPACITY - 1)) == 0,
+               "LINK_CAPACITY must be a power of two");
+
+static const char *TAG = "smoke_x_link";
+static SemaphoreHandle_t xLinkMutex = NULL;
+static link_state_t links[SMOKE_X_MAX_DEVICES];
+
+static int8_t clamp_int8(long val) {
+    return val < INT8_MIN ? INT8_MIN : val > INT8_MAX ? INT8_MAX : val;
+}
+
+static void acc_to_bucket(const link_acc_t *a, smoke_x_link_bucket_t *b) {
+    b->time = a->start;
+    b->rssi_min = clamp_int8(a->rssi_min);
+    b->rssi_max = clamp_int8(a->rssi_max);
+    b->rssi_avg = clamp_int8(lroundf((float)a->rssi_sum / a->received));
+    b->snr_avg = clamp_int8(lroundf((float)a->snr_sum / a->received / 10));
+    b->received = a->received;
+    b->missed = a->missed;
+}
+
+static void close_period(link_state_t *l) {
+    acc_to_bucket(&l->acc, &l->buckets[l->next_index % LINK_CAPACITY]);
+    l->next_index++;
+    if (l->count < LINK_CAPACITY) {
+        l->count++;
+    }
+    l->acc.received = 0;
+}
+
+esp_err_t smoke_x_link_init() {
+    if (!xLinkMutex) {
+        xLinkMutex = xSemaphoreCreateMutex();
+    }
+    if (!xLinkMutex) {
+        ESP_LOGE(TAG, "Unable to create link mutex");
+        return ESP_FAIL;
+    }
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        smoke_x_link_clear(i);
+    }
+    return ESP_OK;
+}
+
+void smoke_x_link_clear(unsigned int device) {
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xLinkMutex, portMAX_DELAY)) {
+        // Like history sequence numbers, indexes keep counting
+        links[device].count = 0;
+        links[device].acc.received = 0;
+        xSemaphoreGive(xLinkMutex);
+    }
+}
+
+/*
+ * Account a packet received at timestamp (us) and now (history clock), from
+ * a transmitter sending every tx_interval_ms
+ */
+void smoke_x_link_update(unsigned int device, int16_t rssi, float snr,
+                         int64_t timestamp, uint32_t now,
+                         uint32_t tx_interval_ms, smoke_x_link_t *p_link) {
+    uint32_t interval_ms = 0;
+    unsigned int missed = 0;
+
+    if (!tx_interval_ms) {
+        tx_interval_ms = SMOKE_X_TX_INTERVAL * 1000;
+    }
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xLinkMutex, portMAX_DELAY)) {
+        link_state_t *l = &links[device];
+        link_acc_t *acc = &l->acc;
+        if (l->last_timestamp) {
+            interval_ms = (timestamp - l->last_timestamp + 500) / 1000;
+        }
+        if (interval_ms && interval_ms <= LINK_MAX_GAP * tx_interval_ms) {
+            unsigned int expected =
+                (interval_ms + tx_interval_ms / 2) / tx_interval_ms;
+            if (expected > 1) {
+                missed = expected - 1;
+            } else {
+                expected = 1;
+            }
+            l->loss += LINK_LOSS_WEIGHT * ((float)missed / expected - l->loss);
+        }
+        l->last_timestamp = timestamp;
+
+        if (acc->received && now - acc->start >= LINK_PERIOD) {
+            close_period(l);
+        }
+        if (!acc->received) {
+            memset(acc, 0, sizeof(*acc));
+            acc->start = now;
+            acc->rssi_min = rssi;
+            acc->rssi_max = rssi;
+        }
+        acc->rssi_sum += rssi;
+        acc->snr_sum += lroundf(snr * 10);
+        acc->rssi_min = rssi < acc->rssi_min ? rssi : acc->rssi_min;
+        acc->rssi_max = rssi > acc->rssi_max ? rssi : acc->rssi_max;
+        acc->received++;
+        acc->missed += missed;
+
+        p_link->rssi = rssi;
+        p_link->snr = snr;
+        p_link->interval = (interval_ms + 500) / 1000;
+        p_link->loss = l->loss;
+        xSemaphoreGive(xLinkMutex);
+    }
+}
+
+/* Move the periods recorded since the restart to the wall clock */
+void smoke_x_link_rebase(int32_t shift) {
+    if (xSemaphoreTake(xLinkMutex, portMAX_DELAY)) {
+        for (unsigned int d = 0; d < SMOKE_X_MAX_DEVICES; d++) {
+            for (unsigned int i = 0; i < LINK_CAPACITY; i++) {
+                links[d].buckets[i].time += shift;
+            }
+            links[d].acc.start += shift;
+        }
+        xSemaphoreGive(xLinkMutex);
+    }
+}
+
+unsigned int smoke_x_link_period() { return LINK_PERIOD; }
+
+/*
+ * Periods are numbered like history buckets: the oldest one held is number
+ * oldest and the one still being filled, if any, is number end - 1.
+ */
+void smoke_x_link_range(unsigned int device, uint32_t *oldest,
+                        uint32_t *end) {
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xLinkMutex, portMAX_DELAY)) {
+        const link_state_t *l = &links[device];
+        *oldest = l->next_index - l->count;
+        *end = l->next_index + (l->acc.received ? 1 : 0);
+        xSemaphoreGive(xLinkMutex);
+    }
+}
+
+/* Copy periods from *index up to end, skipping any evicted since */
+size_t smoke_x_link_read_buckets(unsigned int device, uint32_t *index,
+                                 uint32_t end, smoke_x_link_bucket_t *out,
+                                 size_t max_len) {
+    size_t len = 0;
+    if (device < SMOKE_X_MAX_DEVICES &&
+        xSemaphoreTake(xLinkMutex, portMAX_DELAY)) {
+        const link_state_t *l = &links[device];
+        if ((int32_t)(*index - (l->next_index - l->count)) < 0) {
+            *index = l->next_index - l->count;
+        }
+        while (len < max_len && (int32_t)(end - *index) > 0 &&
+               (int32_t)(l->next_index - *index) > 0) {
+            out[len++] = l->buckets[*index % LINK_CAPACITY];
+            (*index)++;
+        }
+        if (len < max_len && *index == l->next_index &&
+            (int32_t)(end - *index) > 0 && l->acc.received) {
+            acc_to_bucket(&l->acc, &out[len++]);
+            (*index)++;
+        }
+        xSemaphoreGive(xLinkMutex);
+    }
+    return len;
+}
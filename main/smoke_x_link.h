@@ -0,0 +1,31 @@
+#ifndef SMOKE_X_LINK_H
+#define SMOKE_X_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "smoke_x.h"
+
+typedef struct {
+    uint32_t time;  // start of the period, on the history clock
+    int8_t rssi_min;
+    int8_t rssi_avg;
+    int8_t rssi_max;
+    int8_t snr_avg;
+    uint16_t received;
+    uint16_t missed;
+} smoke_x_link_bucket_t;
+
+esp_err_t smoke_x_link_init();
+void smoke_x_link_clear(unsigned int device);
+void smoke_x_link_update(unsigned int device, int16_t rssi, float snr,
+                         int64_t timestamp, uint32_t now,
+                         uint32_t tx_interval_ms, smoke_x_link_t *p_link);
+void smoke_x_link_rebase(int32_t shift);
+unsigned int smoke_x_link_period();
+void smoke_x_link_range(unsigned int device, uint32_t *oldest,
+                        uint32_t *end);
+size_t smoke_x_link_read_buckets(unsigned int device, uint32_t *index,
+                                 uint32_t end, smoke_x_link_bucket_t *out,
+                                 size_t max_len);
+
+#endif
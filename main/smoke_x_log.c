@@ -0,0 +1,329 @@
+#include <stddef.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include "smoke_x_log.h"
+
+/*
+ * Append-only log of history samples on a dedicated flash partition, used to
+ * rebuild the history after a restart. The partition is a ring of sectors
+ * holding fixed size records, each protected by a CRC. A sector is erased
+ * right before its first record is written, so only the sector holding the
+ * newest record is partially filled and the write position can be found by
+ * comparing the first record of every sector and then bisecting one sector.
+ * Every device numbers its samples separately, so each sector starts with a
+ * header record numbered by the log itself, continuing from the sequence
+ * numbers of sectors written before there were several devices.
+ *
+ * Records are buffered and written in batches to limit flash wear, so a crash
+ * loses at most one batch. Starting a new cook writes a marker record rather
+ * than erasing the partition, and so does moving samples to the wall clock.
+ * The device a record belongs to is kept in the upper bits of its type.
+ */
+
+#define LOG_SECTOR_SIZE SPI_FLASH_SEC_SIZE
+#define LOG_RECORDS_PER_SECTOR (LOG_SECTOR_SIZE / sizeof(log_record_t))
+#define LOG_BATCH_LEN 10
+#define LOG_MAGIC 0x5843
+#define LOG_ERASED 0xFFFF
+// Enough samples to refill the coarsest history tier of every device
+#define LOG_REPLAY_RECORDS (4400 * SMOKE_X_MAX_DEVICES)
+#define LOG_TYPE_MASK 0x0F
+#define LOG_DEVICE_SHIFT 4
+
+typedef enum {
+    LOG_RECORD_SAMPLE = 1,
+    LOG_RECORD_NEW_COOK,
+    LOG_RECORD_CLOCK,  // time is the shift of the samples since the restart
+    LOG_RECORD_SECTOR,  // first record of a sector, seq numbers the sector
+} log_record_type_t;
+
+typedef struct {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t time;
+    int16_t temps[SMOKE_X_MAX_PROBES];
+    uint32_t crc;
+} log_record_t;
+
+static const char *TAG = "smoke_x_log";
+static SemaphoreHandle_t xLogMutex = NULL;
+static const esp_partition_t *partition = NULL;
+static unsigned int num_sectors = 0;
+static unsigned int write_sector = 0;
+static unsigned int write_slot = 0;
+static uint32_t sector_seq = 0;
+static log_record_t batch[LOG_BATCH_LEN];
+static unsigned int batch_len = 0;
+
+static uint32_t record_crc(const log_record_t *record) {
+    return esp_rom_crc32_le(0, (const uint8_t *)record,
+                            offsetof(log_record_t, crc));
+}
+
+static bool record_valid(const log_record_t *record) {
+    return record->magic == LOG_MAGIC && record->crc == record_crc(record);
+}
+
+static esp_err_t read_records(unsigned int sector, unsigned int slot,
+                              log_record_t *records, size_t len) {
+    return esp_partition_read(
+        partition, sector * LOG_SECTOR_SIZE + slot * sizeof(log_record_t),
+        records, len * sizeof(log_record_t));
+}
+
+static bool sector_used(unsigned int sector) {
+    log_record_t record;
+    return read_records(sector, 0, &record, 1) == ESP_OK &&
+           record_valid(&record);
+}
+
+static void fill_record(log_record_t *record, uint8_t type,
+                        const smoke_x_sample_t *sample) {
+    memset(record, 0, sizeof(log_record_t));
+    record->magic = LOG_MAGIC;
+    record->type = type;
+    record->seq = sample->seq;
+    record->time = sample->time;
+    record->flags = sample->flags;
+    memcpy(record->temps, sample->temps, sizeof(record->temps));
+    record->crc = record_crc(record);
+}
+
+static esp_err_t start_sector() {
+    log_record_t header;
+    smoke_x_sample_t marker = {.seq = ++sector_seq};
+    write_sector = (write_sector + 1) % num_sectors;
+    esp_err_t err = esp_partition_erase_range(
+        partition, write_sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE);
+    if (!err) {
+        fill_record(&header, LOG_RECORD_SECTOR, &marker);
+        err = esp_partition_write(partition, write_sector * LOG_SECTOR_SIZE,
+                                  &header, sizeof(header));
+    }
+    write_slot = 1;
+    return err;
+}
+
+static esp_err_t write_batch() {
+    esp_err_t err = ESP_OK;
+    unsigned int i = 0;
+    while (!err && i < batch_len) {
+        if (write_slot == LOG_RECORDS_PER_SECTOR) {
+            err = start_sector();
+            if (err) break;
+        }
+        unsigned int len = batch_len - i;
+        if (len > LOG_RECORDS_PER_SECTOR - write_slot) {
+            len = LOG_RECORDS_PER_SECTOR - write_slot;
+        }
+        err = esp_partition_write(
+            partition,
+            write_sector * LOG_SECTOR_SIZE + write_slot * sizeof(log_record_t),
+            &batch[i], len * sizeof(log_record_t));
+        write_slot += len;
+        i += len;
+    }
+    batch_len = 0;
+    if (err) {
+        ESP_LOGE(TAG, "Failed to write cook log (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t append_record(unsigned int device, log_record_type_t type,
+                               const smoke_x_sample_t *sample, bool flush) {
+    esp_err_t err = ESP_OK;
+    if (!partition) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xSemaphoreTake(xLogMutex, portMAX_DELAY)) {
+        fill_record(&batch[batch_len++], type | device << LOG_DEVICE_SHIFT,
+                    sample);
+        if (flush || batch_len == LOG_BATCH_LEN) {
+            err = write_batch();
+        }
+        xSemaphoreGive(xLogMutex);
+    }
+    return err;
+}
+
+/* Write out buffered records before a software restart */
+static void shutdown_handler() {
+    if (xSemaphoreTake(xLogMutex, pdMS_TO_TICKS(100))) {
+        write_batch();
+        xSemaphoreGive(xLogMutex);
+    }
+}
+
+esp_err_t smoke_x_log_init() {
+    log_record_t record;
+    uint32_t newest_seq = 0;
+    bool found = false;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                         ESP_PARTITION_SUBTYPE_ANY,
+                                         SMOKE_X_LOG_PARTITION);
+    if (!partition) {
+        ESP_LOGW(TAG, "No %s partition, history will not be persisted",
+                 SMOKE_X_LOG_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    xLogMutex = xSemaphoreCreateMutex();
+    if (!xLogMutex) {
+        ESP_LOGE(TAG, "Unable to create log mutex");
+        partition = NULL;
+        return ESP_FAIL;
+    }
+    num_sectors = partition->size / LOG_SECTOR_SIZE;
+
+    // The newest record is in the sector whose first record is newest
+    for (unsigned int i = 0; i < num_sectors; i++) {
+        if (read_records(i, 0, &record, 1) == ESP_OK && record_valid(&record) &&
+            (!found || (int32_t)(record.seq - newest_seq) > 0)) {
+            newest_seq = record.seq;
+            write_sector = i;
+            found = true;
+        }
+    }
+
+    if (found) {
+        sector_seq = newest_seq;
+        // Slots are filled in order, find the first one that is still erased
+        unsigned int lo = 1, hi = LOG_RECORDS_PER_SECTOR;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            if (read_records(write_sector, mid, &record, 1) == ESP_OK &&
+                record.magic == LOG_ERASED) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        write_slot = lo;
+    } else {
+        // Empty log, the first write erases and starts at sector 0
+        sector_seq = 0;
+        write_sector = num_sectors - 1;
+        write_slot = LOG_RECORDS_PER_SECTOR;
+    }
+    esp_register_shutdown_handler(shutdown_handler);
+    ESP_LOGI(TAG, "Cook log has %d sectors, next write to sector %d slot %d",
+             num_sectors, write_sector, write_slot);
+    return ESP_OK;
+}
+
+/*
+ * Replay the tail of the log into the history. A new cook marker clears
+ * whatever was replayed before it.
+ */
+esp_err_t smoke_x_log_restore_history() {
+    unsigned int sector = write_sector;
+    unsigned int num_records = write_slot;
+    unsigned int slot = 0;
+    unsigned int restored[SMOKE_X_MAX_DEVICES] = {0};
+    uint32_t boot_seq[SMOKE_X_MAX_DEVICES] = {0};
+    unsigned int total = 0;
+
+    if (!partition) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!sector_used(write_sector)) {
+        return ESP_OK;
+    }
+
+    // Walk back from the newest sector until enough records are covered
+    while (num_records < LOG_REPLAY_RECORDS) {
+        unsigned int prev = (sector + num_sectors - 1) % num_sectors;
+        if (prev == write_sector || !sector_used(prev)) {
+            break;
+        }
+        sector = prev;
+        num_records += LOG_RECORDS_PER_SECTOR;
+    }
+
+    // Nothing is buffered yet, so the batch buffer can be used for reading
+    while (sector != write_sector || slot < write_slot) {
+        size_t len = LOG_BATCH_LEN;
+        size_t last = sector == write_sector ? write_slot
+                                             : LOG_RECORDS_PER_SECTOR;
+        if (last - slot < len) {
+            len = last - slot;
+        }
+        if (read_records(sector, slot, batch, len) != ESP_OK) {
+            break;
+        }
+        for (size_t i = 0; i < len; i++) {
+            unsigned int type = batch[i].type & LOG_TYPE_MASK;
+            unsigned int d = batch[i].type >> LOG_DEVICE_SHIFT;
+            if (!record_valid(&batch[i]) || d >= SMOKE_X_MAX_DEVICES) {
+                continue;
+            }
+            if (type == LOG_RECORD_NEW_COOK) {
+                smoke_x_history_clear(d);
+                restored[d] = 0;
+            } else if (type == LOG_RECORD_CLOCK) {
+                smoke_x_history_rebase(d, boot_seq[d],
+                                       (int32_t)batch[i].time);
+            } else if (type == LOG_RECORD_SAMPLE) {
+                // The restart may be older than what is replayed
+                if (!restored[d] || batch[i].flags & SMOKE_X_SAMPLE_BOOT) {
+                    boot_seq[d] = batch[i].seq;
+                }
+                smoke_x_sample_t sample = {.seq = batch[i].seq,
+                                           .time = batch[i].time,
+                                           .flags = batch[i].flags};
+                memcpy(sample.temps, batch[i].temps, sizeof(sample.temps));
+                smoke_x_history_restore(d, &sample);
+                restored[d]++;
+            }
+        }
+        slot += len;
+        // A full newest sector ends the replay, it doesn't wrap around
+        if (slot == LOG_RECORDS_PER_SECTOR && sector != write_sector) {
+            sector = (sector + 1) % num_sectors;
+            slot = 0;
+        }
+    }
+    for (unsigned int d = 0; d < SMOKE_X_MAX_DEVICES; d++) {
+        total += restored[d];
+    }
+    ESP_LOGI(TAG, "Restored %d samples from cook log", total);
+    return ESP_OK;
+}
+
+esp_err_t smoke_x_log_append(unsigned int device,
+                             const smoke_x_sample_t *sample) {
+    return append_record(device, LOG_RECORD_SAMPLE, sample, false);
+}
+
+/* Mark the start of a new cook, written through so it survives a restart */
+esp_err_t smoke_x_log_new_cook(unsigned int device, uint32_t next_seq) {
+    smoke_x_sample_t marker = {.seq = next_seq};
+    return append_record(device, LOG_RECORD_NEW_COOK, &marker, true);
+}
+
+/* Record that the samples since the restart were moved by shift seconds */
+esp_err_t smoke_x_log_clock(unsigned int device, uint32_t next_seq,
+                            int32_t shift) {
+    smoke_x_sample_t marker = {.seq = next_seq, .time = (uint32_t)shift};
+    return append_record(device, LOG_RECORD_CLOCK, &marker, false);
+}
+
+esp_err_t smoke_x_log_flush() {
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (partition && xSemaphoreTake(xLogMutex, portMAX_DELAY)) {
+        err = write_batch();
+        xSemaphoreGive(xLogMutex);
+    }
+    return err;
+}
@@ -0,0 +1,17 @@
+#ifndef SMOKE_X_LOG_H
+#define SMOKE_X_LOG_H
+
+#include "smoke_x_history.h"
+
+#define SMOKE_X_LOG_PARTITION "cooklog"
+
+esp_err_t smoke_x_log_init();
+esp_err_t smoke_x_log_restore_history();
+esp_err_t smoke_x_log_append(unsigned int device,
+                             const smoke_x_sample_t *sample);
+esp_err_t smoke_x_log_new_cook(unsigned int device, uint32_t next_seq);
+esp_err_t smoke_x_log_clock(unsigned int device, uint32_t next_seq,
+                            int32_t shift);
+esp_err_t smoke_x_log_flush();
+
+#endif
@@ -0,0 +1,274 @@
+#include <stddef.h>
+#include <string.h>
+#include <esp_log.h>
+#include "smoke_x_msg.h"
+
+/*
+ * Decoder for the comma separated messages sent by the transmitter. The
+ * buffer is scanned once: every field is terminated by a comma and its
+ * integer value is accumulated while the characters go by. Nothing is
+ * allocated and the buffer is left untouched, so it can be decoded straight
+ * from the receive buffer.
+ *
+ * Each message family is described by tables of field descriptors: the
+ * fields ahead of the probes, the fields repeated for every probe and the
+ * fields after them. The family is looked up by its number of fields and one
+ * decoder stores every field as its descriptor says, so supporting another
+ * model or firmware variant only takes new tables.
+ */
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+#define FAMILY_FIELDS(header, probe, num_probes, trailer) \
+    (ARRAY_LEN(header) + (num_probes)*ARRAY_LEN(probe) + ARRAY_LEN(trailer))
+// Large enough for any field the transmitter sends, small enough to not wrap
+#define MSG_INT_MAX 1000000
+
+typedef enum {
+    FIELD_SKIP,
+    FIELD_DEVICE_ID,
+    FIELD_EQUALS,      // bool, true when the value is arg
+    FIELD_NOT_EQUALS,  // bool, true unless the value is arg
+    FIELD_INT16,
+    FIELD_TEMP,  // int16_t deci-degrees, arg is the units sent per degree
+    FIELD_BYTE,  // ORed into an unsigned int as byte number arg
+} msg_field_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t offset;  // In smoke_x_msg_t, or smoke_x_msg_probe_t for probes
+    int16_t arg;
+} msg_field_desc_t;
+
+typedef struct {
+    smoke_x_msg_type_t type;
+    uint8_t num_probes;
+    const msg_field_desc_t *header;
+    uint8_t header_len;
+    const msg_field_desc_t *probe;
+    uint8_t probe_len;
+    const msg_field_desc_t *trailer;
+    uint8_t trailer_len;
+} msg_family_t;
+
+typedef struct {
+    uint8_t start;
+    uint8_t len;
+    bool numeric;
+    int32_t value;
+} msg_field_t;
+
+#define FIELD(kind, member, arg) {kind, offsetof(smoke_x_msg_t, member), arg}
+#define PROBE_FIELD(kind, member, arg) \
+    {kind, offsetof(smoke_x_msg_probe_t, member), arg}
+#define SKIP_FIELD {FIELD_SKIP, 0, 0}
+#define FIELDS(a) a, ARRAY_LEN(a)
+
+/* Example sync message "020001,|dhHWl,160,32,69,54," */
+static const msg_field_desc_t sync_fields[] = {
+    SKIP_FIELD,
+    FIELD(FIELD_DEVICE_ID, device_id, 0),
+    // The frequency is sent one byte at a time, least significant first
+    FIELD(FIELD_BYTE, frequency, 0),
+    FIELD(FIELD_BYTE, frequency, 1),
+    FIELD(FIELD_BYTE, frequency, 2),
+    FIELD(FIELD_BYTE, frequency, 3),
+};
+
+/* Acknowledgement of a sync message "|dhHWl,SUCCESS," */
+static const msg_field_desc_t success_fields[] = {
+    FIELD(FIELD_DEVICE_ID, device_id, 0),
+    SKIP_FIELD,
+};
+
+/* Example X2 state message "|ABC12,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,0," */
+static const msg_field_desc_t state_header[] = {
+    FIELD(FIELD_DEVICE_ID, device_id, 0),
+    SKIP_FIELD,
+    FIELD(FIELD_EQUALS, fahrenheit, 1),
+    FIELD(FIELD_NOT_EQUALS, new_alarm, 0),
+};
+
+static const msg_field_desc_t state_probe[] = {
+    PROBE_FIELD(FIELD_NOT_EQUALS, attached, 3),
+    PROBE_FIELD(FIELD_TEMP, temp, 10),
+    PROBE_FIELD(FIELD_NOT_EQUALS, alarm, 0),
+    PROBE_FIELD(FIELD_INT16, max_temp, 0),
+    PROBE_FIELD(FIELD_INT16, min_temp, 0),
+};
+
+static const msg_field_desc_t state_trailer[] = {
+    FIELD(FIELD_NOT_EQUALS, billows_attached, 0),
+    SKIP_FIELD,
+};
+
+static const msg_family_t sync_family = {
+    .type = SMOKE_X_MSG_SYNC,
+    .header = FIELDS(sync_fields),
+};
+
+static const msg_family_t success_family = {
+    .type = SMOKE_X_MSG_SUCCESS,
+    .header = FIELDS(success_fields),
+};
+
+static const msg_family_t x2_family = {
+    .type = SMOKE_X_MSG_STATE,
+    .num_probes = 2,
+    .header = FIELDS(state_header),
+    .probe = FIELDS(state_probe),
+    .trailer = FIELDS(state_trailer),
+};
+
+static const msg_family_t x4_family = {
+    .type = SMOKE_X_MSG_STATE,
+    .num_probes = 4,
+    .header = FIELDS(state_header),
+    .probe = FIELDS(state_probe),
+    .trailer = FIELDS(state_trailer),
+};
+
+#define MSG_MAX_FIELDS \
+    FAMILY_FIELDS(state_header, state_probe, 4, state_trailer)
+
+/* Families by number of fields, which has to be unique */
+static const msg_family_t *const families[MSG_MAX_FIELDS + 1] = {
+    [ARRAY_LEN(sync_fields)] = &sync_family,
+    [ARRAY_LEN(success_fields)] = &success_family,
+    [FAMILY_FIELDS(state_header, state_probe, 2, state_trailer)] = &x2_family,
+    [FAMILY_FIELDS(state_header, state_probe, 4, state_trailer)] = &x4_family,
+};
+
+static const char *TAG = "smoke_x_msg";
+
+/* Split buf into fields, returns the number found or -1 if there are more */
+static int scan_fields(const char *buf, size_t len, msg_field_t *fields) {
+    int num_fields = 0;
+    size_t start = 0;
+    int32_t value = 0;
+    bool negative = false;
+    bool numeric = true;
+
+    // Field offsets are stored in a byte, as is the radio packet length
+    if (len > UINT8_MAX) {
+        len = UINT8_MAX;
+    }
+    for (size_t i = 0; i < len && buf[i]; i++) {
+        char c = buf[i];
+        if (c == ',') {
+            if (num_fields == MSG_MAX_FIELDS) {
+                return -1;
+            }
+            msg_field_t *field = &fields[num_fields++];
+            field->start = start;
+            field->len = i - start;
+            field->numeric = numeric && i > start + negative;
+            field->value = negative ? -value : value;
+            start = i + 1;
+            value = 0;
+            negative = false;
+            numeric = true;
+        } else if (c >= '0' && c <= '9') {
+            if (value < MSG_INT_MAX) {
+                value = value * 10 + (c - '0');
+            } else {
+                numeric = false;
+            }
+        } else if (c == '-' && i == start) {
+            negative = true;
+        } else {
+            numeric = false;
+        }
+    }
+    return num_fields;
+}
+
+static esp_err_t check_int(const msg_field_t *field, int index, int32_t value,
+                           int32_t min, int32_t max) {
+    if (!field->numeric) {
+        ESP_LOGW(TAG, "Field %d is %s", index,
+                 field->len ? "not a number" : "empty");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (value < min || value > max) {
+        ESP_LOGW(TAG, "Field %d out of range: %d", index, field->value);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+/* Store a field in the message or probe at base as its descriptor says */
+static esp_err_t decode_field(const char *buf, const msg_field_t *field,
+                              int index, const msg_field_desc_t *desc,
+                              uint8_t *base) {
+    esp_err_t err = ESP_OK;
+    void *dest = base + desc->offset;
+    int32_t value = field->value;
+
+    switch (desc->kind) {
+        case FIELD_SKIP:
+            break;
+        case FIELD_DEVICE_ID:
+            if (field->len == 0 || field->len >= SMOKE_X_DEVICE_ID_LEN) {
+                ESP_LOGW(TAG, "Invalid device ID length: %d", field->len);
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(dest, &buf[field->start], field->len);
+            ((char *)dest)[field->len] = '\0';
+            break;
+        case FIELD_EQUALS:
+        case FIELD_NOT_EQUALS:
+            err = check_int(field, index, value, INT32_MIN, INT32_MAX);
+            *(bool *)dest =
+                (value == desc->arg) == (desc->kind == FIELD_EQUALS);
+            break;
+        case FIELD_TEMP:
+            value = value * 10 / desc->arg;
+            // Fall through
+        case FIELD_INT16:
+            err = check_int(field, index, value, INT16_MIN, INT16_MAX);
+            *(int16_t *)dest = value;
+            break;
+        case FIELD_BYTE:
+            err = check_int(field, index, value, 0, UINT8_MAX);
+            *(unsigned int *)dest |= (unsigned int)value << (8 * desc->arg);
+            break;
+    }
+    return err;
+}
+
+static esp_err_t decode_fields(const char *buf, const msg_field_t *fields,
+                               int *index, const msg_field_desc_t *descs,
+                               uint8_t len, void *base) {
+    esp_err_t err = ESP_OK;
+    for (uint8_t i = 0; !err && i < len; i++, (*index)++) {
+        err = decode_field(buf, &fields[*index], *index, &descs[i], base);
+    }
+    return err;
+}
+
+esp_err_t smoke_x_msg_parse(const char *buf, size_t len, smoke_x_msg_t *msg) {
+    msg_field_t fields[MSG_MAX_FIELDS];
+    int num_fields = scan_fields(buf, len, fields);
+    const msg_family_t *family = num_fields >= 0 ? families[num_fields] : NULL;
+    int index = 0;
+    esp_err_t err;
+
+    memset(msg, 0, sizeof(smoke_x_msg_t));
+    if (!family) {
+        ESP_LOGW(TAG, "Unexpected number of fields: %d", num_fields);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    msg->type = family->type;
+    msg->num_probes = family->num_probes;
+    err = decode_fields(buf, fields, &index, family->header,
+                        family->header_len, msg);
+    for (unsigned int i = 0; !err && i < family->num_probes; i++) {
+        err = decode_fields(buf, fields, &index, family->probe,
+                            family->probe_len, &msg->probes[i]);
+    }
+    if (!err) {
+        err = decode_fields(buf, fields, &index, family->trailer,
+                            family->trailer_len, msg);
+    }
+    return err;
+}
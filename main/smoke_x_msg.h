@@ -0,0 +1,39 @@
+#ifndef SMOKE_X_MSG_H
+#define SMOKE_X_MSG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "smoke_x.h"
+
+typedef enum {
+    SMOKE_X_MSG_SYNC,
+    SMOKE_X_MSG_SUCCESS,
+    SMOKE_X_MSG_STATE,
+} smoke_x_msg_type_t;
+
+typedef struct {
+    bool attached;
+    int16_t temp;  // deci-degrees
+    bool alarm;
+    int16_t max_temp;  // billows target on the last probe with a billows
+    int16_t min_temp;
+} smoke_x_msg_probe_t;
+
+typedef struct {
+    smoke_x_msg_type_t type;
+    char device_id[SMOKE_X_DEVICE_ID_LEN];
+    // Sync messages
+    unsigned int frequency;
+    // State messages
+    unsigned int num_probes;
+    bool fahrenheit;
+    bool new_alarm;
+    bool billows_attached;
+    smoke_x_msg_probe_t probes[SMOKE_X_MAX_PROBES];
+} smoke_x_msg_t;
+
+esp_err_t smoke_x_msg_parse(const char *buf, size_t len, smoke_x_msg_t *msg);
+
+#endif
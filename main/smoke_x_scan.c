@@ -0,0 +1,72 @@
+#include <string.h>
+#include "smoke_x_scan.h"
+
+/*
+ * Pairing scanner policy. The transmitter sends its sync messages on one of
+ * a few known frequencies, depending on the model. Rather than waiting on
+ * each of them in turn, the radio hops between them looking for a LoRa
+ * preamble with channel activity detection, which only takes a couple of
+ * symbols, and dwells on a frequency only when one is detected.
+ *
+ * Hopping has to visit every frequency within a preamble (about 40 ms at the
+ * Smoke X settings) to never miss a sync message. Each hop still listens
+ * for a while after its check, so that the scan sleeps between checks
+ * rather than spinning on the radio: with 2 frequencies a check on either
+ * starts every 2 x (8 ms CAD + 8 ms), and ends within a preamble of the
+ * last one. A frequency that keeps showing activity without the
+ * sync message being received is most likely some other LoRa device, so it
+ * is left after a few dwells.
+ *
+ * The policy only decides where to listen and for how long, so it can be
+ * driven by any radio, real or simulated.
+ */
+
+// Long enough to receive a sync message once its preamble is detected
+#define SCAN_DWELL_MS 1500
+#define SCAN_MAX_DWELLS 4
+// After a check that found nothing, before hopping to the next frequency
+#define SCAN_HOP_MS 8
+// Without channel activity detection, listen long enough for a sync burst
+#define SCAN_BLIND_DWELL_MS 3300
+
+static void next_frequency(smoke_x_scan_t *scan) {
+    scan->index = (scan->index + 1) % scan->num_freqs;
+    scan->dwells = 0;
+}
+
+void smoke_x_scan_init(smoke_x_scan_t *scan, const uint32_t *freqs,
+                       unsigned int num_freqs, bool cad) {
+    memset(scan, 0, sizeof(smoke_x_scan_t));
+    if (num_freqs > SMOKE_X_SCAN_MAX_FREQS) {
+        num_freqs = SMOKE_X_SCAN_MAX_FREQS;
+    }
+    memcpy(scan->freqs, freqs, num_freqs * sizeof(uint32_t));
+    scan->num_freqs = num_freqs;
+    scan->cad = cad;
+}
+
+/* Frequency to tune to, and with CAD check, for the next step */
+uint32_t smoke_x_scan_frequency(const smoke_x_scan_t *scan) {
+    return scan->num_freqs ? scan->freqs[scan->index] : 0;
+}
+
+/* Account the result of a step, returns the ms to listen before the next */
+uint32_t smoke_x_scan_update(smoke_x_scan_t *scan, bool detected) {
+    if (!scan->num_freqs) {
+        return SCAN_BLIND_DWELL_MS;
+    }
+    if (!scan->cad) {
+        next_frequency(scan);
+        return SCAN_BLIND_DWELL_MS;
+    }
+    scan->checks++;
+    if (detected) {
+        scan->detections++;
+        if (scan->dwells < SCAN_MAX_DWELLS) {
+            scan->dwells++;
+            return SCAN_DWELL_MS;
+        }
+    }
+    next_frequency(scan);
+    return SCAN_HOP_MS;
+}
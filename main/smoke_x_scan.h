@@ -0,0 +1,24 @@
+#ifndef SMOKE_X_SCAN_H
+#define SMOKE_X_SCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SMOKE_X_SCAN_MAX_FREQS 4
+
+typedef struct {
+    uint32_t freqs[SMOKE_X_SCAN_MAX_FREQS];
+    unsigned int num_freqs;
+    bool cad;  // Whether the radio can detect channel activity
+    unsigned int index;
+    unsigned int dwells;  // Consecutive dwells on freqs[index]
+    uint32_t checks;
+    uint32_t detections;
+} smoke_x_scan_t;
+
+void smoke_x_scan_init(smoke_x_scan_t *scan, const uint32_t *freqs,
+                       unsigned int num_freqs, bool cad);
+uint32_t smoke_x_scan_frequency(const smoke_x_scan_t *scan);
+uint32_t smoke_x_scan_update(smoke_x_scan_t *scan, bool detected);
+
+#endif
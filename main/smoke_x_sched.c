@@ -0,0 +1,150 @@
+#include <string.h>
+#include "smoke_x_sched.h"
+
+/*
+ * Receive schedule policy for several transmitters on different frequencies.
+ * A transmitter sends its state at a fixed interval, so once two packets
+ * have been received the next one can be predicted, and the radio only has
+ * to be on its frequency for a short window around that time. The interval
+ * is learned from the gaps between packets, which also covers transmitters
+ * whose crystal runs a little fast or slow.
+ *
+ * A transmitter whose cadence isn't known yet, or that was missed too many
+ * times in a row, is hunted for by listening on its frequency whenever no
+ * window is open. Several of them take turns, each for a little longer than
+ * the interval so that every turn can catch a packet.
+ *
+ * Like the pairing scanner, the policy only decides where to listen and for
+ * how long, with times in ms of any monotonic clock.
+ */
+
+// Tune in this long before a packet is expected, and wait this long after
+#define SCHED_LEAD_MS 1000
+#define SCHED_LATE_MS 1500
+// Then the transmitter has probably drifted or was turned off
+#define SCHED_MAX_MISSES 6
+#define SCHED_HUNT_MS (SMOKE_X_TX_INTERVAL * 1000 + SCHED_LATE_MS)
+// Poll at least this often, in case pairing starts
+#define SCHED_IDLE_MS 1000
+// Fraction of the error in the predicted interval corrected per packet
+#define SCHED_INTERVAL_WEIGHT 4
+// Learn nothing from gaps of more packets, they say little about the drift
+#define SCHED_MAX_LEARN_GAP 4
+
+static bool hunting(const smoke_x_sched_device_t *dev) {
+    return dev->frequency && !dev->next_expected;
+}
+
+void smoke_x_sched_init(smoke_x_sched_t *sched) {
+    memset(sched, 0, sizeof(smoke_x_sched_t));
+}
+
+/* Start scheduling a device on frequency, or stop with 0 */
+void smoke_x_sched_set_device(smoke_x_sched_t *sched, unsigned int device,
+                              uint32_t frequency) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return;
+    }
+    smoke_x_sched_device_t *dev = &sched->devices[device];
+    memset(dev, 0, sizeof(smoke_x_sched_device_t));
+    dev->frequency = frequency;
+    dev->interval = SMOKE_X_TX_INTERVAL * 1000;
+}
+
+void smoke_x_sched_received(smoke_x_sched_t *sched, unsigned int device,
+                            int64_t now) {
+    if (device >= SMOKE_X_MAX_DEVICES) {
+        return;
+    }
+    smoke_x_sched_device_t *dev = &sched->devices[device];
+    if (dev->last_rx) {
+        int64_t delta = now - dev->last_rx;
+        int64_t n = (delta + dev->interval / 2) / dev->interval;
+        if (n == 0) {
+            // Duplicate, the cadence stays anchored on the first copy
+            return;
+        }
+        if (n <= SCHED_MAX_LEARN_GAP) {
+            int32_t error = (int32_t)(delta / n) - (int32_t)dev->interval;
+            // A larger error is more likely a restart than drift
+            if (error > -(int32_t)dev->interval / 8 &&
+                error < (int32_t)dev->interval / 8) {
+                dev->interval += error / SCHED_INTERVAL_WEIGHT;
+            }
+        }
+    }
+    if (dev->next_expected) {
+        dev->expected++;
+        dev->caught++;
+    }
+    dev->misses = 0;
+    dev->last_rx = now;
+    dev->next_expected = now + dev->interval;
+}
+
+/*
+ * Pick the device to listen for at now and how long to listen before asking
+ * again, or return -1 if the radio isn't needed until then.
+ */
+int smoke_x_sched_next(smoke_x_sched_t *sched, int64_t now,
+                       uint32_t *wait_ms) {
+    int best = -1;
+    int64_t until = now + SCHED_IDLE_MS;
+
+    for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+        smoke_x_sched_device_t *dev = &sched->devices[i];
+        if (!dev->frequency || !dev->next_expected) {
+            continue;
+        }
+        while (now > dev->next_expected + SCHED_LATE_MS) {
+            dev->expected++;
+            dev->misses++;
+            dev->next_expected += dev->interval;
+        }
+        if (dev->misses >= SCHED_MAX_MISSES) {
+            dev->misses = 0;
+            dev->next_expected = 0;
+            continue;
+        }
+        if (now >= dev->next_expected - SCHED_LEAD_MS) {
+            // Of overlapping windows, the earliest packet goes first
+            if (best < 0 ||
+                dev->next_expected < sched->devices[best].next_expected) {
+                best = i;
+            }
+        } else if (dev->next_expected - SCHED_LEAD_MS < until) {
+            until = dev->next_expected - SCHED_LEAD_MS;
+        }
+    }
+    if (best >= 0) {
+        until = sched->devices[best].next_expected + SCHED_LATE_MS;
+    } else {
+        for (unsigned int i = 0; i < SMOKE_X_MAX_DEVICES; i++) {
+            if (hunting(&sched->devices[i])) {
+                best = i;
+                break;
+            }
+        }
+        if (best >= 0) {
+            if (now >= sched->hunt_until ||
+                !hunting(&sched->devices[sched->hunt_index])) {
+                // Next device's turn
+                for (unsigned int i = 1; i <= SMOKE_X_MAX_DEVICES; i++) {
+                    unsigned int j = (sched->hunt_index + i) %
+                                     SMOKE_X_MAX_DEVICES;
+                    if (hunting(&sched->devices[j])) {
+                        sched->hunt_index = j;
+                        break;
+                    }
+                }
+                sched->hunt_until = now + SCHED_HUNT_MS;
+            }
+            best = sched->hunt_index;
+            if (sched->hunt_until < until) {
+                until = sched->hunt_until;
+            }
+        }
+    }
+    *wait_ms = until > now ? (uint32_t)(until - now) : 1;
+    return best;
+}
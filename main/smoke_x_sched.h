@@ -0,0 +1,33 @@
+#ifndef SMOKE_X_SCHED_H
+#define SMOKE_X_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "smoke_x.h"
+
+typedef struct {
+    uint32_t frequency;     // 0 if the slot isn't paired
+    uint32_t interval;      // ms between transmissions, as learned
+    int64_t last_rx;        // ms of the last packet, 0 before the first one
+    int64_t next_expected;  // ms of the next packet, 0 until its cadence is
+                            // known and while it is hunted for
+    uint32_t expected;      // packets due since the cadence was known
+    uint32_t caught;        // of which were received
+    unsigned int misses;    // consecutive
+} smoke_x_sched_device_t;
+
+typedef struct {
+    smoke_x_sched_device_t devices[SMOKE_X_MAX_DEVICES];
+    unsigned int hunt_index;
+    int64_t hunt_until;
+} smoke_x_sched_t;
+
+void smoke_x_sched_init(smoke_x_sched_t *sched);
+void smoke_x_sched_set_device(smoke_x_sched_t *sched, unsigned int device,
+                              uint32_t frequency);
+void smoke_x_sched_received(smoke_x_sched_t *sched, unsigned int device,
+                            int64_t now);
+int smoke_x_sched_next(smoke_x_sched_t *sched, int64_t now,
+                       uint32_t *wait_ms);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <esp_event.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "app_radio_sim.h"
+#include "bench.h"
+#include "capture.h"
+#include "smoke_x.h"
+#include "smoke_x_history.h"
+#include "smoke_x_log.h"
+
+/*
+ * Size and serialization time of the /data document, JSON against CBOR.
+ * The device is paired by replaying the start of a capture through the
+ * simulated radio, then its history is refilled with the capture's states,
+ * 30 s apart, and serialized the way /data streams it.
+ *
+ * usage: data_bench [capture] [samples]
+ */
+
+#define MAX_PACKETS 2048
+#define DEFAULT_SAMPLES 1200
+#define INTERVAL_S 30
+#define RUNS 200
+#define STATE_TIMEOUT_MS 2000
+
+typedef struct {
+    const char *name;
+    smoke_x_data_query_t query;
+} data_case_t;
+
+static capture_packet_t packets[MAX_PACKETS];
+static smoke_x_state_t states[MAX_PACKETS];
+static unsigned int num_states = 0;
+static SemaphoreHandle_t xStateReceived = NULL;
+
+static void smoke_x_event_handler(void *arg, esp_event_base_t base, int32_t id,
+                                  void *data) {
+    if (id == SMOKE_X_EVENT_STATE_MSG_RECEIVED) {
+        xSemaphoreGive(xStateReceived);
+    }
+}
+
+/* Replay packets until the device is paired and a state has been received */
+static bool pair(int loaded) {
+    uint32_t last_ms = 0;
+    for (int i = 0; i < loaded; i++) {
+        const capture_packet_t *p = &packets[i];
+        shim_time_advance((int64_t)(p->time_ms - last_ms) * 1000);
+        last_ms = p->time_ms;
+        app_radio_sim_inject((const uint8_t *)p->payload, p->len, p->rssi,
+                             p->snr);
+        if (smoke_x_is_paired(0) &&
+            xSemaphoreTake(xStateReceived, pdMS_TO_TICKS(STATE_TIMEOUT_MS))) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return false;
+}
+
+/* Counts the bytes of the document, as the HTTP chunks would */
+static esp_err_t count_bytes(void *ctx, const char *buf, size_t len) {
+    *(size_t *)ctx += len;
+    return ESP_OK;
+}
+
+static int compare_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Bytes of the document and the median time to serialize it */
+static void bench_case(const data_case_t *c, size_t *bytes, double *us) {
+    static int64_t ns[RUNS];
+    for (unsigned int run = 0; run < RUNS; run++) {
+        int64_t start = bench_now_ns();
+        *bytes = 0;
+        smoke_x_write_data(&c->query, count_bytes, bytes);
+        ns[run] = bench_now_ns() - start;
+    }
+    qsort(ns, RUNS, sizeof(ns[0]), compare_i64);
+    *us = ns[RUNS / 2] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_CAPTURE;
+    unsigned int samples = argc > 2 ? atoi(argv[2]) : DEFAULT_SAMPLES;
+    int loaded = capture_load(path, packets, MAX_PACKETS);
+    const data_case_t cases[] = {
+        {"full history", {.device = 0}},
+        {"max_points 200", {.device = 0, .max_points = 200}},
+        {"resolution 300", {.device = 0, .resolution = 300}},
+    };
+
+    for (int i = 0; i < loaded; i++) {
+        if (capture_state(&packets[i], &states[num_states])) {
+            num_states++;
+        }
+    }
+    if (!num_states) {
+        fprintf(stderr, "No states in %s\n", path);
+        return 1;
+    }
+    xStateReceived = xSemaphoreCreateBinary();
+    shim_partition_add(SMOKE_X_LOG_PARTITION, 0x100000);
+    esp_event_loop_create_default();
+    esp_event_handler_register(SMOKE_X_EVENT, ESP_EVENT_ANY_ID,
+                               smoke_x_event_handler, NULL);
+    if (smoke_x_init() != ESP_OK || smoke_x_start() != ESP_OK) {
+        fprintf(stderr, "smoke_x failed to start\n");
+        return 1;
+    }
+    // Receiving once the tune task has started
+    vTaskDelay(pdMS_TO_TICKS(100));
+    if (!pair(loaded)) {
+        fprintf(stderr, "Unable to pair with %s\n", path);
+        return 1;
+    }
+    smoke_x_history_clear(0);
+    for (unsigned int n = 0; n < samples; n++) {
+        shim_time_advance(INTERVAL_S * 1000000LL);
+        smoke_x_history_append(0, &states[n % num_states], NULL);
+    }
+
+    printf("%u X%u samples from %s, median of %d runs\n\n",
+           smoke_x_history_count(0), states[0].num_probes, path, RUNS);
+    printf("%-16s %10s %10s %10s %10s %8s\n", "", "JSON B", "CBOR B", "JSON us",
+           "CBOR us", "size");
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        data_case_t c = cases[i];
+        size_t json_bytes, cbor_bytes;
+        double json_us, cbor_us;
+        c.query.format = SMOKE_X_DATA_JSON;
+        bench_case(&c, &json_bytes, &json_us);
+        c.query.format = SMOKE_X_DATA_CBOR;
+        bench_case(&c, &cbor_bytes, &cbor_us);
+        printf("%-16s %10zu %10zu %10.1f %10.1f %7.1f%%\n", c.name, json_bytes,
+               cbor_bytes, json_us, cbor_us, 100.0 * cbor_bytes / json_bytes);
+        if (!json_bytes || !cbor_bytes) {
+            return 1;
+        }
+    }
+    return 0;
+}
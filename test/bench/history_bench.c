@@ -0,0 +1,159 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "bench.h"
+#include "capture.h"
+#include "smoke_x_history.h"
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+/*
+ * Memory and time per history sample, for the probe temperatures of a
+ * capture appended over and over, 30 s apart:
+ *
+ * - cJSON: the history as it was kept before smoke_x_history.c, an array of
+ *   cJSON numbers per probe capped at 1200 samples. Only built with cJSON.
+ * - smoke_x_history: the compressed blocks of raw samples, which also feed
+ *   the min/max/avg tiers on every append. Run a second time with every
+ *   probe moving by up to a degree on every sample, as noisy probes do,
+ *   which is the worst case for its delta encoding.
+ *
+ * usage: history_bench [capture] [samples]
+ */
+
+#define MAX_PACKETS 2048
+#define DEFAULT_SAMPLES 100000
+#define INTERVAL_S 30
+// The raw sample blocks of one device in smoke_x_history.c: NUM_BLOCKS
+// blocks of sizeof(block_t), without the tiers
+#define HISTORY_BLOCKS_SIZE (64 * 256)
+// A sample as smoke_x_sample_t stores it, before compression
+#define RAW_SAMPLE_SIZE (4 + 2 * SMOKE_X_MAX_PROBES)
+
+static capture_packet_t packets[MAX_PACKETS];
+static smoke_x_state_t states[MAX_PACKETS];
+static unsigned int num_states = 0;
+
+static void print_result(const char *name, double bytes, double append_ns,
+                         double read_ns) {
+    printf("%-16s %14.1f %14.1f", name, bytes, append_ns);
+    if (read_ns >= 0) {
+        printf(" %14.1f", read_ns);
+    }
+    printf("\n");
+}
+
+#ifdef HAVE_CJSON
+#define CJSON_MAX_RECORDS 1200
+
+static void bench_cjson(unsigned int samples) {
+    cJSON *history[SMOKE_X_MAX_PROBES];
+    size_t heap = shim_heap_used();
+    unsigned int num_probes = states[0].num_probes;
+    int64_t start = 0;
+    double bytes = 0;
+
+    for (unsigned int i = 0; i < num_probes; i++) {
+        history[i] = cJSON_CreateArray();
+    }
+    for (unsigned int n = 0; n < samples; n++) {
+        const smoke_x_state_t *state = &states[n % num_states];
+        if (n == CJSON_MAX_RECORDS) {
+            // Full, every append evicts from now on
+            bytes = (double)(shim_heap_used() - heap) / CJSON_MAX_RECORDS;
+            start = bench_now_ns();
+        }
+        for (unsigned int i = 0; i < num_probes; i++) {
+            if (cJSON_GetArraySize(history[0]) >= CJSON_MAX_RECORDS) {
+                cJSON_DeleteItemFromArray(history[i], 0);
+            }
+            cJSON_AddItemToArray(history[i],
+                                 cJSON_CreateNumber(state->probes[i].temp));
+        }
+    }
+    print_result("cJSON", bytes,
+                 (double)(bench_now_ns() - start) /
+                     (samples - CJSON_MAX_RECORDS),
+                 -1);
+    for (unsigned int i = 0; i < num_probes; i++) {
+        cJSON_Delete(history[i]);
+    }
+}
+#endif
+
+/* Probes jittering by up to +/- 1 degree, never twice the same */
+static void add_noise(smoke_x_state_t *state, unsigned int n) {
+    for (unsigned int i = 0; i < state->num_probes; i++) {
+        state->probes[i].temp += ((n * 7919 + i * 104729) % 21 - 10) / 10.0;
+    }
+}
+
+static void bench_history(const char *name, unsigned int samples,
+                          bool noisy) {
+    static smoke_x_bucket_t out[MAX_PACKETS * 8];
+    uint32_t oldest, end, index;
+    unsigned int retained;
+    int64_t start;
+    size_t read = 0;
+
+    smoke_x_history_init();
+    start = bench_now_ns();
+    for (unsigned int n = 0; n < samples; n++) {
+        smoke_x_state_t state = states[n % num_states];
+        if (noisy) {
+            add_noise(&state, n);
+        }
+        shim_time_advance(INTERVAL_S * 1000000LL);
+        smoke_x_history_append(0, &state, NULL);
+    }
+    double append_ns = (double)(bench_now_ns() - start) / samples;
+    retained = smoke_x_history_count(0);
+
+    // Decoding every retained sample of every probe, as /data does
+    smoke_x_history_tier_range(0, 0, &oldest, &end);
+    start = bench_now_ns();
+    for (unsigned int probe = 0; probe < states[0].num_probes; probe++) {
+        index = oldest;
+        while (index != end) {
+            read += smoke_x_history_read_buckets(0, 0, probe, &index, end, 1,
+                                                 out, NULL,
+                                                 sizeof(out) / sizeof(out[0]));
+        }
+    }
+    print_result(name, (double)HISTORY_BLOCKS_SIZE / retained, append_ns,
+                 (double)(bench_now_ns() - start) / retained);
+    printf("  %u samples retained, %.1f h at %d s, %.1f%% of %d bytes per "
+           "raw sample, %zu temperatures read\n",
+           retained, retained * INTERVAL_S / 3600.0, INTERVAL_S,
+           100.0 * HISTORY_BLOCKS_SIZE / retained / RAW_SAMPLE_SIZE,
+           RAW_SAMPLE_SIZE, read);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_CAPTURE;
+    unsigned int samples = argc > 2 ? atoi(argv[2]) : DEFAULT_SAMPLES;
+    int loaded = capture_load(path, packets, MAX_PACKETS);
+
+    for (int i = 0; i < loaded; i++) {
+        if (capture_state(&packets[i], &states[num_states])) {
+            num_states++;
+        }
+    }
+    if (!num_states) {
+        fprintf(stderr, "No states in %s\n", path);
+        return 1;
+    }
+    printf("%u X%u states from %s, %u samples\n\n", num_states,
+           states[0].num_probes, path, samples);
+    printf("%-16s %14s %14s %14s\n", "", "bytes/sample", "append ns",
+           "read ns");
+#ifdef HAVE_CJSON
+    bench_cjson(samples);
+#endif
+    bench_history("smoke_x_history", samples, false);
+    bench_history("noisy probes", samples, true);
+    return 0;
+}
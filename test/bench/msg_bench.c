@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_system.h>
+#include "bench.h"
+#include "capture.h"
+#include "smoke_x_msg.h"
+
+/*
+ * Time to decode the packets of a capture with smoke_x_msg_parse(), against
+ * the strtok() and atoi() parser it replaced. The legacy parser is the one
+ * of smoke_x.c before smoke_x_msg.c, less its side effects: it duplicates
+ * the message, classifies it by its number of commas and tokenizes it.
+ *
+ * usage: msg_bench [capture] [rounds]
+ */
+
+#define MAX_PACKETS 2048
+#define DEFAULT_ROUNDS 2000
+#define LEGACY_COMMAS_SYNC 6
+#define LEGACY_COMMAS_X2 16
+#define LEGACY_COMMAS_X4 26
+
+/* smoke_x_state_t and smoke_x_config_t as the legacy parser filled them */
+typedef struct {
+    bool attached;
+    double temp;
+    bool alarm;
+    int max_temp;
+    int min_temp;
+} legacy_probe_t;
+
+typedef struct {
+    char device_id[SMOKE_X_DEVICE_ID_LEN];
+    unsigned int frequency;
+    unsigned int num_probes;
+    char *units;
+    bool new_alarm;
+    bool billows_attached;
+    legacy_probe_t probes[SMOKE_X_MAX_PROBES];
+} legacy_msg_t;
+
+static capture_packet_t packets[MAX_PACKETS];
+
+static unsigned int count_commas(const char *msg, const int len) {
+    unsigned int result = 0;
+    for (int i = 0; i < len; i++) {
+        if (msg[i] == ',') result++;
+    }
+    return result;
+}
+
+static void legacy_sync_msg(const char *msg, legacy_msg_t *out) {
+    unsigned char freq_array[4];
+    char *tmp = strdup(msg);
+    strtok(tmp, ",");
+    strncpy(out->device_id, strtok(NULL, ","), SMOKE_X_DEVICE_ID_LEN);
+    for (int i = 0; i < 4; i++) {
+        freq_array[i] = (char)atoi(strtok(NULL, ","));
+    }
+    free(tmp);
+    memcpy(&out->frequency, freq_array, sizeof(freq_array));
+}
+
+static void legacy_state_msg(const char *msg, legacy_msg_t *state) {
+    char *tmp = strdup(msg);
+    strtok(tmp, ",");   // Not using device ID
+    strtok(NULL, ",");  // Not using unknown field
+    state->units = atoi(strtok(NULL, ",")) == 1 ? "°F" : "°C";
+    state->new_alarm = atoi(strtok(NULL, ","));
+    for (unsigned int i = 0; i < state->num_probes; i++) {
+        state->probes[i].attached = atoi(strtok(NULL, ",")) == 3 ? false : true;
+        state->probes[i].temp = atof(strtok(NULL, ",")) / 10.0;
+        state->probes[i].alarm = atoi(strtok(NULL, ","));
+        state->probes[i].max_temp = atoi(strtok(NULL, ","));
+        state->probes[i].min_temp = atoi(strtok(NULL, ","));
+    }
+    state->billows_attached = atoi(strtok(NULL, ","));
+    strtok(NULL, ",");  // Not using unknown field
+    free(tmp);
+}
+
+/* The payload is NUL terminated, as it was by the legacy receive path */
+static bool legacy_parse(const char *msg, int len, legacy_msg_t *out) {
+    switch (count_commas(msg, len)) {
+        case LEGACY_COMMAS_SYNC:
+            legacy_sync_msg(msg, out);
+            return true;
+        case LEGACY_COMMAS_X2:
+            out->num_probes = 2;
+            legacy_state_msg(msg, out);
+            return true;
+        case LEGACY_COMMAS_X4:
+            out->num_probes = 4;
+            legacy_state_msg(msg, out);
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_CAPTURE;
+    unsigned int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    int loaded = capture_load(path, packets, MAX_PACKETS);
+    unsigned int parsed = 0, legacy_parsed = 0;
+    size_t allocs, legacy_allocs;
+    int64_t start;
+    double ns, legacy_ns;
+
+    if (loaded <= 0) {
+        fprintf(stderr, "No packets in %s\n", path);
+        return 1;
+    }
+    allocs = shim_heap_allocs();
+    start = bench_now_ns();
+    for (unsigned int r = 0; r < rounds; r++) {
+        for (int i = 0; i < loaded; i++) {
+            smoke_x_msg_t msg;
+            parsed += smoke_x_msg_parse(packets[i].payload, packets[i].len,
+                                        &msg) == ESP_OK;
+        }
+    }
+    ns = (double)(bench_now_ns() - start) / ((double)rounds * loaded);
+    allocs = shim_heap_allocs() - allocs;
+
+    legacy_allocs = shim_heap_allocs();
+    start = bench_now_ns();
+    for (unsigned int r = 0; r < rounds; r++) {
+        for (int i = 0; i < loaded; i++) {
+            legacy_msg_t msg = {0};
+            legacy_parsed +=
+                legacy_parse(packets[i].payload, packets[i].len, &msg);
+        }
+    }
+    legacy_ns = (double)(bench_now_ns() - start) / ((double)rounds * loaded);
+    legacy_allocs = shim_heap_allocs() - legacy_allocs;
+
+    printf("%d packets from %s, %u rounds\n\n", loaded, path, rounds);
+    printf("%-20s %10s %10s %10s\n", "", "ns/packet", "allocs", "decoded");
+    printf("%-20s %10.1f %10.2f %10u\n", "smoke_x_msg_parse", ns,
+           (double)allocs / rounds / loaded, parsed / rounds);
+    printf("%-20s %10.1f %10.2f %10u\n", "strtok/atoi", legacy_ns,
+           (double)legacy_allocs / rounds / loaded, legacy_parsed / rounds);
+    return parsed / rounds == (unsigned int)loaded ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "app_lora.h"
+#include "app_radio_sim.h"
+#include "bench.h"
+
+/*
+ * CPU used by the app_lora radio task while nothing is received, and the
+ * time from a packet arriving to the receive callback, with the simulated
+ * modem's receive done line wired and without it. Unwired, the radio task
+ * polls the modem every tick, as it did before it waited on the interrupt.
+ * Each case runs in a process of its own, app_lora can only start once.
+ *
+ * usage: radio_bench [packets]
+ */
+
+#define DEFAULT_PACKETS 500
+#define IDLE_MS 2000
+// Packets arrive at random within the polling period
+#define PACKET_GAP_MAX_US 20000
+#define PACKET_TIMEOUT_MS 1000
+
+static SemaphoreHandle_t xReceived = NULL;
+static int64_t injected_ns;
+static uint32_t *latency_ns;
+static unsigned int num_received = 0;
+
+static void on_rx(const app_lora_frame_t *frame) {
+    latency_ns[num_received++] = bench_now_ns() - injected_ns;
+    xSemaphoreGive(xReceived);
+}
+
+static int64_t cpu_ns() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(unsigned int percent) {
+    unsigned int i = (num_received - 1) * percent / 100;
+    return latency_ns[i] / 1000.0;
+}
+
+static int run(bool wired, unsigned int packets) {
+    const char payload[] = "|dhHWl,0,1,0,0,848,0,225,0,0,457,0,203,0,0,487,0,"
+                           "195,0,3,0,0,0,0,1,0,";
+    app_radio_sim_stats_t stats;
+    uint32_t reads;
+    int64_t start, cpu;
+
+    latency_ns = calloc(packets, sizeof(uint32_t));
+    xReceived = xSemaphoreCreateBinary();
+    app_radio_sim_set_rx_done_wired(wired);
+    if (app_lora_init() != ESP_OK || app_lora_start_rx(on_rx) != ESP_OK) {
+        return 1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    app_radio_sim_get_stats(&stats);
+    reads = stats.reads;
+    start = bench_now_ns();
+    cpu = cpu_ns();
+    vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+    cpu = cpu_ns() - cpu;
+    double idle_s = (bench_now_ns() - start) / 1e9;
+    app_radio_sim_get_stats(&stats);
+    reads = stats.reads - reads;
+
+    for (unsigned int i = 0; i < packets; i++) {
+        injected_ns = bench_now_ns();
+        app_radio_sim_inject((const uint8_t *)payload, strlen(payload), -80, 7);
+        if (!xSemaphoreTake(xReceived, pdMS_TO_TICKS(PACKET_TIMEOUT_MS))) {
+            fprintf(stderr, "Packet %u never received\n", i);
+            return 1;
+        }
+        usleep(1000 + rand() % PACKET_GAP_MAX_US);
+    }
+    qsort(latency_ns, num_received, sizeof(uint32_t), compare_u32);
+    printf("%-10s %10.3f %10.1f %10.1f %10.1f %10.1f\n",
+           wired ? "interrupt" : "polling", 100.0 * cpu / 1e9 / idle_s,
+           reads / idle_s, percentile_us(50), percentile_us(99),
+           latency_ns[num_received - 1] / 1000.0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned int packets = argc > 1 ? atoi(argv[1]) : DEFAULT_PACKETS;
+    const bool cases[] = {false, true};
+    int status, failed = 0;
+
+    printf("Idle for %d ms, then %u packets 1 to %d ms apart\n\n", IDLE_MS,
+           packets, 1 + PACKET_GAP_MAX_US / 1000);
+    printf("%-10s %10s %10s %10s %10s %10s\n", "", "idle CPU %", "reads/s",
+           "p50 us", "p99 us", "max us");
+    fflush(stdout);
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            exit(run(cases[i], packets));
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status)) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "smoke_x_msg.h"
+
+int capture_load(const char *path, capture_packet_t *packets, size_t max) {
+    char line[CAPTURE_PAYLOAD_MAX + 64];
+    size_t n = 0;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (n < max && fgets(line, sizeof(line), f)) {
+        capture_packet_t *p = &packets[n];
+        int rssi;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "%u %d %f %255s", &p->time_ms, &rssi, &p->snr,
+                   p->payload) != 4) {
+            fprintf(stderr, "Bad capture line: %s", line);
+            fclose(f);
+            return -1;
+        }
+        p->rssi = rssi;
+        p->len = strlen(p->payload);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+bool capture_state(const capture_packet_t *packet, smoke_x_state_t *state) {
+    smoke_x_msg_t msg;
+    if (smoke_x_msg_parse(packet->payload, packet->len, &msg) != ESP_OK ||
+        msg.type != SMOKE_X_MSG_STATE) {
+        return false;
+    }
+    memset(state, 0, sizeof(*state));
+    state->num_probes = msg.num_probes;
+    state->units = msg.fahrenheit ? "°F" : "°C";
+    state->new_alarm = msg.new_alarm;
+    state->billows_attached = msg.billows_attached;
+    for (unsigned int i = 0; i < msg.num_probes; i++) {
+        state->probes[i].attached = msg.probes[i].attached;
+        state->probes[i].temp = msg.probes[i].temp / 10.0;
+        state->probes[i].alarm = msg.probes[i].alarm;
+        state->probes[i].max_temp = msg.probes[i].max_temp;
+        state->probes[i].min_temp = msg.probes[i].min_temp;
+    }
+    state->time = packet->time_ms / 1000;
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "smoke_x.h"
+
+/*
+ * Captures of packets as received, one per line:
+ *   <ms since start> <rssi dBm> <snr dB> <payload>
+ * Lines starting with '#' are comments.
+ */
+
+#define CAPTURE_PAYLOAD_MAX 256
+
+typedef struct {
+    uint32_t time_ms;
+    int16_t rssi;
+    float snr;
+    char payload[CAPTURE_PAYLOAD_MAX];
+    size_t len;
+} capture_packet_t;
+
+/* Number of packets read into packets, or -1 if the file can't be read */
+int capture_load(const char *path, capture_packet_t *packets, size_t max);
+
+/* The state a state message decodes to, as smoke_x keeps it */
+bool capture_state(const capture_packet_t *packet, smoke_x_state_t *state);
+
+#endif
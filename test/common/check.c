@@ -0,0 +1,12 @@
+#include "check.h"
+
+unsigned int check_failed = 0;
+
+int check_failures(const char *name) {
+    if (check_failed) {
+        fprintf(stderr, "%s: %u checks failed\n", name, check_failed);
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/*
+ * Checks that report where they failed and carry on, so that one run shows
+ * every failure. Test programs return check_failures() from main().
+ */
+
+extern unsigned int check_failed;
+
+#define CHECK(cond)                                                    \
+    do {                                                               \
+        if (!(cond)) {                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,     \
+                    __LINE__, #cond);                                  \
+            check_failed++;                                            \
+        }                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                 \
+    do {                                                               \
+        long long _a = (a), _b = (b);                                  \
+        if (_a != _b) {                                                \
+            fprintf(stderr, "%s:%d: %s == %s failed, %lld != %lld\n",  \
+                    __FILE__, __LINE__, #a, #b, _a, _b);               \
+            check_failed++;                                            \
+        }                                                              \
+    } while (0)
+
+int check_failures(const char *name);
+
+#endif
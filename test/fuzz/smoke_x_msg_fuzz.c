@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include "smoke_x_msg.h"
+
+/*
+ * libFuzzer target for smoke_x_msg_parse(), the first thing to touch a
+ * packet off the air. The input is copied to a buffer of exactly its size
+ * and not terminated, so reading past len is caught by ASan. Whatever is
+ * accepted has to be a message the rest of smoke_x can use as is.
+ */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static bool quiet = false;
+    smoke_x_msg_t msg;
+    char *buf = malloc(size ? size : 1);
+
+    if (!quiet) {
+        esp_log_level_set("smoke_x_msg", ESP_LOG_NONE);
+        quiet = true;
+    }
+    memcpy(buf, data, size);
+    if (smoke_x_msg_parse(buf, size, &msg) == ESP_OK) {
+        size_t id_len = strnlen(msg.device_id, SMOKE_X_DEVICE_ID_LEN);
+        if (id_len == 0 || id_len == SMOKE_X_DEVICE_ID_LEN ||
+            memchr(msg.device_id, ',', id_len)) {
+            abort();
+        }
+        switch (msg.type) {
+            case SMOKE_X_MSG_SYNC:
+            case SMOKE_X_MSG_SUCCESS:
+                if (msg.num_probes) {
+                    abort();
+                }
+                break;
+            case SMOKE_X_MSG_STATE:
+                if (msg.num_probes != 2 && msg.num_probes != 4) {
+                    abort();
+                }
+                break;
+            default:
+                abort();
+        }
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Runs a libFuzzer target without libFuzzer, for compilers that don't have
+ * it: every file of the corpus directories, then mutations of them. The
+ * mutations are random but repeatable, seeded with -seed=. Build it with
+ * -fsanitize=address,undefined for the checks libFuzzer would have made.
+ *
+ * usage: <target> [-runs=N] [-seed=N] corpus_dir...
+ */
+
+#define MAX_INPUTS 256
+#define MAX_INPUT_LEN 512
+#define DEFAULT_RUNS 100000
+#define MAX_MUTATIONS 8
+
+typedef struct {
+    uint8_t data[MAX_INPUT_LEN];
+    size_t len;
+} input_t;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static input_t inputs[MAX_INPUTS];
+static unsigned int num_inputs = 0;
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void load_dir(const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    char file_path[1024];
+
+    if (!dir) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        exit(1);
+    }
+    while ((entry = readdir(dir)) && num_inputs < MAX_INPUTS) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        FILE *f = fopen(file_path, "rb");
+        if (f) {
+            input_t *input = &inputs[num_inputs++];
+            input->len = fread(input->data, 1, MAX_INPUT_LEN, f);
+            fclose(f);
+        }
+    }
+    closedir(dir);
+}
+
+/* Characters the message format is made of, most mutations use them */
+static uint8_t random_char() {
+    static const char chars[] = "0123456789,,,,--|";
+    return next_random() % 4 ? chars[next_random() % (sizeof(chars) - 1)]
+                             : next_random();
+}
+
+static void mutate(input_t *input) {
+    size_t pos = input->len ? next_random() % input->len : 0;
+    switch (next_random() % 6) {
+        case 0:  // Replace a byte
+            if (input->len) {
+                input->data[pos] = random_char();
+            }
+            break;
+        case 1:  // Insert a byte
+            if (input->len < MAX_INPUT_LEN) {
+                memmove(&input->data[pos + 1], &input->data[pos],
+                        input->len - pos);
+                input->data[pos] = random_char();
+                input->len++;
+            }
+            break;
+        case 2:  // Delete a byte
+            if (input->len) {
+                memmove(&input->data[pos], &input->data[pos + 1],
+                        input->len - pos - 1);
+                input->len--;
+            }
+            break;
+        case 3:  // Truncate
+            input->len = pos;
+            break;
+        case 4:  // Run of digits, to overflow a field
+            for (unsigned int n = next_random() % 24;
+                 n && input->len < MAX_INPUT_LEN; n--) {
+                memmove(&input->data[pos + 1], &input->data[pos],
+                        input->len - pos);
+                input->data[pos] = '0' + next_random() % 10;
+                input->len++;
+            }
+            break;
+        case 5: {  // Splice in the tail of another input
+            const input_t *other = &inputs[next_random() % num_inputs];
+            size_t from = other->len ? next_random() % other->len : 0;
+            size_t len = other->len - from;
+            if (pos + len > MAX_INPUT_LEN) {
+                len = MAX_INPUT_LEN - pos;
+            }
+            memcpy(&input->data[pos], &other->data[from], len);
+            input->len = pos + len;
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long runs = DEFAULT_RUNS;
+    input_t input;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "-runs=", 6)) {
+            runs = strtoul(argv[i] + 6, NULL, 10);
+        } else if (!strncmp(argv[i], "-seed=", 6)) {
+            rng_state = strtoul(argv[i] + 6, NULL, 10);
+            rng_state = rng_state ? rng_state : 1;
+        } else {
+            load_dir(argv[i]);
+        }
+    }
+    if (!num_inputs) {
+        fprintf(stderr, "No corpus\n");
+        return 1;
+    }
+    for (unsigned int i = 0; i < num_inputs; i++) {
+        LLVMFuzzerTestOneInput(inputs[i].data, inputs[i].len);
+    }
+    for (unsigned long run = 0; run < runs; run++) {
+        input = inputs[next_random() % num_inputs];
+        for (unsigned int n = next_random() % MAX_MUTATIONS + 1; n; n--) {
+            mutate(&input);
+        }
+        LLVMFuzzerTestOneInput(input.data, input.len);
+    }
+    printf("%u corpus inputs and %lu mutations run\n", num_inputs, runs);
+    return 0;
+}
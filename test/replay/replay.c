@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_event.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "app_lora.h"
+#include "app_mqtt_json.h"
+#include "app_radio_sim.h"
+#include "bench.h"
+#include "capture.h"
+#include "smoke_x.h"
+#include "smoke_x_history.h"
+#include "smoke_x_link.h"
+#include "smoke_x_log.h"
+#include "smoke_x_msg.h"
+#include "smoke_x_sched.h"
+#ifdef HAVE_APP_MQTT
+#include <mqtt_client.h>
+#include "app_mqtt.h"
+#endif
+
+/*
+ * Replays a capture of timestamped packets through the receive path as it
+ * runs on the device: injected into the simulated radio, read by the
+ * app_lora radio task, decoded by its decode task into smoke_x, and the
+ * state event handled on the event loop by app_mqtt, or by the state
+ * serializer alone when app_mqtt isn't built.
+ *
+ * The capture is replayed twice. Paced, one packet at a time with the clock
+ * moved forward to each packet's time, to measure the latency of every
+ * stage. Then saturated, with several packets in flight, for the number of
+ * packets per second the path sustains. Stages are timed by wrapping the
+ * functions handle_rx() calls, see CMakeLists.txt, and percentiles are
+ * computed from every sample.
+ *
+ * usage: replay [capture] [saturated repeats]
+ */
+
+#define MAX_PACKETS 2048
+#define SATURATED_IN_FLIGHT 4
+#define DEFAULT_REPEATS 20
+#define PACKET_TIMEOUT_MS 2000
+
+typedef enum {
+    STAGE_QUEUE,  // Injected until handle_rx() starts
+    STAGE_PARSE,
+    STAGE_HISTORY,
+    STAGE_LOG,
+    STAGE_LINK,
+    STAGE_SCHED,
+    STAGE_POST,
+    STAGE_RX,       // handle_rx() as a whole
+    STAGE_PUBLISH,  // The state event on the event loop
+    STAGE_TOTAL,    // Injected until published
+    NUM_STAGES,
+} stage_t;
+
+typedef struct {
+    uint32_t *ns;
+    size_t count;
+} samples_t;
+
+static const char *stage_names[NUM_STAGES] = {
+    "queue", "parse",   "history", "log",     "link",
+    "sched", "post",    "handle_rx", "publish", "total"};
+
+static capture_packet_t packets[MAX_PACKETS];
+static unsigned int num_packets = 0;
+static samples_t samples[NUM_STAGES];
+static size_t max_samples = 0;
+static SemaphoreHandle_t xSamplesMutex = NULL;
+static SemaphoreHandle_t xHandled = NULL;
+static volatile bool record = false;
+static int64_t injected_ns[MAX_PACKETS];
+static unsigned int num_handled = 0;
+static unsigned int num_published = 0;
+static __thread bool in_rx = false;
+static app_lora_rx_cb_t handle_rx = NULL;
+#ifdef HAVE_APP_MQTT
+// The first discovery, rendering the messages
+static int64_t discovery_ns = 0;
+static size_t discovery_allocs = 0;
+#endif
+
+static void add_sample(stage_t stage, int64_t ns) {
+    samples_t *s = &samples[stage];
+    if (!record) {
+        return;
+    }
+    xSemaphoreTake(xSamplesMutex, portMAX_DELAY);
+    if (s->count < max_samples) {
+        s->ns[s->count++] = ns;
+    }
+    xSemaphoreGive(xSamplesMutex);
+}
+
+/* Straight from the C library, the harness's memory isn't the firmware's */
+void *__real_malloc(size_t size);
+
+static void alloc_samples(size_t max) {
+    max_samples = max;
+    for (unsigned int i = 0; i < NUM_STAGES; i++) {
+        samples[i].ns = __real_malloc(max * sizeof(uint32_t));
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile, the samples have to be sorted */
+static double percentile_us(const samples_t *s, unsigned int percent) {
+    size_t rank = (s->count * percent + 99) / 100;
+    return s->ns[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static void print_stages(const char *title) {
+    printf("\n%s, latency in us\n", title);
+    printf("%-10s %7s %9s %9s %9s %9s\n", "stage", "n", "p50", "p90", "p99",
+           "max");
+    for (unsigned int i = 0; i < NUM_STAGES; i++) {
+        samples_t *s = &samples[i];
+        if (!s->count) {
+            continue;
+        }
+        qsort(s->ns, s->count, sizeof(uint32_t), compare_u32);
+        printf("%-10s %7zu %9.1f %9.1f %9.1f %9.1f\n", stage_names[i],
+               s->count, percentile_us(s, 50), percentile_us(s, 90),
+               percentile_us(s, 99), s->ns[s->count - 1] / 1000.0);
+    }
+}
+
+static void clear_stages() {
+    for (unsigned int i = 0; i < NUM_STAGES; i++) {
+        samples[i].count = 0;
+    }
+}
+
+/* The stages handle_rx() goes through, timed by wrapping them */
+
+esp_err_t __real_smoke_x_msg_parse(const char *buf, size_t len,
+                                   smoke_x_msg_t *msg);
+esp_err_t __wrap_smoke_x_msg_parse(const char *buf, size_t len,
+                                   smoke_x_msg_t *msg) {
+    int64_t start = bench_now_ns();
+    esp_err_t err = __real_smoke_x_msg_parse(buf, len, msg);
+    add_sample(STAGE_PARSE, bench_now_ns() - start);
+    return err;
+}
+
+void __real_smoke_x_history_append(unsigned int device,
+                                   const smoke_x_state_t *state,
+                                   smoke_x_sample_t *out_sample);
+void __wrap_smoke_x_history_append(unsigned int device,
+                                   const smoke_x_state_t *state,
+                                   smoke_x_sample_t *out_sample) {
+    int64_t start = bench_now_ns();
+    __real_smoke_x_history_append(device, state, out_sample);
+    add_sample(STAGE_HISTORY, bench_now_ns() - start);
+}
+
+esp_err_t __real_smoke_x_log_append(unsigned int device,
+                                    const smoke_x_sample_t *sample);
+esp_err_t __wrap_smoke_x_log_append(unsigned int device,
+                                    const smoke_x_sample_t *sample) {
+    int64_t start = bench_now_ns();
+    esp_err_t err = __real_smoke_x_log_append(device, sample);
+    add_sample(STAGE_LOG, bench_now_ns() - start);
+    return err;
+}
+
+void __real_smoke_x_link_update(unsigned int device, int16_t rssi, float snr,
+                                int64_t timestamp, uint32_t now,
+                                uint32_t tx_interval_ms,
+                                smoke_x_link_t *p_link);
+void __wrap_smoke_x_link_update(unsigned int device, int16_t rssi, float snr,
+                                int64_t timestamp, uint32_t now,
+                                uint32_t tx_interval_ms,
+                                smoke_x_link_t *p_link) {
+    int64_t start = bench_now_ns();
+    __real_smoke_x_link_update(device, rssi, snr, timestamp, now,
+                               tx_interval_ms, p_link);
+    add_sample(STAGE_LINK, bench_now_ns() - start);
+}
+
+void __real_smoke_x_sched_received(smoke_x_sched_t *sched,
+                                   unsigned int device, int64_t now);
+void __wrap_smoke_x_sched_received(smoke_x_sched_t *sched,
+                                   unsigned int device, int64_t now) {
+    int64_t start = bench_now_ns();
+    __real_smoke_x_sched_received(sched, device, now);
+    add_sample(STAGE_SCHED, bench_now_ns() - start);
+}
+
+esp_err_t __real_esp_event_post(esp_event_base_t base, int32_t id,
+                                const void *data, size_t size,
+                                TickType_t ticks);
+esp_err_t __wrap_esp_event_post(esp_event_base_t base, int32_t id,
+                                const void *data, size_t size,
+                                TickType_t ticks) {
+    int64_t start = bench_now_ns();
+    esp_err_t err = __real_esp_event_post(base, id, data, size, ticks);
+    if (in_rx) {
+        add_sample(STAGE_POST, bench_now_ns() - start);
+    }
+    return err;
+}
+
+/* Runs on the decode task in place of handle_rx() */
+static void timed_rx(const app_lora_frame_t *frame) {
+    int64_t start = bench_now_ns();
+    unsigned int n = num_handled;
+    add_sample(STAGE_QUEUE, start - injected_ns[n % MAX_PACKETS]);
+    in_rx = true;
+    handle_rx(frame);
+    in_rx = false;
+    add_sample(STAGE_RX, bench_now_ns() - start);
+    xSemaphoreTake(xSamplesMutex, portMAX_DELAY);
+    num_handled++;
+    xSemaphoreGive(xSamplesMutex);
+    xSemaphoreGive(xHandled);
+}
+
+int __real_app_lora_start_rx(app_lora_rx_cb_t cb);
+int __wrap_app_lora_start_rx(app_lora_rx_cb_t cb) {
+    handle_rx = cb;
+    return __real_app_lora_start_rx(timed_rx);
+}
+
+static void publish_state(unsigned int device) {
+#ifdef HAVE_APP_MQTT
+    app_mqtt_publish_state(device);
+#else
+    char buf[1024];
+    smoke_x_state_t state;
+    if (smoke_x_get_state(device, &state) == ESP_OK) {
+        app_mqtt_json_state(&state, buf, sizeof(buf));
+    }
+#endif
+}
+
+static void smoke_x_event_handler(void *arg, esp_event_base_t base, int32_t id,
+                                  void *data) {
+    int64_t start = bench_now_ns();
+    switch (id) {
+        case SMOKE_X_EVENT_STATE_MSG_RECEIVED:
+            publish_state(*(int *)data);
+            add_sample(STAGE_PUBLISH, bench_now_ns() - start);
+            num_published++;
+            break;
+#ifdef HAVE_APP_MQTT
+        case SMOKE_X_EVENT_DISCOVERY_REQUIRED: {
+            size_t allocs = shim_heap_allocs();
+            app_mqtt_publish_discovery();
+            if (!discovery_ns) {
+                discovery_ns = bench_now_ns() - start;
+                discovery_allocs = shim_heap_allocs() - allocs;
+            }
+            break;
+        }
+#endif
+    }
+}
+
+/* Inject a packet, the clock first moved forward to its time if paced */
+static void inject(unsigned int n, const capture_packet_t *p) {
+    injected_ns[n % MAX_PACKETS] = bench_now_ns();
+    app_radio_sim_inject((const uint8_t *)p->payload, p->len, p->rssi, p->snr);
+}
+
+/* Wait until n packets have gone through handle_rx() */
+static bool wait_handled(unsigned int n) {
+    while (num_handled < n) {
+        if (!xSemaphoreTake(xHandled, pdMS_TO_TICKS(PACKET_TIMEOUT_MS))) {
+            app_radio_sim_stats_t sim_stats;
+            app_lora_rx_stats_t rx_stats;
+            app_radio_sim_get_stats(&sim_stats);
+            app_lora_get_rx_stats(&rx_stats);
+            fprintf(stderr,
+                    "Packet %u was never handled, %u injected, %u lost, "
+                    "%u received by app_lora\n",
+                    num_handled, sim_stats.injected, sim_stats.lost,
+                    rx_stats.received);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool replay_paced() {
+    uint32_t last_ms = 0;
+    int64_t start;
+    for (unsigned int i = 0; i < num_packets; i++) {
+        const capture_packet_t *p = &packets[i];
+        shim_time_advance((int64_t)(p->time_ms - last_ms) * 1000);
+        last_ms = p->time_ms;
+        unsigned int handled = num_handled, published = num_published;
+        start = bench_now_ns();
+        inject(handled, p);
+        if (!wait_handled(handled + 1)) {
+            return false;
+        }
+        shim_event_flush();
+        if (num_published != published) {
+            add_sample(STAGE_TOTAL, bench_now_ns() - start);
+        }
+    }
+    return true;
+}
+
+static bool replay_saturated(unsigned int repeats, double *packets_per_s) {
+    unsigned int total = repeats * num_packets;
+    unsigned int first = num_handled;
+    int64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < total; i++) {
+        // Stay clear of the radio and receive queues, they would drop packets
+        if (!wait_handled(first + i + 1 > SATURATED_IN_FLIGHT
+                              ? first + i + 1 - SATURATED_IN_FLIGHT
+                              : first)) {
+            return false;
+        }
+        inject(first + i, &packets[i % num_packets]);
+    }
+    if (!wait_handled(first + total)) {
+        return false;
+    }
+    shim_event_flush();
+    *packets_per_s = total / ((bench_now_ns() - start) / 1e9);
+    return true;
+}
+
+#ifdef HAVE_APP_MQTT
+/* Configured as from the web UI, with the default publish policy */
+static void start_mqtt() {
+    app_mqtt_params_t params = {
+        .uri = "mqtt://loopback",
+        .identity = "",
+        .username = "",
+        .password = "",
+        .ca_cert = "",
+        .enabled = true,
+        .ha_discovery = true,
+        .ha_base_topic = "homeassistant",
+        .ha_status_topic = "homeassistant/status",
+        .ha_birth_payload = "online",
+        .state_topic = "homeassistant/smoke-x/state",
+        // The settings the README suggests, the defaults publish every change
+        .deadband = 1.0,
+        .min_interval = 60,
+        .max_interval = 300,
+    };
+    app_mqtt_set_params(&params);
+}
+#endif
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_CAPTURE;
+    unsigned int repeats = argc > 2 ? atoi(argv[2]) : DEFAULT_REPEATS;
+    double packets_per_s = 0;
+    size_t heap_init, heap_peak, allocs;
+    app_radio_sim_stats_t sim_stats;
+    app_lora_rx_stats_t rx_stats;
+    int loaded = capture_load(path, packets, MAX_PACKETS);
+
+    if (loaded <= 0) {
+        return 1;
+    }
+    num_packets = loaded;
+    // Room for every stage of every packet, and the few extra posts
+    alloc_samples((repeats + 1) * num_packets + 16);
+    xSamplesMutex = xSemaphoreCreateMutex();
+    xHandled = xSemaphoreCreateCounting(MAX_PACKETS, 0);
+    shim_partition_add(SMOKE_X_LOG_PARTITION, 0x100000);
+    shim_partition_add("mqttlog", 0x40000);
+
+    // Started as app_main() starts it
+    esp_event_loop_create_default();
+    esp_event_handler_register(SMOKE_X_EVENT, ESP_EVENT_ANY_ID,
+                               smoke_x_event_handler, NULL);
+#ifdef HAVE_APP_MQTT
+    start_mqtt();
+#endif
+    if (smoke_x_init() != ESP_OK || smoke_x_start() != ESP_OK) {
+        fprintf(stderr, "smoke_x failed to start\n");
+        return 1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+    shim_event_flush();
+    heap_init = shim_heap_used();
+    shim_heap_reset_peak();
+    allocs = shim_heap_allocs();
+
+    record = true;
+    if (!replay_paced()) {
+        return 1;
+    }
+#ifdef HAVE_APP_MQTT
+    shim_mqtt_stats_t paced_stats;
+    shim_mqtt_get_stats(&paced_stats);
+#endif
+    printf("Replayed %u packets from %s spanning %.1f h\n", num_packets, path,
+           packets[num_packets - 1].time_ms / 3600000.0);
+    printf("%u states published, device %s\n", num_published,
+           smoke_x_is_paired(0) ? "paired" : "NOT paired");
+#ifdef HAVE_APP_MQTT
+    printf("MQTT while paced: %u messages, %u bytes\n", paced_stats.published,
+           paced_stats.bytes);
+#endif
+    print_stages("Paced, one packet at a time");
+
+    clear_stages();
+    if (!replay_saturated(repeats, &packets_per_s)) {
+        return 1;
+    }
+    print_stages("Saturated");
+    printf("\nSaturated: %u packets, %.0f packets/s\n", repeats * num_packets,
+           packets_per_s);
+
+    heap_peak = shim_heap_peak();
+    printf("Heap: %zu bytes in use after init, high water mark %zu bytes "
+           "(+%zu), %zu allocations while replaying\n",
+           heap_init, heap_peak, heap_peak - heap_init,
+           shim_heap_allocs() - allocs);
+    app_radio_sim_get_stats(&sim_stats);
+    app_lora_get_rx_stats(&rx_stats);
+    printf("Radio: %u injected, %u lost, %u overflowed, %u dropped by the "
+           "receive queue, at most %u queued\n",
+           sim_stats.injected, sim_stats.lost, sim_stats.overflowed,
+           rx_stats.dropped, rx_stats.max_queued);
+#ifdef HAVE_APP_MQTT
+    shim_mqtt_stats_t mqtt_stats, discovery_stats;
+    shim_mqtt_get_stats(&mqtt_stats);
+    printf("MQTT: %u messages, %u bytes\n", mqtt_stats.published,
+           mqtt_stats.bytes);
+    // Published again from the cache, the key hasn't changed
+    allocs = shim_heap_allocs();
+    int64_t start = bench_now_ns();
+    app_mqtt_publish_discovery();
+    int64_t cached_ns = bench_now_ns() - start;
+    shim_mqtt_get_stats(&discovery_stats);
+    printf("Discovery: %u messages, %u bytes, rendered in %.1f us with %zu "
+           "allocations, from the cache in %.1f us with %zu\n",
+           discovery_stats.published - mqtt_stats.published,
+           discovery_stats.bytes - mqtt_stats.bytes, discovery_ns / 1000.0,
+           discovery_allocs, cached_ns / 1000.0, shim_heap_allocs() - allocs);
+#endif
+    if (!smoke_x_is_paired(0) || !num_published || sim_stats.lost ||
+        rx_stats.dropped) {
+        fprintf(stderr, "Not every packet made it through\n");
+        return 1;
+    }
+    return 0;
+}
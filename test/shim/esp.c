@@ -0,0 +1,354 @@
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define MAX_LOG_TAGS 32
+#define MAX_SHUTDOWN_HANDLERS 8
+#define MAX_EVENT_HANDLERS 32
+#define EVENT_QUEUE_LEN 32
+#define EVENT_DATA_MAX 64
+
+typedef struct {
+    const char *tag;
+    esp_log_level_t level;
+} log_tag_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} event_handler_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    size_t size;
+    uint8_t data[EVENT_DATA_MAX];
+    SemaphoreHandle_t flushed;  // Not an event, signaled once reached
+} event_t;
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_tag_t log_tags[MAX_LOG_TAGS];
+static unsigned int num_log_tags = 0;
+static int default_level = -1;
+
+static atomic_llong time_offset_us = 0;
+static int64_t start_us = 0;
+
+static shutdown_handler_t shutdown_handlers[MAX_SHUTDOWN_HANDLERS];
+static unsigned int num_shutdown_handlers = 0;
+
+static atomic_size_t heap_used = 0;
+static atomic_size_t heap_peak = 0;
+static atomic_size_t heap_allocs = 0;
+
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static event_handler_t event_handlers[MAX_EVENT_HANDLERS];
+static unsigned int num_event_handlers = 0;
+static QueueHandle_t xEventQueue = NULL;
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:
+            return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:
+            return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND:
+            return "ESP_ERR_NVS_NOT_FOUND";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+static esp_log_level_t tag_level(const char *tag) {
+    if (default_level < 0) {
+        const char *env = getenv("ESP_LOG_LEVEL");
+        default_level = env ? atoi(env) : CONFIG_LOG_DEFAULT_LEVEL;
+    }
+    for (unsigned int i = 0; i < num_log_tags; i++) {
+        if (!strcmp(log_tags[i].tag, tag)) {
+            return log_tags[i].level;
+        }
+    }
+    return default_level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    pthread_mutex_lock(&log_lock);
+    if (!strcmp(tag, "*")) {
+        default_level = level;
+        num_log_tags = 0;
+    } else if (num_log_tags < MAX_LOG_TAGS) {
+        log_tags[num_log_tags].tag = tag;
+        log_tags[num_log_tags++].level = level;
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+    static const char letters[] = "NEWIDV";
+    va_list args;
+    pthread_mutex_lock(&log_lock);
+    if (level <= tag_level(tag)) {
+        fprintf(stderr, "%c (%lld) %s: ", letters[level],
+                (long long)esp_timer_get_time() / 1000, tag);
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+        fputc('\n', stderr);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time() {
+    if (!start_us) {
+        start_us = monotonic_us();
+    }
+    return monotonic_us() - start_us + time_offset_us;
+}
+
+void shim_time_advance(int64_t us) { time_offset_us += us; }
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    for (unsigned int i = 0; i < num_shutdown_handlers; i++) {
+        if (shutdown_handlers[i] == handle) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    if (num_shutdown_handlers == MAX_SHUTDOWN_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    shutdown_handlers[num_shutdown_handlers++] = handle;
+    return ESP_OK;
+}
+
+void shim_shutdown() {
+    for (unsigned int i = num_shutdown_handlers; i > 0; i--) {
+        shutdown_handlers[i - 1]();
+    }
+}
+
+void esp_restart() {
+    shim_shutdown();
+    exit(0);
+}
+
+uint32_t esp_random() { return random(); }
+
+/*
+ * Allocations by code linked with -Wl,--wrap=malloc and friends are counted
+ * here. The real allocator's usable size is what gets counted, so that frees
+ * balance without a header of our own.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void heap_add(void *ptr) {
+    size_t used;
+    if (!ptr) {
+        return;
+    }
+    used = heap_used += malloc_usable_size(ptr);
+    heap_allocs++;
+    size_t peak = heap_peak;
+    while (used > peak && !atomic_compare_exchange_weak(&heap_peak, &peak,
+                                                        used)) {
+    }
+}
+
+static void heap_remove(void *ptr) {
+    if (ptr) {
+        heap_used -= malloc_usable_size(ptr);
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    void *ptr = __real_calloc(num, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    void *new_ptr;
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    new_ptr = __real_realloc(ptr, size);
+    if (new_ptr || !size) {
+        heap_used -= old_size;
+        heap_add(new_ptr);
+    }
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr) {
+    heap_remove(ptr);
+    __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = __wrap_malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+size_t shim_heap_used() { return heap_used; }
+
+size_t shim_heap_peak() { return heap_peak; }
+
+size_t shim_heap_allocs() { return heap_allocs; }
+
+void shim_heap_reset_peak() { heap_peak = (size_t)heap_used; }
+
+uint32_t esp_get_free_heap_size() { return SHIM_HEAP_SIZE - heap_used; }
+
+uint32_t esp_get_minimum_free_heap_size() {
+    return SHIM_HEAP_SIZE - heap_peak;
+}
+
+size_t xPortGetFreeHeapSize() { return esp_get_free_heap_size(); }
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void event_task(void *pvParameter) {
+    event_t event;
+    event_handler_t handlers[MAX_EVENT_HANDLERS];
+    unsigned int num_handlers;
+    while (1) {
+        xQueueReceive(xEventQueue, &event, portMAX_DELAY);
+        if (event.flushed) {
+            xSemaphoreGive(event.flushed);
+            continue;
+        }
+        pthread_mutex_lock(&event_lock);
+        num_handlers = num_event_handlers;
+        memcpy(handlers, event_handlers, sizeof(handlers));
+        pthread_mutex_unlock(&event_lock);
+        for (unsigned int i = 0; i < num_handlers; i++) {
+            event_handler_t *h = &handlers[i];
+            if ((h->base == ESP_EVENT_ANY_BASE || h->base == event.base) &&
+                (h->id == ESP_EVENT_ANY_ID || h->id == event.id)) {
+                h->handler(h->arg, event.base, event.id,
+                           event.size ? event.data : NULL);
+            }
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default() {
+    if (xEventQueue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xEventQueue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(event_t));
+    xTaskCreate(&event_task, "sys_evt", 2304, NULL, 20, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id,
+                                     esp_event_handler_t handler, void *arg) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+    pthread_mutex_lock(&event_lock);
+    if (num_event_handlers < MAX_EVENT_HANDLERS) {
+        event_handlers[num_event_handlers++] =
+            (event_handler_t){base, id, handler, arg};
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&event_lock);
+    return err;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t base, int32_t id,
+                                       esp_event_handler_t handler) {
+    pthread_mutex_lock(&event_lock);
+    for (unsigned int i = 0; i < num_event_handlers; i++) {
+        event_handler_t *h = &event_handlers[i];
+        if (h->base == base && h->id == id && h->handler == handler) {
+            memmove(h, h + 1, (--num_event_handlers - i) * sizeof(*h));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data,
+                         size_t size, TickType_t ticks) {
+    event_t event = {.base = base, .id = id, .size = size};
+    if (!xEventQueue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (size > EVENT_DATA_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (size) {
+        memcpy(event.data, data, size);
+    }
+    return xQueueSend(xEventQueue, &event, ticks) == pdTRUE ? ESP_OK
+                                                          : ESP_ERR_TIMEOUT;
+}
+
+void shim_event_flush() {
+    static SemaphoreHandle_t xFlushed = NULL;
+    event_t event;
+    pthread_mutex_lock(&event_lock);
+    if (!xFlushed) {
+        xFlushed = xSemaphoreCreateBinary();
+    }
+    pthread_mutex_unlock(&event_lock);
+    event = (event_t){.flushed = xFlushed};
+    xQueueSend(xEventQueue, &event, portMAX_DELAY);
+    xSemaphoreTake(xFlushed, portMAX_DELAY);
+}
@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "esp_partition.h"
+
+#define MAX_PARTITIONS 4
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t *flash;
+    uint32_t erases;
+    uint32_t bytes_written;
+} sim_partition_t;
+
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_partition_t partitions[MAX_PARTITIONS];
+static unsigned int num_partitions = 0;
+static uint32_t next_address = 0x110000;
+static long power_budget = -1;  // Bytes left to write, -1 for unlimited
+static bool powered_off = false;
+
+static sim_partition_t *find(const esp_partition_t *partition) {
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        if (&partitions[i].partition == partition) {
+            return &partitions[i];
+        }
+    }
+    return NULL;
+}
+
+static bool in_range(const sim_partition_t *sim, size_t offset, size_t size) {
+    return offset <= sim->partition.size &&
+           size <= sim->partition.size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        esp_partition_t *p = &partitions[i].partition;
+        if (p->type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || p->subtype == subtype) &&
+            (!label || !strcmp(p->label, label))) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+    sim_partition_t *sim = find(partition);
+    if (!sim || !in_range(sim, src_offset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&flash_lock);
+    memcpy(dst, sim->flash + src_offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size) {
+    sim_partition_t *sim = find(partition);
+    const uint8_t *bytes = src;
+    esp_err_t err = ESP_OK;
+    size_t len = size;
+    if (!sim || !in_range(sim, dst_offset, size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&flash_lock);
+    if (powered_off) {
+        len = 0;
+        err = ESP_FAIL;
+    } else if (power_budget >= 0 && (long)size > power_budget) {
+        // Only a prefix of the write makes it before the power goes
+        len = power_budget;
+        power_budget = 0;
+        powered_off = true;
+        err = ESP_FAIL;
+    } else if (power_budget >= 0) {
+        power_budget -= size;
+    }
+    for (size_t i = 0; i < len; i++) {
+        sim->flash[dst_offset + i] &= bytes[i];
+    }
+    sim->bytes_written += len;
+    pthread_mutex_unlock(&flash_lock);
+    return err;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+    sim_partition_t *sim = find(partition);
+    if (!sim || !in_range(sim, offset, size) || offset % SPI_FLASH_SEC_SIZE ||
+        size % SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&flash_lock);
+    if (powered_off) {
+        pthread_mutex_unlock(&flash_lock);
+        return ESP_FAIL;
+    }
+    memset(sim->flash + offset, 0xff, size);
+    sim->erases += size / SPI_FLASH_SEC_SIZE;
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+const esp_partition_t *shim_partition_add(const char *label, uint32_t size) {
+    sim_partition_t *sim = (sim_partition_t *)find(
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                 ESP_PARTITION_SUBTYPE_ANY, label));
+    if (!sim) {
+        if (num_partitions == MAX_PARTITIONS) {
+            return NULL;
+        }
+        sim = &partitions[num_partitions++];
+        strncpy(sim->partition.label, label, sizeof(sim->partition.label) - 1);
+        sim->partition.type = ESP_PARTITION_TYPE_DATA;
+        sim->partition.subtype = 0x99;
+        sim->partition.address = next_address;
+        next_address += size;
+    }
+    // Mapped rather than allocated, flash isn't part of the heap being tracked
+    if (sim->flash) {
+        munmap(sim->flash, sim->partition.size);
+    }
+    sim->flash = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memset(sim->flash, 0xff, size);
+    sim->partition.size = size;
+    sim->erases = 0;
+    sim->bytes_written = 0;
+    return &sim->partition;
+}
+
+void shim_partition_power_loss(long bytes) {
+    pthread_mutex_lock(&flash_lock);
+    power_budget = bytes;
+    powered_off = false;
+    pthread_mutex_unlock(&flash_lock);
+}
+
+void shim_partition_power_on() { shim_partition_power_loss(-1); }
+
+uint32_t shim_partition_erases(const esp_partition_t *partition) {
+    sim_partition_t *sim = find(partition);
+    return sim ? sim->erases : 0;
+}
+
+uint32_t shim_partition_bytes_written(const esp_partition_t *partition) {
+    sim_partition_t *sim = find(partition);
+    return sim ? sim->bytes_written : 0;
+}
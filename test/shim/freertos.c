@@ -0,0 +1,344 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct shim_task {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    bool is_static;
+    uint8_t *items;
+};
+
+static __thread struct shim_task *current_task = NULL;
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* Absolute CLOCK_MONOTONIC deadline ticks from now */
+static void deadline(TickType_t ticks, struct timespec *ts) {
+    uint64_t ns = (uint64_t)ticks * (1000000000 / configTICK_RATE_HZ);
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static void init_cond(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Wait on cond until ticks run out, false on timeout */
+static bool wait_cond(pthread_cond_t *cond, pthread_mutex_t *lock,
+                      TickType_t ticks, const struct timespec *until) {
+    if (ticks == 0) {
+        return false;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, until) != ETIMEDOUT;
+}
+
+static struct shim_task *new_task() {
+    struct shim_task *task = calloc(1, sizeof(struct shim_task));
+    pthread_mutex_init(&task->lock, NULL);
+    init_cond(&task->cond);
+    return task;
+}
+
+static void *task_main(void *arg) {
+    struct shim_task *task = arg;
+    current_task = task;
+    task->fn(task->arg);
+    // FreeRTOS tasks must never return
+    abort();
+    return NULL;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    pthread_mutex_unlock(&critical_lock);
+}
+
+BaseType_t xPortInIsrContext() { return pdFALSE; }
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                       uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+    struct shim_task *task = new_task();
+    pthread_attr_t attr;
+    task->fn = fn;
+    task->arg = arg;
+    // The handle is set before the task runs, as it is for a task of lower
+    // priority than its creator
+    if (handle) {
+        *handle = task;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&task->thread, &attr, task_main, task)) {
+        pthread_attr_destroy(&attr);
+        if (handle) {
+            *handle = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    pthread_attr_destroy(&attr);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core) {
+    return xTaskCreate(fn, name, stack_depth, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task || task == current_task) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec until;
+    deadline(ticks, &until);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+           EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount() {
+    return esp_timer_get_time() / (1000000 / configTICK_RATE_HZ);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    // Threads not created as tasks, like main(), get a handle when needed
+    if (!current_task) {
+        current_task = new_task();
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    struct shim_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec until;
+    uint32_t value;
+    deadline(ticks, &until);
+    pthread_mutex_lock(&task->lock);
+    while (!task->notify && wait_cond(&task->cond, &task->lock, ticks, &until)) {
+    }
+    value = task->notify;
+    if (value) {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    xTaskNotifyGive(task);
+    if (woken) {
+        *woken = pdFALSE;
+    }
+}
+
+static void init_queue(struct shim_queue *queue, UBaseType_t length,
+                       UBaseType_t item_size) {
+    pthread_mutex_init(&queue->lock, NULL);
+    init_cond(&queue->cond);
+    queue->length = length;
+    queue->item_size = item_size;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct shim_queue *queue = calloc(1, sizeof(struct shim_queue));
+    if (!queue) {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size + 1);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    init_queue(queue, length, item_size);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    if (!queue->is_static) {
+        free(queue->items);
+        free(queue);
+    }
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item,
+                             TickType_t ticks, bool front) {
+    struct timespec until;
+    BaseType_t sent = pdFALSE;
+    deadline(ticks, &until);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length &&
+           wait_cond(&queue->cond, &queue->lock, ticks, &until)) {
+    }
+    if (queue->count < queue->length) {
+        UBaseType_t slot;
+        if (front) {
+            queue->head = (queue->head + queue->length - 1) % queue->length;
+            slot = queue->head;
+        } else {
+            slot = (queue->head + queue->count) % queue->length;
+        }
+        if (queue->item_size) {
+            memcpy(queue->items + slot * queue->item_size, item,
+                   queue->item_size);
+        }
+        queue->count++;
+        sent = pdTRUE;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return sent;
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void *item,
+                                TickType_t ticks, bool remove) {
+    struct timespec until;
+    BaseType_t received = pdFALSE;
+    deadline(ticks, &until);
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count &&
+           wait_cond(&queue->cond, &queue->lock, ticks, &until)) {
+    }
+    if (queue->count) {
+        if (queue->item_size) {
+            memcpy(item, queue->items + queue->head * queue->item_size,
+                   queue->item_size);
+        }
+        if (remove) {
+            queue->head = (queue->head + 1) % queue->length;
+            queue->count--;
+            pthread_cond_broadcast(&queue->cond);
+        }
+        received = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return received;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    return queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item,
+                             TickType_t ticks) {
+    return queue_send(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    return queue_receive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+    return queue_receive(queue, item, ticks, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    UBaseType_t count;
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/* A semaphore's count is the number of zero sized items in its queue */
+static SemaphoreHandle_t create_semaphore(struct shim_queue *queue,
+                                          UBaseType_t max,
+                                          UBaseType_t initial) {
+    if (!queue) {
+        return NULL;
+    }
+    queue->count = initial;
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return create_semaphore(xQueueCreate(1, 0), 1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return create_semaphore(xQueueCreate(1, 0), 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    struct shim_queue *queue = (struct shim_queue *)buffer->storage;
+    _Static_assert(sizeof(struct shim_queue) <= sizeof(buffer->storage),
+                   "StaticSemaphore_t too small");
+    memset(queue, 0, sizeof(struct shim_queue));
+    init_queue(queue, 1, 0);
+    queue->is_static = true;
+    return create_semaphore(queue, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+    return create_semaphore(xQueueCreate(max, 0), max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    return xQueueReceive(sem, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return xQueueSend(sem, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) { vQueueDelete(sem); }
@@ -0,0 +1,58 @@
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Partitions are RAM backed NOR flash: erased bytes read 0xff, writes can
+ * only clear bits and erases are whole sectors. A power loss can be
+ * scheduled to tear a write part way.
+ */
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size);
+
+/* Add an erased data partition, or erase it again if it exists */
+const esp_partition_t *shim_partition_add(const char *label, uint32_t size);
+/*
+ * Lose power after another bytes bytes have been written: the write that
+ * crosses the limit only lands in part and fails, as does everything after
+ * it until shim_partition_power_on(). A negative count never loses power.
+ */
+void shim_partition_power_loss(long bytes);
+void shim_partition_power_on();
+/* Counters since the partition was added */
+uint32_t shim_partition_erases(const esp_partition_t *partition);
+uint32_t shim_partition_bytes_written(const esp_partition_t *partition);
+
+#endif
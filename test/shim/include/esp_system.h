@@ -0,0 +1,30 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Heap an ESP32 typically has left once Wi-Fi and the web server are up
+#define SHIM_HEAP_SIZE (160 * 1024)
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+uint32_t esp_get_free_heap_size();
+uint32_t esp_get_minimum_free_heap_size();
+uint32_t esp_random();
+void esp_restart();
+
+/*
+ * Run the shutdown handlers as esp_restart() would, but return. Heap use is
+ * tracked for code linked with the shim's --wrap options: bytes in use now,
+ * the high water mark since the last reset, and the allocation count.
+ */
+void shim_shutdown();
+size_t shim_heap_used();
+size_t shim_heap_peak();
+size_t shim_heap_allocs();
+void shim_heap_reset_peak();
+
+#endif
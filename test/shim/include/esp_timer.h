@@ -0,0 +1,16 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Microseconds since start, plus whatever shim_time_advance() added */
+int64_t esp_timer_get_time();
+
+/*
+ * Move the clock forward without waiting, so that a capture spanning hours
+ * replays in seconds. The FreeRTOS tick count follows, timeouts don't.
+ */
+void shim_time_advance(int64_t us);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+/* The project's Kconfig defaults, for the host build */
+
+#define CONFIG_SMOKE_X_MAX_DEVICES 2
+#define CONFIG_SMOKE_X_HISTORY_RAM_KB 66
+#define CONFIG_MQTT_BACKLOG_LEN 120
+#define CONFIG_MQTT_BACKLOG_DRAIN_MS 200
+#define CONFIG_RADIO_SIM 1
+#define CONFIG_LOG_DEFAULT_LEVEL 2
+
+#endif
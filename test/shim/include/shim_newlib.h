@@ -0,0 +1,26 @@
+#ifndef SHIM_NEWLIB_H
+#define SHIM_NEWLIB_H
+
+/* What ESP-IDF's newlib has and older host C libraries don't */
+
+#include <string.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || __GLIBC_MINOR__ < 38)
+static inline size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+static inline size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(dst, size);
+    return len == size ? size + strlen(src)
+                       : len + strlcpy(dst + len, src, size - len);
+}
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+
+/*
+ * A client connected to a broker that takes every message instantly: it
+ * connects on start and acknowledges QoS 1 messages from its task, without
+ * any network. Used to time the application's side of publishing.
+ */
+
+#define EVENT_QUEUE_LEN 64
+
+struct esp_mqtt_client {
+    esp_event_handler_t handler;
+    void *handler_arg;
+    TaskHandle_t task;
+    QueueHandle_t events;
+    SemaphoreHandle_t stopped;
+    int next_msg_id;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static shim_mqtt_stats_t stats;
+
+static void client_task(void *arg) {
+    esp_mqtt_client_handle_t client = arg;
+    esp_mqtt_event_t event;
+    while (1) {
+        xQueueReceive(client->events, &event, portMAX_DELAY);
+        if (event.event_id == MQTT_EVENT_ANY) {
+            xSemaphoreGive(client->stopped);
+            vTaskDelete(NULL);
+        }
+        if (event.event_id == MQTT_EVENT_PUBLISHED) {
+            pthread_mutex_lock(&stats_lock);
+            stats.acked++;
+            pthread_mutex_unlock(&stats_lock);
+        }
+        if (client->handler) {
+            client->handler(client->handler_arg, "MQTT_EVENTS",
+                            event.event_id, &event);
+        }
+    }
+}
+
+static void post(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id,
+                 int msg_id) {
+    esp_mqtt_event_t event = {
+        .event_id = id, .client = client, .msg_id = msg_id};
+    xQueueSend(client->events, &event, portMAX_DELAY);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(
+    const esp_mqtt_client_config_t *config) {
+    esp_mqtt_client_handle_t client =
+        calloc(1, sizeof(struct esp_mqtt_client));
+    client->events = xQueueCreate(EVENT_QUEUE_LEN, sizeof(esp_mqtt_event_t));
+    client->stopped = xSemaphoreCreateBinary();
+    client->next_msg_id = 1;
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client,
+                                         esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler,
+                                         void *event_handler_arg) {
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    xTaskCreate(&client_task, "mqtt_task", 6144, client, 5, &client->task);
+    post(client, MQTT_EVENT_CONNECTED, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    if (client->task) {
+        post(client, MQTT_EVENT_ANY, 0);
+        xSemaphoreTake(client->stopped, portMAX_DELAY);
+        client->task = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client) {
+    if (client->task) {
+        post(client, MQTT_EVENT_DISCONNECTED, 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    esp_mqtt_client_stop(client);
+    vQueueDelete(client->events);
+    vSemaphoreDelete(client->stopped);
+    free(client);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client,
+                            const char *topic, const char *data, int len,
+                            int qos, int retain, bool store) {
+    int msg_id;
+    if (!client || !client->task) {
+        return -1;
+    }
+    pthread_mutex_lock(&stats_lock);
+    msg_id = qos ? client->next_msg_id++ : 0;
+    stats.published++;
+    stats.bytes += strlen(topic) + (len ? len : strlen(data));
+    pthread_mutex_unlock(&stats_lock);
+    if (qos) {
+        post(client, MQTT_EVENT_PUBLISHED, msg_id);
+    }
+    return msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client,
+                            const char *topic, const char *data, int len,
+                            int qos, int retain) {
+    return esp_mqtt_client_enqueue(client, topic, data, len, qos, retain, true);
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client,
+                              const char *topic, int qos) {
+    return client && client->task ? 0 : -1;
+}
+
+void shim_mqtt_get_stats(shim_mqtt_stats_t *out_stats) {
+    pthread_mutex_lock(&stats_lock);
+    *out_stats = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
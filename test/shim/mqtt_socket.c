@@ -0,0 +1,395 @@
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+
+/*
+ * A client for a real broker, speaking MQTT 3.1.1 over TCP: mqtt:// URIs,
+ * QoS 0 and 1, no TLS. As esp-mqtt does, it reconnects by itself, without
+ * subscribing again, and dispatches events on its own task. Unlike it,
+ * messages not acknowledged before a disconnect are not sent again.
+ */
+
+#define CONNECT 0x10
+#define CONNACK 0x20
+#define PUBLISH 0x30
+#define PUBACK 0x40
+#define SUBSCRIBE 0x82
+#define SUBACK 0x90
+#define PINGREQ 0xc0
+#define DISCONNECT 0xe0
+#define KEEPALIVE_S 60
+#define RECONNECT_MS 100
+#define POLL_MS 50
+#define MAX_PACKET_LEN 4096
+
+struct esp_mqtt_client {
+    char host[64];
+    char port[8];
+    char client_id[64];
+    esp_event_handler_t handler;
+    void *handler_arg;
+    TaskHandle_t task;
+    SemaphoreHandle_t stopped;
+    volatile bool running;
+    volatile bool connected;
+    int fd;
+    pthread_mutex_t write_lock;
+    int next_msg_id;
+    int64_t last_write_us;
+    uint8_t rx_buf[MAX_PACKET_LEN];
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static shim_mqtt_stats_t stats;
+
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t *event) {
+    event->client = client;
+    if (event->event_id == MQTT_EVENT_PUBLISHED) {
+        pthread_mutex_lock(&stats_lock);
+        stats.acked++;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    if (client->handler) {
+        client->handler(client->handler_arg, "MQTT_EVENTS", event->event_id,
+                        event);
+    }
+}
+
+static void dispatch_id(esp_mqtt_client_handle_t client,
+                        esp_mqtt_event_id_t id, int msg_id) {
+    esp_mqtt_event_t event = {.event_id = id, .msg_id = msg_id};
+    dispatch(client, &event);
+}
+
+static size_t put_len(uint8_t *buf, size_t len) {
+    size_t n = 0;
+    do {
+        buf[n] = len % 128;
+        len /= 128;
+        buf[n++] |= len ? 0x80 : 0;
+    } while (len);
+    return n;
+}
+
+static size_t put_str(uint8_t *buf, const char *str, size_t len) {
+    buf[0] = len >> 8;
+    buf[1] = len & 0xff;
+    memcpy(buf + 2, str, len);
+    return len + 2;
+}
+
+/* Send a packet whose variable header and payload are in body */
+static bool send_packet(esp_mqtt_client_handle_t client, uint8_t type,
+                        const uint8_t *body, size_t len) {
+    uint8_t header[5] = {type};
+    size_t header_len = 1 + put_len(header + 1, len);
+    bool ok;
+
+    pthread_mutex_lock(&client->write_lock);
+    ok = client->fd >= 0 &&
+         send(client->fd, header, header_len, MSG_NOSIGNAL) ==
+             (ssize_t)header_len &&
+         send(client->fd, body, len, MSG_NOSIGNAL) == (ssize_t)len;
+    client->last_write_us = esp_timer_get_time();
+    pthread_mutex_unlock(&client->write_lock);
+    return ok;
+}
+
+/* Read exactly len bytes, giving up when the client is stopped */
+static bool read_all(esp_mqtt_client_handle_t client, uint8_t *buf,
+                     size_t len) {
+    struct pollfd pfd = {.fd = client->fd, .events = POLLIN};
+    ssize_t n;
+
+    while (len) {
+        if (!client->running) {
+            return false;
+        }
+        if (poll(&pfd, 1, POLL_MS) <= 0) {
+            if (client->connected && esp_timer_get_time() -
+                                             client->last_write_us >
+                                         KEEPALIVE_S / 2 * 1000000LL) {
+                send_packet(client, PINGREQ, NULL, 0);
+            }
+            continue;
+        }
+        n = recv(client->fd, buf, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Read a packet, returns its type and the length of its body */
+static bool read_packet(esp_mqtt_client_handle_t client, uint8_t *type,
+                        uint8_t *body, size_t *len) {
+    uint8_t byte;
+    size_t shift = 0;
+
+    *len = 0;
+    if (!read_all(client, type, 1)) {
+        return false;
+    }
+    do {
+        if (shift > 21 || !read_all(client, &byte, 1)) {
+            return false;
+        }
+        *len |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return *len <= MAX_PACKET_LEN && read_all(client, body, *len);
+}
+
+static bool open_session(esp_mqtt_client_handle_t client) {
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM}, *addr;
+    uint8_t body[128];
+    size_t len = 0, id_len = strlen(client->client_id);
+    uint8_t type;
+    int fd;
+
+    if (getaddrinfo(client->host, client->port, &hints, &addr)) {
+        return false;
+    }
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addr);
+    if (fd < 0) {
+        return false;
+    }
+    pthread_mutex_lock(&client->write_lock);
+    client->fd = fd;
+    pthread_mutex_unlock(&client->write_lock);
+
+    len += put_str(body, "MQTT", 4);
+    body[len++] = 4;     // 3.1.1
+    body[len++] = 0x02;  // Clean session
+    body[len++] = 0;
+    body[len++] = KEEPALIVE_S;
+    len += put_str(body + len, client->client_id, id_len);
+    if (send_packet(client, CONNECT, body, len) &&
+        read_packet(client, &type, client->rx_buf, &len) &&
+        type == CONNACK && len == 2 && client->rx_buf[1] == 0) {
+        return true;
+    }
+    pthread_mutex_lock(&client->write_lock);
+    close(client->fd);
+    client->fd = -1;
+    pthread_mutex_unlock(&client->write_lock);
+    return false;
+}
+
+static void handle_publish(esp_mqtt_client_handle_t client, uint8_t type,
+                           uint8_t *body, size_t len) {
+    size_t topic_len = body[0] << 8 | body[1];
+    size_t pos = 2 + topic_len;
+    esp_mqtt_event_t event = {.event_id = MQTT_EVENT_DATA,
+                              .qos = type >> 1 & 0x03,
+                              .retain = type & 0x01};
+    uint8_t ack[2];
+
+    if (len < 2 || pos + (event.qos ? 2 : 0) > len) {
+        return;
+    }
+    if (event.qos) {
+        memcpy(ack, body + pos, sizeof(ack));
+        event.msg_id = ack[0] << 8 | ack[1];
+        pos += 2;
+    }
+    // Null terminated, which esp-mqtt doesn't promise
+    event.topic = strndup((char *)body + 2, topic_len);
+    event.topic_len = topic_len;
+    event.data = strndup((char *)body + pos, len - pos);
+    event.data_len = event.total_data_len = len - pos;
+    dispatch(client, &event);
+    free(event.topic);
+    free(event.data);
+    if (event.qos) {
+        send_packet(client, PUBACK, ack, sizeof(ack));
+    }
+}
+
+static void client_task(void *arg) {
+    esp_mqtt_client_handle_t client = arg;
+    uint8_t *body = client->rx_buf;
+    uint8_t type;
+    size_t len;
+
+    while (client->running) {
+        if (!open_session(client)) {
+            vTaskDelay(pdMS_TO_TICKS(RECONNECT_MS));
+            continue;
+        }
+        client->connected = true;
+        dispatch_id(client, MQTT_EVENT_CONNECTED, 0);
+        while (read_packet(client, &type, body, &len)) {
+            if ((type & 0xf0) == PUBLISH) {
+                handle_publish(client, type, body, len);
+            } else if (type == PUBACK && len == 2) {
+                dispatch_id(client, MQTT_EVENT_PUBLISHED,
+                            body[0] << 8 | body[1]);
+            } else if (type == SUBACK && len >= 2) {
+                dispatch_id(client, MQTT_EVENT_SUBSCRIBED,
+                            body[0] << 8 | body[1]);
+            }
+        }
+        client->connected = false;
+        pthread_mutex_lock(&client->write_lock);
+        close(client->fd);
+        client->fd = -1;
+        pthread_mutex_unlock(&client->write_lock);
+        dispatch_id(client, MQTT_EVENT_DISCONNECTED, 0);
+    }
+    xSemaphoreGive(client->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(
+    const esp_mqtt_client_config_t *config) {
+    esp_mqtt_client_handle_t client =
+        calloc(1, sizeof(struct esp_mqtt_client));
+    const char *host = strstr(config->uri, "://");
+    const char *port;
+
+    host = host ? host + 3 : config->uri;
+    port = strchr(host, ':');
+    snprintf(client->host, sizeof(client->host), "%.*s",
+             port ? (int)(port - host) : (int)strlen(host), host);
+    snprintf(client->port, sizeof(client->port), "%s", port ? port + 1 : "1883");
+    snprintf(client->client_id, sizeof(client->client_id), "%s",
+             config->client_id && *config->client_id ? config->client_id
+                                                      : "smoke-x-shim");
+    client->fd = -1;
+    client->next_msg_id = 1;
+    client->stopped = xSemaphoreCreateBinary();
+    pthread_mutex_init(&client->write_lock, NULL);
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client,
+                                         esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler,
+                                         void *event_handler_arg) {
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    if (client->task) {
+        return ESP_FAIL;
+    }
+    client->running = true;
+    xTaskCreate(&client_task, "mqtt_task", 6144, client, 5, &client->task);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    if (client->task) {
+        client->running = false;
+        xSemaphoreTake(client->stopped, portMAX_DELAY);
+        client->task = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client) {
+    if (client->connected) {
+        send_packet(client, DISCONNECT, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    esp_mqtt_client_stop(client);
+    vSemaphoreDelete(client->stopped);
+    pthread_mutex_destroy(&client->write_lock);
+    free(client);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client,
+                            const char *topic, const char *data, int len,
+                            int qos, int retain) {
+    size_t topic_len = strlen(topic);
+    size_t data_len = len ? (size_t)len : strlen(data);
+    size_t body_len = 2 + topic_len + (qos ? 2 : 0) + data_len;
+    uint8_t *body;
+    int msg_id = 0;
+    size_t pos;
+    bool ok;
+
+    if (!client || !client->connected || body_len > MAX_PACKET_LEN) {
+        return -1;
+    }
+    body = malloc(body_len);
+    pos = put_str(body, topic, topic_len);
+    if (qos) {
+        pthread_mutex_lock(&stats_lock);
+        msg_id = client->next_msg_id;
+        client->next_msg_id = client->next_msg_id % 0xffff + 1;
+        pthread_mutex_unlock(&stats_lock);
+        body[pos++] = msg_id >> 8;
+        body[pos++] = msg_id & 0xff;
+    }
+    memcpy(body + pos, data, data_len);
+    ok = send_packet(client, PUBLISH | (qos ? 0x02 : 0) | (retain ? 0x01 : 0),
+                     body, body_len);
+    free(body);
+    if (!ok) {
+        return -1;
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats.published++;
+    stats.bytes += topic_len + data_len;
+    pthread_mutex_unlock(&stats_lock);
+    return msg_id;
+}
+
+/* Sent right away too, there is no outbox to queue it in */
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client,
+                            const char *topic, const char *data, int len,
+                            int qos, int retain, bool store) {
+    return esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client,
+                              const char *topic, int qos) {
+    uint8_t body[256];
+    size_t topic_len = strlen(topic);
+    int msg_id;
+
+    if (!client || !client->connected || topic_len + 5 > sizeof(body)) {
+        return -1;
+    }
+    pthread_mutex_lock(&stats_lock);
+    msg_id = client->next_msg_id;
+    client->next_msg_id = client->next_msg_id % 0xffff + 1;
+    pthread_mutex_unlock(&stats_lock);
+    body[0] = msg_id >> 8;
+    body[1] = msg_id & 0xff;
+    put_str(body + 2, topic, topic_len);
+    body[4 + topic_len] = qos;
+    return send_packet(client, SUBSCRIBE, body, topic_len + 5) ? msg_id : -1;
+}
+
+void shim_mqtt_get_stats(shim_mqtt_stats_t *out_stats) {
+    pthread_mutex_lock(&stats_lock);
+    *out_stats = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
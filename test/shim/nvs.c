@@ -0,0 +1,177 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+
+#define MAX_ENTRIES 64
+#define MAX_NAME_LEN 16
+
+typedef struct {
+    char ns[MAX_NAME_LEN];
+    char key[MAX_NAME_LEN];
+    size_t len;
+    uint8_t *value;
+} entry_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char namespaces[MAX_ENTRIES][MAX_NAME_LEN];
+static unsigned int num_namespaces = 0;
+static entry_t entries[MAX_ENTRIES];
+static unsigned int num_entries = 0;
+
+/* Handles are the namespace index plus one */
+static const char *handle_ns(nvs_handle_t handle) {
+    return handle && handle <= num_namespaces ? namespaces[handle - 1] : NULL;
+}
+
+static entry_t *find(nvs_handle_t handle, const char *key) {
+    const char *ns = handle_ns(handle);
+    for (unsigned int i = 0; ns && i < num_entries; i++) {
+        if (!strcmp(entries[i].ns, ns) && !strcmp(entries[i].key, key)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char *key, const void *value,
+                     size_t len) {
+    entry_t *entry;
+    esp_err_t err = ESP_OK;
+    if (!handle_ns(handle) || strlen(key) >= MAX_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    entry = find(handle, key);
+    if (!entry && num_entries < MAX_ENTRIES) {
+        entry = &entries[num_entries++];
+        strcpy(entry->ns, handle_ns(handle));
+        strcpy(entry->key, key);
+    }
+    if (entry) {
+        free(entry->value);
+        entry->value = malloc(len ? len : 1);
+        memcpy(entry->value, value, len);
+        entry->len = len;
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+/* Like nvs_get_blob(), a NULL out_value only asks for the length */
+static esp_err_t get(nvs_handle_t handle, const char *key, void *out_value,
+                     size_t *length) {
+    entry_t *entry;
+    esp_err_t err = ESP_OK;
+    pthread_mutex_lock(&nvs_lock);
+    entry = find(handle, key);
+    if (!entry) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value && *length < entry->len) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (out_value) {
+        memcpy(out_value, entry->value, entry->len);
+    }
+    if (entry) {
+        *length = entry->len;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+/* Fixed size values must be read back with the size they were written */
+static esp_err_t get_fixed(nvs_handle_t handle, const char *key,
+                           void *out_value, size_t len) {
+    size_t stored = len;
+    esp_err_t err = get(handle, key, NULL, &stored);
+    if (err == ESP_OK && stored != len) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return err == ESP_OK ? get(handle, key, out_value, &stored) : err;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *out_handle) {
+    unsigned int i;
+    if (strlen(name) >= MAX_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    for (i = 0; i < num_namespaces && strcmp(namespaces[i], name); i++) {
+    }
+    if (i == num_namespaces && num_namespaces < MAX_ENTRIES) {
+        strcpy(namespaces[num_namespaces++], name);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    *out_handle = i + 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    entry_t *entry;
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_lock(&nvs_lock);
+    entry = find(handle, key);
+    if (entry) {
+        free(entry->value);
+        *entry = entries[--num_entries];
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    const char *ns = handle_ns(handle);
+    pthread_mutex_lock(&nvs_lock);
+    for (unsigned int i = 0; ns && i < num_entries;) {
+        if (!strcmp(entries[i].ns, ns)) {
+            free(entries[i].value);
+            entries[i] = entries[--num_entries];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+    return set(handle, key, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+    return get(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+    return set(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value,
+                      size_t *length) {
+    return get(handle, key, out_value, length);
+}
+
+#define NVS_FIXED(suffix, type)                                            \
+    esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char *key,       \
+                               type value) {                               \
+        return set(handle, key, &value, sizeof(value));                    \
+    }                                                                      \
+    esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char *key,       \
+                               type *out_value) {                          \
+        return get_fixed(handle, key, out_value, sizeof(*out_value));      \
+    }
+
+NVS_FIXED(i8, int8_t)
+NVS_FIXED(u8, uint8_t)
+NVS_FIXED(u16, uint16_t)
+NVS_FIXED(u32, uint32_t)
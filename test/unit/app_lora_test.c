@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "app_lora.h"
+#include "app_radio_sim.h"
+#include "check.h"
+
+/* Reception on the simulated radio, started and stopped under load */
+
+#define CALLBACK_MS 50
+#define RETUNES 1000
+#define REPEATS 10
+#define REPEAT_MS 20
+
+static const char payload[] = "|dhHWl,SUCCESS,";
+static SemaphoreHandle_t xCallbackMutex = NULL;
+static SemaphoreHandle_t xInCallback = NULL;
+static volatile unsigned int received = 0;
+static volatile bool in_callback = false;
+
+/* A slow callback holding a lock, as handle_rx() holds xSchedMutex */
+static void slow_rx(const app_lora_frame_t *frame) {
+    xSemaphoreTake(xCallbackMutex, portMAX_DELAY);
+    in_callback = true;
+    xSemaphoreGive(xInCallback);
+    vTaskDelay(pdMS_TO_TICKS(CALLBACK_MS));
+    received++;
+    in_callback = false;
+    xSemaphoreGive(xCallbackMutex);
+}
+
+static void inject() {
+    app_radio_sim_inject((const uint8_t *)payload, strlen(payload), -80, 7);
+}
+
+/*
+ * Stopping while the callback runs waits for it to return, so its lock is
+ * released, and drops the frames still queued
+ */
+static void test_stop_in_callback() {
+    CHECK_EQ(app_lora_start_rx(slow_rx), ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    for (unsigned int i = 0; i < 4; i++) {
+        inject();
+    }
+    CHECK(xSemaphoreTake(xInCallback, pdMS_TO_TICKS(1000)));
+    CHECK_EQ(app_lora_stop_rx(), ESP_OK);
+    CHECK(!in_callback);
+    CHECK_EQ(received, 1);
+    CHECK(xSemaphoreTake(xCallbackMutex, 0));
+    xSemaphoreGive(xCallbackMutex);
+    // Nothing is received once stopped
+    inject();
+    vTaskDelay(pdMS_TO_TICKS(3 * CALLBACK_MS));
+    CHECK_EQ(received, 1);
+}
+
+/* Reception starts again after a stop, with a new decode task */
+static void test_restart() {
+    unsigned int before = received;
+    CHECK_EQ(app_lora_start_rx(slow_rx), ESP_OK);
+    // Only one decode task at a time
+    CHECK(app_lora_start_rx(slow_rx) != ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    inject();
+    CHECK(xSemaphoreTake(xInCallback, pdMS_TO_TICKS(1000)));
+    vTaskDelay(pdMS_TO_TICKS(2 * CALLBACK_MS));
+    CHECK_EQ(received, before + 1);
+    CHECK_EQ(app_lora_stop_rx(), ESP_OK);
+    // Stopping again does nothing
+    CHECK_EQ(app_lora_stop_rx(), ESP_OK);
+}
+
+/* Retune through the radio task and wait for it to be done */
+static int64_t set_params(app_lora_params_t *params) {
+    int64_t start = esp_timer_get_time();
+    CHECK_EQ(app_lora_set_params(params, xTaskGetCurrentTaskHandle()),
+             ESP_OK);
+    CHECK(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)));
+    return esp_timer_get_time() - start;
+}
+
+/*
+ * Only changes reach the radio, told apart field by field whatever the
+ * padding of the parameters holds, and frequency alone is the fast path
+ */
+static void test_retune() {
+    app_lora_retune_stats_t before, after;
+    app_lora_params_t params, copy;
+    int64_t total_us = 0;
+
+    app_lora_get_params(&params);
+    memset(&copy, 0xa5, sizeof(copy));
+    copy.tx_power = params.tx_power;
+    copy.frequency = params.frequency;
+    copy.bandwidth = params.bandwidth;
+    copy.spreading_factor = params.spreading_factor;
+    copy.preamble_len = params.preamble_len;
+    copy.sync_word = params.sync_word;
+    copy.implicit_hdr = params.implicit_hdr;
+    copy.msg_len = params.msg_len;
+    copy.coding_rate = params.coding_rate;
+    copy.crc_on = params.crc_on;
+    CHECK(app_lora_params_equal(&params, &copy));
+    copy.crc_on = !copy.crc_on;
+    CHECK(!app_lora_params_equal(&params, &copy));
+
+    set_params(&params);
+    app_lora_get_retune_stats(&before);
+    set_params(&params);
+    for (unsigned int i = 0; i < RETUNES; i++) {
+        params.frequency = i % 2 ? 915000000 : 920000000;
+        total_us += set_params(&params);
+    }
+    app_lora_get_retune_stats(&after);
+    CHECK_EQ(after.full.count, before.full.count);
+    CHECK_EQ(after.frequency.count, before.frequency.count + RETUNES);
+    printf("Retune through the radio task: %.1f us on average\n",
+           (double)total_us / RETUNES);
+    params.spreading_factor = params.spreading_factor == 9 ? 10 : 9;
+    set_params(&params);
+    app_lora_get_retune_stats(&after);
+    CHECK_EQ(after.full.count, before.full.count + 1);
+}
+
+/* Repeated transmits are made by the radio task, without a task each */
+static void test_repeat_tx() {
+    app_lora_tx_msg_t msg = {.msg = (char *)payload,
+                             .repeat_interval_ms = REPEAT_MS};
+    app_radio_sim_stats_t before, after;
+    size_t allocs = shim_heap_allocs();
+    app_radio_sim_get_stats(&before);
+    CHECK_EQ(app_lora_start_tx(&msg), ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(REPEATS * REPEAT_MS));
+    CHECK_EQ(app_lora_stop_tx(), ESP_OK);
+    app_radio_sim_get_stats(&after);
+    printf("%zu allocations for %u repeated transmits\n",
+           shim_heap_allocs() - allocs, after.sent - before.sent);
+    CHECK(after.sent - before.sent >= REPEATS / 2);
+    CHECK_EQ(shim_heap_allocs(), allocs);
+}
+
+int main() {
+    xCallbackMutex = xSemaphoreCreateMutex();
+    xInCallback = xSemaphoreCreateBinary();
+    CHECK_EQ(app_lora_init(), ESP_OK);
+    test_stop_in_callback();
+    test_restart();
+    test_retune();
+    test_repeat_tx();
+    return check_failures("app_lora_test");
+}
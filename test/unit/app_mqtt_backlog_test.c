@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "app_mqtt_backlog.h"
+#include "check.h"
+#include "smoke_x_history.h"
+
+/*
+ * The MQTT backlog on the simulated NOR flash, filled past the RAM ring and
+ * the partition, drained and restarted: every state counted has to come
+ * back out, oldest first.
+ */
+
+#define TEST_SECTORS 2
+#define RECORD_SIZE 56
+#define RECORDS_PER_SECTOR (SPI_FLASH_SEC_SIZE / RECORD_SIZE)
+#define PARTITION_RECORDS (TEST_SECTORS * RECORDS_PER_SECTOR)
+// Spilled in batches, the last batch to fit leaves the ring full
+#define SPILL_LEN 10
+#define LOSSLESS_LEN \
+    (PARTITION_RECORDS / SPILL_LEN * SPILL_LEN + CONFIG_MQTT_BACKLOG_LEN)
+#define EPOCH 1700000000
+
+static void format() {
+    shim_partition_add(APP_MQTT_BACKLOG_PARTITION,
+                       TEST_SECTORS * SPI_FLASH_SEC_SIZE);
+    app_mqtt_backlog_init();
+}
+
+/* A state told apart by its link interval */
+static void push(uint32_t id) {
+    smoke_x_state_t state = {.num_probes = 2, .link = {.interval = id}};
+    app_mqtt_backlog_push(0, &state);
+}
+
+/* Pop everything, checking it comes out in order, and return how much */
+static unsigned int drain(uint32_t *last) {
+    smoke_x_state_t state;
+    unsigned int device, count = 0, out_of_order = 0;
+    uint32_t seq;
+
+    while (app_mqtt_backlog_peek(&device, &state, &seq)) {
+        out_of_order += count && state.link.interval != *last + 1;
+        *last = state.link.interval;
+        app_mqtt_backlog_pop(seq);
+        count++;
+    }
+    CHECK_EQ(out_of_order, 0);
+    return count;
+}
+
+/*
+ * What is counted is what drains, for every fill level up to and past a
+ * full partition, and nothing is dropped before it has to be
+ */
+static void test_count() {
+    for (uint32_t n = 0; n <= LOSSLESS_LEN + 2 * RECORDS_PER_SECTOR; n++) {
+        uint32_t last = 0;
+        unsigned int count;
+        format();
+        for (uint32_t i = 0; i < n; i++) {
+            push(i);
+        }
+        count = app_mqtt_backlog_count();
+        CHECK_EQ(drain(&last), count);
+        CHECK_EQ(app_mqtt_backlog_count(), 0);
+        if (n <= LOSSLESS_LEN) {
+            CHECK_EQ(count, n);
+        }
+        if (n) {
+            CHECK_EQ(last, n - 1);
+        }
+    }
+}
+
+/*
+ * A restart that spills the RAM ring into the last free slots leaves the
+ * partition full, with the oldest record where the next one goes
+ */
+static void test_restart_full() {
+    const uint32_t n = PARTITION_RECORDS;
+    smoke_x_state_t state;
+    unsigned int device;
+    uint32_t seq, last = 0;
+
+    format();
+    for (uint32_t i = 0; i < n; i++) {
+        push(i);
+    }
+    shim_shutdown();
+    app_mqtt_backlog_init();
+    CHECK_EQ(app_mqtt_backlog_count(), n);
+    for (unsigned int i = 0; i < 10; i++) {
+        CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+        app_mqtt_backlog_pop(seq);
+    }
+    // Published records are found marked after the next restart
+    app_mqtt_backlog_init();
+    CHECK_EQ(app_mqtt_backlog_count(), n - 10);
+    CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+    CHECK_EQ(state.link.interval, 10);
+    CHECK_EQ(drain(&last), n - 10);
+    CHECK_EQ(last, n - 1);
+}
+
+/*
+ * States received before the wall clock was set get their time once it is,
+ * unless they are from before a restart
+ */
+static void test_clock_set_later() {
+    smoke_x_state_t state;
+    unsigned int device;
+    uint32_t seq;
+    int32_t shift;
+
+    smoke_x_history_init();
+    format();
+    push(0);
+    shim_shutdown();
+    app_mqtt_backlog_init();
+    push(1);
+    shim_time_advance(100 * 1000000LL);
+    CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+    CHECK(!state.time_is_epoch);
+    smoke_x_history_sync_clock(EPOCH, &shift);
+    CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+    CHECK_EQ(state.link.interval, 0);
+    CHECK(!state.time_is_epoch);
+    app_mqtt_backlog_pop(seq);
+    CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+    CHECK_EQ(state.link.interval, 1);
+    CHECK(state.time_is_epoch);
+    CHECK(labs((long)state.time - (EPOCH - 100)) <= 1);
+}
+
+/*
+ * States published from RAM between two spills leave a gap in the numbers
+ * in flash. After a power loss, new states are numbered past all of them,
+ * and those from before it still get no time.
+ */
+static void test_restart_gap() {
+    const uint32_t gap = 20;
+    smoke_x_state_t state;
+    unsigned int device;
+    uint32_t seq, last_seq = 0, n = 0;
+    int32_t shift;
+
+    smoke_x_history_init();
+    format();
+    // The first spill, published
+    while (n <= CONFIG_MQTT_BACKLOG_LEN) {
+        push(n++);
+    }
+    for (unsigned int i = 0; i < SPILL_LEN + gap; i++) {
+        CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+        CHECK_EQ(seq, i);
+        app_mqtt_backlog_pop(seq);
+    }
+    // The second spill, numbered after the gap
+    while (n <= CONFIG_MQTT_BACKLOG_LEN + SPILL_LEN + gap) {
+        push(n++);
+    }
+    app_mqtt_backlog_init();
+    CHECK_EQ(app_mqtt_backlog_count(), SPILL_LEN);
+    push(n);
+    smoke_x_history_sync_clock(EPOCH, &shift);
+    for (unsigned int i = 0; i < SPILL_LEN; i++) {
+        CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+        CHECK_EQ(state.link.interval, SPILL_LEN + gap + i);
+        CHECK(!state.time_is_epoch);
+        last_seq = seq;
+        app_mqtt_backlog_pop(seq);
+    }
+    CHECK(app_mqtt_backlog_peek(&device, &state, &seq));
+    CHECK_EQ(state.link.interval, n);
+    CHECK(state.time_is_epoch);
+    CHECK((int32_t)(seq - last_seq) > 0);
+    app_mqtt_backlog_pop(seq);
+    CHECK_EQ(app_mqtt_backlog_count(), 0);
+}
+
+int main() {
+    test_count();
+    test_restart_full();
+    test_clock_set_later();
+    test_restart_gap();
+    return check_failures("app_mqtt_backlog_test");
+}
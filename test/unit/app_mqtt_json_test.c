@@ -0,0 +1,154 @@
+#include <string.h>
+#include "app_mqtt_json.h"
+#include "check.h"
+
+/* The state payload, byte for byte, and the same values one by one */
+
+#define BUF_LEN 1024
+
+static const char no_probes[] =
+    "{\"probe_1_attached\":\"OFF\",\"probe_1_alarm\":\"offline\","
+    "\"probe_1_temp\":\"offline\",\"probe_1_max\":\"offline\","
+    "\"probe_1_min\":\"offline\",\"probe_2_attached\":\"OFF\","
+    "\"probe_2_alarm\":\"offline\",\"probe_2_temp\":\"offline\","
+    "\"probe_2_max\":\"offline\",\"probe_2_min\":\"offline\","
+    "\"billows_target\":\"offline\",\"billows_attached\":\"OFF\","
+    "\"rssi\":-90,\"snr\":7.5,\"packet_loss\":0}";
+
+static const char all_probes[] =
+    "{\"probe_1_attached\":\"ON\",\"probe_1_alarm\":\"OFF\","
+    "\"probe_1_temp\":70.4,\"probe_1_max\":185,\"probe_1_min\":32,"
+    "\"probe_2_attached\":\"ON\",\"probe_2_alarm\":\"ON\","
+    "\"probe_2_temp\":225,\"probe_2_max\":250,\"probe_2_min\":200,"
+    "\"probe_3_attached\":\"ON\",\"probe_3_alarm\":\"OFF\","
+    "\"probe_3_temp\":-0.5,\"probe_3_max\":40,\"probe_3_min\":-10,"
+    "\"probe_4_attached\":\"ON\",\"probe_4_alarm\":\"OFF\","
+    "\"probe_4_temp\":100.1,\"probe_4_max\":212,\"probe_4_min\":0,"
+    "\"billows_target\":\"offline\",\"billows_attached\":\"OFF\","
+    "\"time\":1700000000,\"rssi\":-87,\"snr\":-3.3,\"packet_interval\":30,"
+    "\"packet_loss\":3.2}";
+
+// The last probe reports the billows target instead of its alarms
+static const char billows[] =
+    "{\"probe_1_attached\":\"ON\",\"probe_1_alarm\":\"OFF\","
+    "\"probe_1_temp\":70.4,\"probe_1_max\":185,\"probe_1_min\":32,"
+    "\"probe_2_attached\":\"OFF\",\"probe_2_alarm\":\"offline\","
+    "\"probe_2_temp\":\"offline\",\"probe_2_max\":\"offline\","
+    "\"probe_2_min\":\"offline\",\"probe_3_attached\":\"ON\","
+    "\"probe_3_alarm\":\"OFF\",\"probe_3_temp\":-0.5,\"probe_3_max\":40,"
+    "\"probe_3_min\":-10,\"probe_4_attached\":\"ON\","
+    "\"probe_4_alarm\":\"OFF\",\"probe_4_temp\":230.5,"
+    "\"probe_4_max\":\"offline\",\"probe_4_min\":\"offline\","
+    "\"billows_target\":225,\"billows_attached\":\"ON\",\"rssi\":-87,"
+    "\"snr\":-3.3,\"packet_interval\":30,\"packet_loss\":3.2}";
+
+typedef struct {
+    unsigned int count;
+    unsigned int billows_target;
+    char target[APP_MQTT_JSON_VALUE_LEN];
+} values_t;
+
+static void on_value(const char *key, const char *value, void *ctx) {
+    values_t *values = ctx;
+    values->count++;
+    if (!strcmp(key, "billows_target")) {
+        values->billows_target++;
+        strcpy(values->target, value);
+    }
+}
+
+static void init_x4(smoke_x_state_t *state) {
+    static const smoke_x_probe_t probes[] = {
+        {.attached = true, .temp = 70.4, .max_temp = 185, .min_temp = 32},
+        {.attached = true,
+         .temp = 225,
+         .alarm = true,
+         .max_temp = 250,
+         .min_temp = 200},
+        {.attached = true, .temp = -0.5, .max_temp = 40, .min_temp = -10},
+        {.attached = true, .temp = 100.1, .max_temp = 212, .min_temp = 0},
+    };
+    memset(state, 0, sizeof(smoke_x_state_t));
+    state->num_probes = 4;
+    memcpy(state->probes, probes, sizeof(probes));
+    state->time = 1700000000;
+    state->time_is_epoch = true;
+    state->link = (smoke_x_link_t){
+        .rssi = -87, .snr = -3.25, .interval = 30, .loss = 0.032};
+}
+
+static void check_state(const smoke_x_state_t *state, const char *expected) {
+    char buf[BUF_LEN];
+    size_t len = app_mqtt_json_state(state, buf, sizeof(buf));
+    CHECK_EQ(len, strlen(expected));
+    CHECK(!strcmp(buf, expected));
+}
+
+static void test_no_probes() {
+    smoke_x_state_t state = {
+        .num_probes = 2, .time = 3600, .link = {.rssi = -90, .snr = 7.5}};
+    values_t values = {0};
+    check_state(&state, no_probes);
+    app_mqtt_json_values(&state, on_value, &values);
+    CHECK_EQ(values.count, 15);
+    CHECK_EQ(values.billows_target, 1);
+}
+
+static void test_all_probes() {
+    smoke_x_state_t state;
+    values_t values = {0};
+    init_x4(&state);
+    check_state(&state, all_probes);
+    app_mqtt_json_values(&state, on_value, &values);
+    CHECK_EQ(values.count, 27);
+    CHECK_EQ(values.billows_target, 1);
+    CHECK(!strcmp(values.target, "offline"));
+}
+
+static void test_billows() {
+    smoke_x_state_t state;
+    values_t values = {0};
+    init_x4(&state);
+    state.probes[1] = (smoke_x_probe_t){.attached = false};
+    state.probes[3].temp = 230.5;
+    state.probes[3].billows_target = 225;
+    state.billows_attached = true;
+    state.time_is_epoch = false;
+    check_state(&state, billows);
+    app_mqtt_json_values(&state, on_value, &values);
+    CHECK_EQ(values.billows_target, 1);
+    CHECK(!strcmp(values.target, "225"));
+}
+
+/* time is only there once it is in seconds since the epoch */
+static void test_time() {
+    char buf[BUF_LEN];
+    smoke_x_state_t state;
+    init_x4(&state);
+    app_mqtt_json_state(&state, buf, sizeof(buf));
+    CHECK(strstr(buf, ",\"time\":1700000000,"));
+    state.time_is_epoch = false;
+    app_mqtt_json_state(&state, buf, sizeof(buf));
+    CHECK(!strstr(buf, "\"time\""));
+    CHECK_EQ(strlen(buf), strlen(all_probes) - strlen(",\"time\":1700000000"));
+}
+
+/* A payload that doesn't fit, null terminator included, isn't written */
+static void test_overflow() {
+    char buf[BUF_LEN];
+    smoke_x_state_t state;
+    init_x4(&state);
+    CHECK_EQ(app_mqtt_json_state(&state, buf, strlen(all_probes)), 0);
+    CHECK_EQ(app_mqtt_json_state(&state, buf, strlen(all_probes) + 1),
+             strlen(all_probes));
+    CHECK_EQ(app_mqtt_json_state(&state, buf, 0), 0);
+}
+
+int main() {
+    test_no_probes();
+    test_all_probes();
+    test_billows();
+    test_time();
+    test_overflow();
+    return check_failures("app_mqtt_json_test");
+}
@@ -0,0 +1,185 @@
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <esp_event.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mqtt_client.h>
+#include <nvs.h>
+#include "app_mqtt.h"
+#include "app_mqtt_backlog.h"
+#include "check.h"
+
+/*
+ * app_mqtt against a mosquitto broker on localhost: the states kept from
+ * boot, before the broker could be reached, are published to the history
+ * topic once it can, and none is lost to the client being stopped and
+ * started again halfway through. Skipped when there's no mosquitto.
+ */
+
+#define SKIPPED 77
+#define NVS_NAMESPACE "mqtt_config"
+#define STATE_TOPIC "test/smoke-x/state"
+#define HISTORY_TOPIC STATE_TOPIC "/history"
+#define NUM_STATES 10
+#define STOP_AFTER 4
+#define TIMEOUT_MS 20000
+
+static uint32_t received[4 * NUM_STATES];
+static volatile unsigned int num_received = 0;
+static volatile bool subscribed = false;
+
+/* A free port on localhost for the broker */
+static int free_port() {
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static bool broker_up(int port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons(port),
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool up = !connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    close(fd);
+    return up;
+}
+
+static pid_t start_broker(int port) {
+    char port_str[8];
+    pid_t pid;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    pid = fork();
+    if (pid == 0) {
+        execl(MOSQUITTO, MOSQUITTO, "-p", port_str, NULL);
+        _exit(1);
+    }
+    for (unsigned int i = 0; pid > 0 && i < 100 && !broker_up(port); i++) {
+        usleep(50000);
+    }
+    return pid;
+}
+
+/* The configuration as app_mqtt_set_params() saved it before the restart */
+static void save_config(const char *uri) {
+    nvs_handle_t h_nvs;
+    nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h_nvs);
+    nvs_set_str(h_nvs, APP_MQTT_URI, uri);
+    nvs_set_str(h_nvs, APP_MQTT_STATE_TOPIC, STATE_TOPIC);
+    nvs_set_i8(h_nvs, APP_MQTT_ENABLED, 1);
+    nvs_close(h_nvs);
+}
+
+static void on_history(void *handler_args, esp_event_base_t base,
+                       int32_t event_id, void *event_data) {
+    esp_mqtt_event_handle_t event = event_data;
+    const char *interval;
+
+    if (event_id == MQTT_EVENT_SUBSCRIBED) {
+        subscribed = true;
+    } else if (event_id == MQTT_EVENT_DATA &&
+               !strcmp(event->topic, HISTORY_TOPIC) &&
+               (interval = strstr(event->data, "\"packet_interval\":")) &&
+               num_received < sizeof(received) / sizeof(received[0])) {
+        received[num_received] = atoi(interval + 18);
+        num_received++;
+    }
+}
+
+/* Each state at least once, the first time in order */
+static unsigned int received_in_order() {
+    unsigned int next = 1;
+    for (unsigned int i = 0; i < num_received; i++) {
+        if (received[i] == next) {
+            next++;
+        } else if (received[i] > next) {
+            return 0;
+        }
+    }
+    return next - 1;
+}
+
+static bool wait_for(bool (*done)()) {
+    int64_t start = esp_timer_get_time();
+    while (!done() && esp_timer_get_time() - start < TIMEOUT_MS * 1000LL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return done();
+}
+
+static bool some_received() { return num_received >= STOP_AFTER; }
+
+static bool all_received() {
+    return received_in_order() == NUM_STATES && !app_mqtt_backlog_count();
+}
+
+int main() {
+    esp_mqtt_client_config_t config = {.client_id = "smoke-x-test"};
+    esp_mqtt_client_handle_t subscriber;
+    int port = free_port();
+    char uri[32];
+    int64_t start;
+    pid_t broker;
+
+    if (!*MOSQUITTO) {
+        printf("No mosquitto, skipped\n");
+        return SKIPPED;
+    }
+    snprintf(uri, sizeof(uri), "mqtt://127.0.0.1:%d", port);
+    esp_event_loop_create_default();
+    save_config(uri);
+
+    // At boot, before the network is up
+    CHECK_EQ(app_mqtt_init(), ESP_OK);
+    CHECK(app_mqtt_is_enabled());
+    CHECK(!app_mqtt_is_connected());
+    for (uint32_t i = 1; i <= NUM_STATES; i++) {
+        smoke_x_state_t state = {.num_probes = 2, .link = {.interval = i}};
+        app_mqtt_backlog_push(0, &state);
+    }
+
+    broker = start_broker(port);
+    CHECK(broker_up(port));
+    config.uri = uri;
+    subscriber = esp_mqtt_client_init(&config);
+    esp_mqtt_client_register_event(subscriber, MQTT_EVENT_ANY, on_history,
+                                   NULL);
+    esp_mqtt_client_start(subscriber);
+    for (unsigned int i = 0; i < 100 && !subscribed; i++) {
+        esp_mqtt_client_subscribe(subscriber, HISTORY_TOPIC, 1);
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+    CHECK(subscribed);
+
+    // Stopped while it's publishing, which doesn't wait on the broker
+    CHECK_EQ(app_mqtt_start(), ESP_OK);
+    CHECK(wait_for(some_received));
+    start = esp_timer_get_time();
+    app_mqtt_stop();
+    CHECK(esp_timer_get_time() - start < 1000000);
+    CHECK_EQ(app_mqtt_start(), ESP_OK);
+
+    CHECK(wait_for(all_received));
+    printf("%u states published for %d kept\n", num_received, NUM_STATES);
+    CHECK_EQ(received_in_order(), NUM_STATES);
+    CHECK_EQ(app_mqtt_backlog_count(), 0);
+
+    app_mqtt_stop();
+    esp_mqtt_client_destroy(subscriber);
+    kill(broker, SIGTERM);
+    waitpid(broker, NULL, 0);
+    return check_failures("app_mqtt_test");
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app_radio.h"
+#include "app_radio_sim.h"
+#include "check.h"
+
+/*
+ * The simulated radio through the driver operations, as app_lora calls
+ * them: the channel model has to lose, duplicate and jitter packets at the
+ * rates it's configured with, and repeat itself for the same seed.
+ */
+
+#define PACKETS 20000
+#define SIM_QUEUE_LEN 16
+#define FREQUENCY 915000000
+
+static const app_radio_t *radio = &app_radio_sim;
+static const uint8_t payload[] = "|dhHWl,SUCCESS,";
+
+typedef struct {
+    unsigned int received;
+    int16_t rssi_min;
+    int16_t rssi_max;
+    uint32_t rssi_hash;
+} run_t;
+
+/* Inject and read back every packet, as the radio task would */
+static run_t run(const app_radio_sim_channel_t *channel, unsigned int packets) {
+    run_t r = {.rssi_min = INT16_MAX, .rssi_max = INT16_MIN};
+    uint8_t buf[PAYLOAD_LEN_MAX];
+    app_radio_status_t status;
+    int len;
+
+    app_radio_sim_set_channel(channel);
+    for (unsigned int i = 0; i < packets; i++) {
+        app_radio_sim_inject(payload, sizeof(payload) - 1, -80, 7.5);
+        while ((len = radio->receive(buf, sizeof(buf))) > 0) {
+            radio->status(&status);
+            CHECK_EQ(len, sizeof(payload) - 1);
+            r.received++;
+            r.rssi_min = status.rssi < r.rssi_min ? status.rssi : r.rssi_min;
+            r.rssi_max = status.rssi > r.rssi_max ? status.rssi : r.rssi_max;
+            r.rssi_hash = r.rssi_hash * 31 + status.rssi;
+        }
+    }
+    return r;
+}
+
+static void get_stats_delta(const app_radio_sim_stats_t *before,
+                            app_radio_sim_stats_t *delta) {
+    app_radio_sim_get_stats(delta);
+    delta->injected -= before->injected;
+    delta->lost -= before->lost;
+    delta->duplicated -= before->duplicated;
+    delta->overflowed -= before->overflowed;
+}
+
+/* Rates within 1.5 points of the configured ones over 20000 packets */
+static void test_channel_rates() {
+    app_radio_sim_channel_t channel = {.loss_pct = 20,
+                                       .duplicate_pct = 5,
+                                       .rssi_jitter = 6,
+                                       .seed = 42};
+    app_radio_sim_stats_t before, stats;
+    app_radio_sim_get_stats(&before);
+    run_t r = run(&channel, PACKETS);
+    get_stats_delta(&before, &stats);
+
+    double lost_pct = 100.0 * stats.lost / PACKETS;
+    // Of the packets not lost
+    double dup_pct = 100.0 * stats.duplicated / (PACKETS - stats.lost);
+    printf("Lost %.2f%%, duplicated %.2f%%, RSSI %d to %d dBm\n", lost_pct,
+           dup_pct, r.rssi_min, r.rssi_max);
+    CHECK_EQ(stats.injected, PACKETS);
+    CHECK(lost_pct > 18.5 && lost_pct < 21.5);
+    CHECK(dup_pct > 3.5 && dup_pct < 6.5);
+    CHECK_EQ(r.received, PACKETS - stats.lost + stats.duplicated);
+    CHECK_EQ(r.rssi_min, -86);
+    CHECK_EQ(r.rssi_max, -74);
+    CHECK_EQ(stats.overflowed, 0);
+}
+
+/* The same seed gives the same channel, another seed another one */
+static void test_seed() {
+    app_radio_sim_channel_t channel = {.loss_pct = 30,
+                                       .duplicate_pct = 10,
+                                       .rssi_jitter = 3,
+                                       .seed = 7};
+    run_t a = run(&channel, 1000);
+    run_t b = run(&channel, 1000);
+    channel.seed = 8;
+    run_t c = run(&channel, 1000);
+    CHECK_EQ(a.received, b.received);
+    CHECK_EQ(a.rssi_hash, b.rssi_hash);
+    CHECK(a.rssi_hash != c.rssi_hash);
+}
+
+/* Only a radio receiving, and tuned to the transmitter, gets packets */
+static void test_tuning() {
+    app_radio_sim_channel_t channel = {.seed = 1};
+    app_lora_params_t params = {.frequency = FREQUENCY};
+    bool detected = true;
+
+    radio->stop_rx();
+    CHECK_EQ(run(&channel, 10).received, 0);
+    radio->start_rx();
+    app_radio_sim_set_activity(FREQUENCY + 500000);
+    radio->configure(&params);
+    CHECK_EQ(run(&channel, 10).received, 0);
+    CHECK_EQ(radio->cad(&detected), ESP_OK);
+    CHECK(!detected);
+    app_radio_sim_set_activity(FREQUENCY);
+    CHECK_EQ(run(&channel, 10).received, 10);
+    CHECK_EQ(radio->cad(&detected), ESP_OK);
+    CHECK(detected);
+    app_radio_sim_set_activity(0);
+}
+
+/* Packets not read in time overflow the FIFO, the oldest are kept */
+static void test_overflow() {
+    app_radio_sim_channel_t channel = {.seed = 1};
+    app_radio_sim_stats_t before, stats;
+    uint8_t buf[PAYLOAD_LEN_MAX];
+    unsigned int read = 0;
+
+    app_radio_sim_set_channel(&channel);
+    app_radio_sim_get_stats(&before);
+    for (unsigned int i = 0; i < SIM_QUEUE_LEN + 4; i++) {
+        app_radio_sim_inject(payload, sizeof(payload) - 1, -80, 7.5);
+    }
+    while (radio->receive(buf, sizeof(buf)) > 0) {
+        read++;
+    }
+    get_stats_delta(&before, &stats);
+    CHECK_EQ(read, SIM_QUEUE_LEN);
+    CHECK_EQ(stats.overflowed, 4);
+    CHECK_EQ(app_radio_sim_inject(buf, 0, -80, 7.5), ESP_ERR_INVALID_SIZE);
+}
+
+int main() {
+    app_lora_params_t params = {.frequency = FREQUENCY};
+    CHECK_EQ(radio->init(&params), ESP_OK);
+    CHECK_EQ(radio->configure(&params), ESP_OK);
+    CHECK_EQ(radio->start_rx(), ESP_OK);
+    test_channel_rates();
+    test_seed();
+    test_tuning();
+    test_overflow();
+    return check_failures("app_radio_sim_test");
+}
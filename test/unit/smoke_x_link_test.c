@@ -0,0 +1,92 @@
+#include <math.h>
+#include "check.h"
+#include "smoke_x_link.h"
+
+/* Loss estimates against the learned transmit interval, and the period ring */
+
+#define US 1000000LL
+#define PERIOD_SAMPLES 20
+
+static smoke_x_link_t link;
+
+/* A packet every gap_ms for count packets, from a transmitter at tx_ms */
+static int64_t receive(int64_t t, unsigned int count, uint32_t gap_ms,
+                       uint32_t tx_ms) {
+    for (unsigned int i = 0; i < count; i++) {
+        t += gap_ms * 1000LL;
+        smoke_x_link_update(0, -80, 7.5, t, t / US, tx_ms, &link);
+    }
+    return t;
+}
+
+/*
+ * A transmitter faster than the nominal 30 s loses nothing, yet a fixed
+ * 30 s interval would count a packet in 27.5 s as one, and a packet in
+ * 45 s as two
+ */
+static void test_learned_interval() {
+    int64_t t;
+    smoke_x_link_init();
+    t = receive(1 * US, 200, 27500, 27500);
+    CHECK(link.loss < 0.001);
+    CHECK_EQ(link.interval, 28);
+    // Every other packet missed
+    receive(t, 200, 55000, 27500);
+    CHECK(fabsf(link.loss - 0.5) < 0.01);
+}
+
+/* Before the interval has been learned, it's assumed to be nominal */
+static void test_unknown_interval() {
+    smoke_x_link_init();
+    receive(1 * US, 200, SMOKE_X_TX_INTERVAL * 3000, 0);
+    CHECK(fabsf(link.loss - 2.0 / 3) < 0.01);
+}
+
+/* A gap of more than 20 intervals is the transmitter off, not loss */
+static void test_long_gap() {
+    int64_t t;
+    smoke_x_link_init();
+    t = receive(1 * US, 100, 10000, 10000);
+    t = receive(t, 1, 10000 * 21, 10000);
+    CHECK(link.loss < 0.001);
+    receive(t, 1, 10000 * 20, 10000);
+    CHECK(link.loss > 0.09);
+}
+
+/* The ring keeps its newest periods in order as it goes round */
+static void test_ring() {
+    const unsigned int periods = 1000;
+    uint32_t period_ms = smoke_x_link_period() * 1000 / PERIOD_SAMPLES;
+    smoke_x_link_bucket_t buckets[64];
+    uint32_t oldest, end, index, last_time = 0;
+    unsigned int read = 0, out_of_order = 0;
+    size_t len;
+
+    smoke_x_link_init();
+    receive(1 * US, periods * PERIOD_SAMPLES, period_ms, period_ms);
+    smoke_x_link_range(0, &oldest, &end);
+    // Indexes carry on from the tests before
+    CHECK(end - oldest > 200 && end - oldest < periods);
+    index = oldest;
+    while ((len = smoke_x_link_read_buckets(0, &index, end, buckets,
+                                            sizeof(buckets) /
+                                                sizeof(buckets[0])))) {
+        for (size_t i = 0; i < len; i++) {
+            out_of_order += read && buckets[i].time !=
+                                        last_time + smoke_x_link_period();
+            last_time = buckets[i].time;
+            read++;
+        }
+    }
+    CHECK_EQ(read, end - oldest);
+    CHECK_EQ(out_of_order, 0);
+    CHECK_EQ(index, end);
+}
+
+int main() {
+    test_learned_interval();
+    test_unknown_interval();
+    test_long_gap();
+    test_ring();
+    return check_failures("smoke_x_link_test");
+}
@@ -0,0 +1,192 @@
+#include <string.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include "check.h"
+#include "smoke_x_log.h"
+
+/*
+ * The cook log on the simulated NOR flash, which only clears bits on write
+ * and erases whole sectors, restarted the way the receiver restarts: the
+ * write position is found again from the flash alone and the tail of the
+ * log replayed into a cleared history.
+ */
+
+#define TEST_SECTORS 4
+#define RECORD_SIZE 24
+#define RECORDS_PER_SECTOR (SPI_FLASH_SEC_SIZE / RECORD_SIZE)
+// A sector's first record is its header, the rest are samples
+#define SAMPLES_PER_SECTOR (RECORDS_PER_SECTOR - 1)
+#define BATCH_LEN 10
+
+static const esp_partition_t *partition;
+
+static int16_t temp_of(uint32_t seq, unsigned int probe) {
+    return (int16_t)(700 + seq % 400 + probe * 10);
+}
+
+static void append(unsigned int device, uint32_t seq) {
+    smoke_x_sample_t sample = {.seq = seq, .time = 1000 + seq * 30};
+    for (unsigned int i = 0; i < SMOKE_X_MAX_PROBES; i++) {
+        sample.temps[i] = temp_of(seq, i);
+    }
+    smoke_x_log_append(device, &sample);
+}
+
+static void append_range(uint32_t first, uint32_t end) {
+    for (uint32_t seq = first; seq != end; seq++) {
+        append(0, seq);
+    }
+}
+
+static void format() {
+    partition = shim_partition_add(SMOKE_X_LOG_PARTITION,
+                                   TEST_SECTORS * SPI_FLASH_SEC_SIZE);
+}
+
+/* Power back on, find the write position and restore the history */
+static void restart() {
+    shim_partition_power_on();
+    smoke_x_log_init();
+    for (unsigned int d = 0; d < SMOKE_X_MAX_DEVICES; d++) {
+        smoke_x_history_clear(d);
+    }
+    smoke_x_log_restore_history();
+}
+
+/*
+ * The restored history of device 0 has to be exactly the samples first to
+ * end, with the temperatures they were logged with
+ */
+static void check_restored(uint32_t first, uint32_t end) {
+    smoke_x_bucket_t out[1];
+    uint32_t oldest, newest_end, index;
+    smoke_x_history_tier_range(0, 0, &oldest, &newest_end);
+    CHECK_EQ(smoke_x_history_count(0), end - first);
+    if (first == end) {
+        return;
+    }
+    CHECK_EQ(oldest, first);
+    CHECK_EQ(newest_end, end);
+    for (unsigned int probe = 0; probe < SMOKE_X_MAX_PROBES; probe++) {
+        unsigned int wrong = 0;
+        index = oldest;
+        while (index != newest_end) {
+            uint32_t seq = index;
+            if (!smoke_x_history_read_buckets(0, 0, probe, &index, newest_end,
+                                              1, out, NULL, 1)) {
+                wrong++;
+                break;
+            }
+            wrong += out[0].avg != temp_of(seq, probe);
+        }
+        CHECK_EQ(wrong, 0);
+    }
+}
+
+/* The write position is found for every fill level of a sector */
+static void test_tail_bisect() {
+    for (uint32_t n = 0; n <= 2 * RECORDS_PER_SECTOR; n++) {
+        format();
+        smoke_x_log_init();
+        append_range(0, n);
+        smoke_x_log_flush();
+        restart();
+        check_restored(0, n);
+        // Carries on right after the last record found
+        append_range(n, n + 3);
+        smoke_x_log_flush();
+        restart();
+        check_restored(0, n + 3);
+    }
+}
+
+/*
+ * Once every sector has been written the oldest is erased for the next one,
+ * and everything but the sector being filled next is restored
+ */
+static void test_sector_wrap() {
+    uint32_t end = 0;
+    format();
+    smoke_x_log_init();
+    for (unsigned int round = 0; round < 5; round++) {
+        append_range(end, end + 3 * SAMPLES_PER_SECTOR + 17);
+        end += 3 * SAMPLES_PER_SECTOR + 17;
+        smoke_x_log_flush();
+        restart();
+        // The sector being filled and the full ones before it
+        uint32_t in_last = (end - 1) % SAMPLES_PER_SECTOR + 1;
+        uint32_t kept = in_last + (TEST_SECTORS - 1) * SAMPLES_PER_SECTOR;
+        check_restored(end > kept ? end - kept : 0, end);
+    }
+    CHECK(shim_partition_erases(partition) > TEST_SECTORS);
+}
+
+/*
+ * Power lost partway through writing a batch, at every byte of it, whether
+ * the batch fits in a sector or starts the next one. Only whole records
+ * come back, as an unbroken run from the first sample, and the log keeps
+ * working afterwards.
+ */
+static void test_torn_writes() {
+    const uint32_t starts[] = {15, SAMPLES_PER_SECTOR - 4};
+    // The failed writes are expected
+    esp_log_level_set("smoke_x_log", ESP_LOG_NONE);
+    for (unsigned int s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+        uint32_t before = starts[s] - starts[s] % BATCH_LEN;
+        long batch_bytes = (BATCH_LEN + 1) * RECORD_SIZE;
+        for (long bytes = 0; bytes <= batch_bytes; bytes++) {
+            format();
+            smoke_x_log_init();
+            append_range(0, before);
+            smoke_x_log_flush();
+            shim_partition_power_loss(bytes);
+            append_range(before, before + BATCH_LEN);
+            restart();
+
+            uint32_t end = smoke_x_history_count(0);
+            CHECK(end >= before && end <= before + BATCH_LEN);
+            check_restored(0, end);
+
+            append_range(end, end + BATCH_LEN);
+            smoke_x_log_flush();
+            restart();
+            check_restored(0, end + BATCH_LEN);
+        }
+    }
+    esp_log_level_set("smoke_x_log", ESP_LOG_WARN);
+}
+
+/* A new cook marker drops what came before it, for its device only */
+static void test_new_cook() {
+    format();
+    smoke_x_log_init();
+    append_range(0, 50);
+    append(1, 0);
+    smoke_x_log_new_cook(0, 50);
+    append_range(50, 70);
+    smoke_x_log_flush();
+    restart();
+    check_restored(50, 70);
+    CHECK_EQ(smoke_x_history_count(1), 1);
+}
+
+/* Buffered samples are written out by a software restart */
+static void test_shutdown_flush() {
+    format();
+    smoke_x_log_init();
+    append_range(0, 7);
+    shim_shutdown();
+    restart();
+    check_restored(0, 7);
+}
+
+int main() {
+    smoke_x_history_init();
+    test_tail_bisect();
+    test_sector_wrap();
+    test_torn_writes();
+    test_new_cook();
+    test_shutdown_flush();
+    return check_failures("smoke_x_log_test");
+}
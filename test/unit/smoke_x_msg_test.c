@@ -0,0 +1,162 @@
+#include <string.h>
+#include <esp_log.h>
+#include "check.h"
+#include "smoke_x_msg.h"
+
+/* Messages as the transmitter sends them, and the ways they go wrong */
+
+static esp_err_t parse(const char *buf, smoke_x_msg_t *msg) {
+    return smoke_x_msg_parse(buf, strlen(buf), msg);
+}
+
+static void check_probe(const smoke_x_msg_probe_t *probe, bool attached,
+                        int16_t temp, bool alarm, int16_t max_temp,
+                        int16_t min_temp) {
+    CHECK_EQ(probe->attached, attached);
+    CHECK_EQ(probe->temp, temp);
+    CHECK_EQ(probe->alarm, alarm);
+    CHECK_EQ(probe->max_temp, max_temp);
+    CHECK_EQ(probe->min_temp, min_temp);
+}
+
+static void test_sync() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("020001,|dhHWl,160,32,69,54,", &msg), ESP_OK);
+    CHECK_EQ(msg.type, SMOKE_X_MSG_SYNC);
+    CHECK(!strcmp(msg.device_id, "|dhHWl"));
+    // 54 69 32 160, least significant byte first
+    CHECK_EQ(msg.frequency, 0x364520a0);
+    CHECK_EQ(msg.frequency, 910500000);
+    CHECK_EQ(msg.num_probes, 0);
+
+    // Bytes of the frequency out of range
+    CHECK_EQ(parse("020001,|dhHWl,256,32,69,54,", &msg), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("020001,|dhHWl,-1,32,69,54,", &msg), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("020001,|dhHWl,16x,32,69,54,", &msg), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("020001,|dhHWl,,32,69,54,", &msg), ESP_ERR_INVALID_ARG);
+}
+
+static void test_success() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("|dhHWl,SUCCESS,", &msg), ESP_OK);
+    CHECK_EQ(msg.type, SMOKE_X_MSG_SUCCESS);
+    CHECK(!strcmp(msg.device_id, "|dhHWl"));
+}
+
+static void test_x2() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("|ABC12,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,0,", &msg),
+             ESP_OK);
+    CHECK_EQ(msg.type, SMOKE_X_MSG_STATE);
+    CHECK(!strcmp(msg.device_id, "|ABC12"));
+    CHECK_EQ(msg.num_probes, 2);
+    CHECK(msg.fahrenheit);
+    CHECK(!msg.new_alarm);
+    CHECK(!msg.billows_attached);
+    check_probe(&msg.probes[0], true, 701, true, 185, 32);
+    check_probe(&msg.probes[1], true, -5, true, 91, 50);
+
+    // Celsius, a new alarm, an unplugged probe and a billows
+    CHECK_EQ(parse("|ABC12,0,0,2,0,701,0,185,32,3,0,0,91,50,1,0,", &msg),
+             ESP_OK);
+    CHECK(!msg.fahrenheit);
+    CHECK(msg.new_alarm);
+    CHECK(msg.billows_attached);
+    check_probe(&msg.probes[0], true, 701, false, 185, 32);
+    check_probe(&msg.probes[1], false, 0, false, 91, 50);
+}
+
+static void test_x4() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("|dhHWl,0,1,0,0,848,0,225,0,0,457,0,203,0,0,487,0,195,0,"
+                   "3,0,0,0,0,1,0,",
+                   &msg),
+             ESP_OK);
+    CHECK_EQ(msg.type, SMOKE_X_MSG_STATE);
+    CHECK_EQ(msg.num_probes, 4);
+    CHECK(msg.fahrenheit);
+    CHECK(msg.billows_attached);
+    check_probe(&msg.probes[0], true, 848, false, 225, 0);
+    check_probe(&msg.probes[1], true, 457, false, 203, 0);
+    check_probe(&msg.probes[2], true, 487, false, 195, 0);
+    check_probe(&msg.probes[3], false, 0, false, 0, 0);
+}
+
+/* Temperatures are deci-degrees, with their sign, within an int16_t */
+static void test_temp() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("|ABC12,0,1,0,0,0,0,0,0,0,-400,0,0,0,0,0,", &msg), ESP_OK);
+    CHECK_EQ(msg.probes[0].temp, 0);
+    CHECK_EQ(msg.probes[1].temp, -400);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,32767,0,0,0,0,-32768,0,0,0,0,0,", &msg),
+             ESP_OK);
+    CHECK_EQ(msg.probes[0].temp, 32767);
+    CHECK_EQ(msg.probes[1].temp, -32768);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,32768,0,0,0,0,0,0,0,0,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,0,0,0,0,0,-32769,0,0,0,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+    // Far too many digits to accumulate
+    CHECK_EQ(parse("|ABC12,0,1,0,0,99999999999999,0,0,0,0,0,0,0,0,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,7.5,0,0,0,0,0,0,0,0,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,-,0,0,0,0,0,0,0,0,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+}
+
+/* IDs fill device_id with its terminator, a longer one is rejected */
+static void test_device_id() {
+    smoke_x_msg_t msg;
+    CHECK_EQ(parse("|ABCDEF,SUCCESS,", &msg), ESP_OK);
+    CHECK(!strcmp(msg.device_id, "|ABCDEF"));
+    CHECK_EQ(parse("|ABCDEFG,SUCCESS,", &msg), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("|ABCDEFGHIJKLMNOPQRSTUVWXYZ,SUCCESS,", &msg),
+             ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse(",SUCCESS,", &msg), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("020001,|ABCDEFGH,160,32,69,54,", &msg),
+             ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("|ABCDEFGH,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,0,", &msg),
+             ESP_ERR_INVALID_SIZE);
+}
+
+/* Only the field count tells families apart, anything else is rejected */
+static void test_framing() {
+    smoke_x_msg_t msg;
+    const char *x2 = "|ABC12,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,0,";
+    CHECK_EQ(parse("", &msg), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("|dhHWl", &msg), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("|dhHWl,SUCCESS,EXTRA,", &msg), ESP_ERR_INVALID_SIZE);
+    // A field short, and a field too many
+    CHECK_EQ(parse("|ABC12,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,", &msg),
+             ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,701,1,185,32,0,-5,1,91,50,0,0,0,", &msg),
+             ESP_ERR_INVALID_SIZE);
+    // Far too many fields
+    char many[200];
+    memset(many, ',', sizeof(many) - 1);
+    many[sizeof(many) - 1] = '\0';
+    CHECK_EQ(parse(many, &msg), ESP_ERR_INVALID_SIZE);
+    // Only len bytes are read, and no further than a NUL
+    CHECK_EQ(smoke_x_msg_parse(x2, strlen(x2) - 1, &msg), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(smoke_x_msg_parse("|dhHWl,SUCCESS,\0,,,", 20, &msg), ESP_OK);
+    CHECK_EQ(msg.type, SMOKE_X_MSG_SUCCESS);
+    // A failed parse leaves nothing of a previous message behind
+    CHECK_EQ(parse(x2, &msg), ESP_OK);
+    CHECK_EQ(parse("|ABC12,0,1,0,0,x,1,185,32,0,-5,1,91,50,0,0,", &msg),
+             ESP_ERR_INVALID_ARG);
+    CHECK_EQ(msg.probes[1].temp, 0);
+}
+
+int main() {
+    // The rejected messages are expected
+    esp_log_level_set("smoke_x_msg", ESP_LOG_NONE);
+    test_sync();
+    test_success();
+    test_x2();
+    test_x4();
+    test_temp();
+    test_device_id();
+    test_framing();
+    return check_failures("smoke_x_msg_test");
+}
@@ -0,0 +1,100 @@
+#include "check.h"
+#include "smoke_x_scan.h"
+
+/*
+ * The pairing scan policy, stepped as the tune task steps it, against a
+ * radio whose CAD takes 2 symbols at the Smoke X settings
+ */
+
+#define X2_FREQ 920000000
+#define X4_FREQ 915000000
+#define CAD_MS 8
+// The sync message preamble the scan has to catch on any frequency
+#define PREAMBLE_MS 40
+#define DWELL_MS 1500
+#define BLIND_DWELL_MS 3300
+#define MAX_DWELLS 4
+
+static const uint32_t freqs[] = {X2_FREQ, X4_FREQ};
+
+/* Every check sleeps, and every frequency is checked within a preamble */
+static void test_hop() {
+    smoke_x_scan_t scan;
+    uint32_t last_check[2] = {0, 0};
+    uint32_t now = 0;
+    smoke_x_scan_init(&scan, freqs, 2, true);
+    for (unsigned int i = 0; i < 1000; i++) {
+        uint32_t freq = smoke_x_scan_frequency(&scan);
+        unsigned int f = freq == X4_FREQ;
+        CHECK(freq == freqs[f]);
+        if (i >= 2) {
+            CHECK(now - last_check[f] + CAD_MS <= PREAMBLE_MS);
+        }
+        last_check[f] = now;
+        now += CAD_MS;
+        uint32_t wait_ms = smoke_x_scan_update(&scan, false);
+        CHECK(wait_ms > 0);
+        now += wait_ms;
+    }
+    CHECK_EQ(scan.checks, 1000);
+    CHECK_EQ(scan.detections, 0);
+}
+
+/* Activity holds the scan on a frequency, a few dwells at most */
+static void test_dwell() {
+    smoke_x_scan_t scan;
+    smoke_x_scan_init(&scan, freqs, 2, true);
+    CHECK_EQ(smoke_x_scan_frequency(&scan), X2_FREQ);
+    for (unsigned int i = 0; i < MAX_DWELLS; i++) {
+        CHECK_EQ(smoke_x_scan_update(&scan, true), DWELL_MS);
+        CHECK_EQ(smoke_x_scan_frequency(&scan), X2_FREQ);
+    }
+    // Some other LoRa device, move on
+    CHECK(smoke_x_scan_update(&scan, true) < DWELL_MS);
+    CHECK_EQ(smoke_x_scan_frequency(&scan), X4_FREQ);
+    CHECK_EQ(smoke_x_scan_update(&scan, true), DWELL_MS);
+    CHECK_EQ(smoke_x_scan_frequency(&scan), X4_FREQ);
+    // Quiet again, and back to the first frequency with its dwells reset
+    CHECK(smoke_x_scan_update(&scan, false) < DWELL_MS);
+    CHECK_EQ(smoke_x_scan_frequency(&scan), X2_FREQ);
+    CHECK_EQ(smoke_x_scan_update(&scan, true), DWELL_MS);
+    CHECK_EQ(scan.checks, 8);
+    CHECK_EQ(scan.detections, 7);
+}
+
+/* Without CAD every frequency is listened to for a whole sync burst */
+static void test_blind() {
+    smoke_x_scan_t scan;
+    smoke_x_scan_init(&scan, freqs, 2, false);
+    for (unsigned int i = 0; i < 4; i++) {
+        CHECK_EQ(smoke_x_scan_frequency(&scan), freqs[i % 2]);
+        CHECK_EQ(smoke_x_scan_update(&scan, i == 1), BLIND_DWELL_MS);
+    }
+    CHECK_EQ(scan.checks, 0);
+    CHECK_EQ(scan.detections, 0);
+}
+
+/* No frequencies sleeps, more than fit are left out */
+static void test_limits() {
+    const uint32_t many[] = {902000000, 905000000, 910000000,
+                             915000000, 920000000, 925000000};
+    smoke_x_scan_t scan;
+    smoke_x_scan_init(&scan, freqs, 0, true);
+    CHECK_EQ(smoke_x_scan_frequency(&scan), 0);
+    CHECK(smoke_x_scan_update(&scan, true) > 0);
+    smoke_x_scan_init(&scan, many, 6, true);
+    CHECK_EQ(scan.num_freqs, SMOKE_X_SCAN_MAX_FREQS);
+    for (unsigned int i = 0; i < 2 * SMOKE_X_SCAN_MAX_FREQS; i++) {
+        CHECK_EQ(smoke_x_scan_frequency(&scan),
+                 many[i % SMOKE_X_SCAN_MAX_FREQS]);
+        smoke_x_scan_update(&scan, false);
+    }
+}
+
+int main() {
+    test_hop();
+    test_dwell();
+    test_blind();
+    test_limits();
+    return check_failures("smoke_x_scan_test");
+}
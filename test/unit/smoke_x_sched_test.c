@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include "check.h"
+#include "smoke_x_sched.h"
+
+/*
+ * The receive schedule for two transmitters, stepped in ms as the radio task
+ * steps it
+ */
+
+#define X2_FREQ 920000000
+#define X4_FREQ 915000000
+#define INTERVAL_MS (SMOKE_X_TX_INTERVAL * 1000)
+#define LEAD_MS 1000
+#define LATE_MS 1500
+#define MAX_MISSES 6
+#define HUNT_MS (INTERVAL_MS + LATE_MS)
+
+static smoke_x_sched_t sched;
+
+/* A device whose cadence is known, with its next packet due at next */
+static void learned(unsigned int device, uint32_t frequency, int64_t next) {
+    smoke_x_sched_set_device(&sched, device, frequency);
+    smoke_x_sched_received(&sched, device, next - 2 * INTERVAL_MS);
+    smoke_x_sched_received(&sched, device, next - INTERVAL_MS);
+}
+
+/* A transmitter 1% slow is followed, and a larger jump isn't learned */
+static void test_drift() {
+    const smoke_x_sched_device_t *dev = &sched.devices[0];
+    int64_t t = 1000;
+
+    smoke_x_sched_init(&sched);
+    smoke_x_sched_set_device(&sched, 0, X2_FREQ);
+    CHECK_EQ(dev->interval, INTERVAL_MS);
+    for (unsigned int i = 0; i < 30; i++) {
+        smoke_x_sched_received(&sched, 0, t);
+        t += INTERVAL_MS + 300;
+    }
+    CHECK(labs((long)dev->interval - (INTERVAL_MS + 300)) < 4);
+    CHECK_EQ(dev->next_expected, dev->last_rx + dev->interval);
+    // Restarted, the interval stays
+    smoke_x_sched_received(&sched, 0, dev->last_rx + INTERVAL_MS * 3 / 2);
+    CHECK(labs((long)dev->interval - (INTERVAL_MS + 300)) < 4);
+}
+
+/* A second copy of a packet neither moves the cadence nor counts */
+static void test_duplicate() {
+    const smoke_x_sched_device_t *dev = &sched.devices[0];
+
+    smoke_x_sched_init(&sched);
+    learned(0, X2_FREQ, 100000);
+    smoke_x_sched_received(&sched, 0, 100000);
+    CHECK_EQ(dev->expected, 2);
+    CHECK_EQ(dev->caught, 2);
+    smoke_x_sched_received(&sched, 0, 100200);
+    CHECK_EQ(dev->last_rx, 100000);
+    CHECK_EQ(dev->next_expected, 100000 + INTERVAL_MS);
+    CHECK_EQ(dev->interval, INTERVAL_MS);
+    CHECK_EQ(dev->expected, 2);
+    CHECK_EQ(dev->caught, 2);
+}
+
+/* The radio is on the frequency from LEAD_MS before to LATE_MS after */
+static void test_window() {
+    const int64_t next = 100000;
+    uint32_t wait_ms;
+
+    smoke_x_sched_init(&sched);
+    learned(0, X2_FREQ, next);
+    CHECK_EQ(smoke_x_sched_next(&sched, next - LEAD_MS - 500, &wait_ms), -1);
+    CHECK_EQ(wait_ms, 500);
+    CHECK_EQ(smoke_x_sched_next(&sched, next - LEAD_MS, &wait_ms), 0);
+    CHECK_EQ(wait_ms, LEAD_MS + LATE_MS);
+    CHECK_EQ(smoke_x_sched_next(&sched, next + LATE_MS, &wait_ms), 0);
+    CHECK_EQ(sched.devices[0].misses, 0);
+    // Missed, the next window is an interval on
+    CHECK_EQ(smoke_x_sched_next(&sched, next + LATE_MS + 1, &wait_ms), -1);
+    CHECK_EQ(sched.devices[0].misses, 1);
+    CHECK_EQ(sched.devices[0].next_expected, next + INTERVAL_MS);
+}
+
+/* After MAX_MISSES windows in a row without a packet, it is hunted for */
+static void test_lost() {
+    const smoke_x_sched_device_t *dev = &sched.devices[0];
+    int64_t next = 100000;
+    uint32_t wait_ms;
+
+    smoke_x_sched_init(&sched);
+    learned(0, X2_FREQ, next);
+    for (unsigned int i = 1; i < MAX_MISSES; i++) {
+        CHECK_EQ(smoke_x_sched_next(&sched, next + LATE_MS + 1, &wait_ms),
+                 -1);
+        CHECK_EQ(dev->misses, i);
+        next += INTERVAL_MS;
+        CHECK_EQ(smoke_x_sched_next(&sched, next, &wait_ms), 0);
+    }
+    CHECK_EQ(smoke_x_sched_next(&sched, next + LATE_MS + 1, &wait_ms), 0);
+    CHECK_EQ(dev->next_expected, 0);
+    CHECK_EQ(dev->misses, 0);
+    // Found again, back to windows
+    smoke_x_sched_received(&sched, 0, next + 10000);
+    CHECK_EQ(dev->next_expected, next + 10000 + INTERVAL_MS);
+    CHECK_EQ(smoke_x_sched_next(&sched, next + 11000, &wait_ms), -1);
+}
+
+/* Devices being hunted for take turns a little longer than the interval */
+static void test_hunt_turns() {
+    int64_t t = 1000;
+    uint32_t wait_ms;
+    int first, second;
+
+    smoke_x_sched_init(&sched);
+    CHECK_EQ(smoke_x_sched_next(&sched, t, &wait_ms), -1);
+    CHECK(wait_ms > 0);
+    smoke_x_sched_set_device(&sched, 0, X2_FREQ);
+    smoke_x_sched_set_device(&sched, 1, X4_FREQ);
+    first = smoke_x_sched_next(&sched, t, &wait_ms);
+    CHECK(first >= 0);
+    CHECK(wait_ms > 0 && wait_ms <= HUNT_MS);
+    second = !first;
+    CHECK_EQ(smoke_x_sched_next(&sched, t + HUNT_MS - 1, &wait_ms), first);
+    CHECK_EQ(wait_ms, 1);
+    CHECK_EQ(smoke_x_sched_next(&sched, t + HUNT_MS, &wait_ms), second);
+    CHECK_EQ(smoke_x_sched_next(&sched, t + 2 * HUNT_MS, &wait_ms), first);
+    // Found, the other one has every turn
+    smoke_x_sched_received(&sched, first, t + 2 * HUNT_MS + 100);
+    CHECK_EQ(smoke_x_sched_next(&sched, t + 2 * HUNT_MS + 200, &wait_ms),
+             second);
+    CHECK_EQ(smoke_x_sched_next(&sched, t + 3 * HUNT_MS + 200, &wait_ms),
+             second);
+}
+
+/* Of overlapping windows, the one whose packet is due first wins */
+static void test_overlap() {
+    uint32_t wait_ms;
+
+    smoke_x_sched_init(&sched);
+    learned(0, X2_FREQ, 61000);
+    learned(1, X4_FREQ, 60500);
+    CHECK_EQ(smoke_x_sched_next(&sched, 60000, &wait_ms), 1);
+    CHECK_EQ(wait_ms, 500 + LATE_MS);
+    smoke_x_sched_received(&sched, 1, 60500);
+    CHECK_EQ(smoke_x_sched_next(&sched, 60500, &wait_ms), 0);
+    CHECK_EQ(wait_ms, 500 + LATE_MS);
+}
+
+/* Packets due once the cadence is known, and of them those received */
+static void test_catch_rate() {
+    const smoke_x_sched_device_t *dev = &sched.devices[0];
+    uint32_t wait_ms;
+
+    smoke_x_sched_init(&sched);
+    smoke_x_sched_set_device(&sched, 0, X2_FREQ);
+    smoke_x_sched_received(&sched, 0, 1000);
+    CHECK_EQ(dev->expected, 0);
+    smoke_x_sched_received(&sched, 0, 31000);
+    CHECK_EQ(dev->expected, 1);
+    CHECK_EQ(dev->caught, 1);
+    // One missed, then the next one received
+    smoke_x_sched_next(&sched, 61000 + LATE_MS + 1, &wait_ms);
+    CHECK_EQ(dev->expected, 2);
+    CHECK_EQ(dev->caught, 1);
+    smoke_x_sched_received(&sched, 0, 91000);
+    CHECK_EQ(dev->expected, 3);
+    CHECK_EQ(dev->caught, 2);
+    CHECK_EQ(dev->interval, INTERVAL_MS);
+    // Reset with the device
+    smoke_x_sched_set_device(&sched, 0, X2_FREQ);
+    CHECK_EQ(dev->expected, 0);
+    CHECK_EQ(dev->caught, 0);
+}
+
+int main() {
+    test_drift();
+    test_duplicate();
+    test_window();
+    test_lost();
+    test_hunt_turns();
+    test_overlap();
+    test_catch_rate();
+    return check_failures("smoke_x_sched_test");
+}
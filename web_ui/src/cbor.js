@@ -0,0 +1,96 @@
+// Minimal CBOR (RFC 8949) decoder covering what the receiver sends: integers,
+// strings, arrays and maps (definite or indefinite length), booleans and null
+export function decodeCbor(buffer) {
+  const view = new DataView(buffer)
+  const text = new TextDecoder()
+  let offset = 0
+
+  function readArgument(info) {
+    if (info < 24) return info
+    let value
+    switch (info) {
+      case 24:
+        value = view.getUint8(offset)
+        offset += 1
+        return value
+      case 25:
+        value = view.getUint16(offset)
+        offset += 2
+        return value
+      case 26:
+        value = view.getUint32(offset)
+        offset += 4
+        return value
+      case 27:
+        value = Number(view.getBigUint64(offset))
+        offset += 8
+        return value
+      case 31:
+        return -1
+      default:
+        throw new Error("Invalid CBOR argument " + info)
+    }
+  }
+
+  // Returns BREAK when an indefinite length item ends
+  const BREAK = Symbol("break")
+
+  function readItem() {
+    const initial = view.getUint8(offset++)
+    const major = initial >> 5
+    const info = initial & 31
+
+    if (major == 7) {
+      switch (info) {
+        case 20:
+          return false
+        case 21:
+          return true
+        case 22:
+        case 23:
+          return null
+        case 31:
+          return BREAK
+        default:
+          throw new Error("Unsupported CBOR simple value " + info)
+      }
+    }
+
+    const length = readArgument(info)
+    switch (major) {
+      case 0:
+        return length
+      case 1:
+        return -1 - length
+      case 2:
+      case 3: {
+        if (length < 0) throw new Error("Unsupported indefinite string")
+        const bytes = new Uint8Array(buffer, offset, length)
+        offset += length
+        return major == 3 ? text.decode(bytes) : bytes
+      }
+      case 4: {
+        const array = []
+        for (let i = 0; length < 0 || i < length; i++) {
+          const item = readItem()
+          if (item === BREAK) break
+          array.push(item)
+        }
+        return array
+      }
+      case 5: {
+        const map = {}
+        for (let i = 0; length < 0 || i < length; i++) {
+          const key = readItem()
+          if (key === BREAK) break
+          map[key] = readItem()
+        }
+        return map
+      }
+      default:
+        throw new Error("Unsupported CBOR major type " + major)
+    }
+  }
+
+  return readItem()
+}
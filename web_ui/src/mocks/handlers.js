@@ -88,6 +88,29 @@ export default [
           ],
         },
         billows: false,
+        oldest_seq: 0,
+        start_seq: 0,
+        next_seq: 102,
+        time: Math.floor(Date.now() / 1000),
+        clock_synced: true,
+        start_time: Math.floor(Date.now() / 1000) - 101 * 30,
+        time_offsets: Array.from({ length: 102 }, (_, i) => i * 30),
+        link: {
+          rssi: -87,
+          snr: 8,
+          packet_interval: 30,
+          packet_loss: 3,
+          period: 600,
+          history: Array.from({ length: 6 }, (_, i) => [
+            Math.floor(Date.now() / 1000) - 101 * 30 + i * 600,
+            -92,
+            -87,
+            -81,
+            8,
+            i === 5 ? 1 : 19,
+            i === 2 ? 1 : 0,
+          ]),
+        },
       })
     )
   }),
@@ -120,6 +143,22 @@ export default [
         deviceId: "|ABC12",
         currentFrequency: 915000000,
         deviceModel: "X2",
+        syncTime: 1250,
+        retuneTime: 180,
+        isPairing: false,
+        maxDevices: 2,
+        devices: [
+          {
+            device: 0,
+            deviceId: "|ABC12",
+            deviceModel: "X2",
+            frequency: 915000000,
+            interval: 30012,
+            expected: 240,
+            caught: 238,
+            catchRate: 99.1,
+          },
+        ],
       })
     )
   }),
@@ -141,6 +180,10 @@ Paste Certificate Here\n\
         ha_status_topic: "homeassistant/status",
         ha_birth_payload: "online",
         state_topic: "homeassistant/smoke-x/state",
+        deadband: 0.5,
+        min_interval: 10,
+        max_interval: 60,
+        sensor_topics: false,
       })
     )
   }),